@@ -0,0 +1,157 @@
+// Measures allocator throughput with several threads allocating and
+// freeing small blocks at once. Each thread keeps a window of live
+// blocks and replaces a random one per step, and every few steps hands a
+// block to its neighbour to free, so cross-thread frees are exercised.
+// The threads are left unpinned so they can spread over the CPUs.
+//
+// Usage: alloc_bench [--json] [operations per thread] [max threads] [rounds]
+#include "bench.h"
+#include "../memory_manager.h"
+#include <pthread.h>
+
+#define WINDOW 1024
+#define MAX_THREADS 64
+
+typedef struct
+{
+    long operations;
+    unsigned int seed;
+    void *handoff; // a block for the next thread to free
+    long corrupted;
+} Worker;
+
+static Worker workers[MAX_THREADS];
+static int thread_count;
+static pthread_barrier_t start_barrier;
+
+// Mostly the small sizes the shell allocates, with a few medium ones
+static size_t random_size(unsigned int *seed)
+{
+    unsigned int r = rand_r(seed);
+    return (r % 16) ? 8 + r % 248 : 512 + r % 3584;
+}
+
+static void *run_worker(void *arg)
+{
+    Worker *self = arg;
+    Worker *next = &workers[(self - workers + 1) % thread_count];
+    unsigned char *blocks[WINDOW];
+    unsigned char tags[WINDOW];
+
+    for (int i = 0; i < WINDOW; i++)
+    {
+        tags[i] = (unsigned char)i;
+        blocks[i] = shell_malloc(random_size(&self->seed));
+        blocks[i][0] = tags[i];
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    for (long op = 0; op < self->operations; op++)
+    {
+        int i = rand_r(&self->seed) % WINDOW;
+        if (blocks[i][0] != tags[i])
+        {
+            self->corrupted++;
+        }
+
+        // Pass every 64th block on instead of freeing it here
+        if ((op & 63) == 0 && !__atomic_load_n(&next->handoff, __ATOMIC_ACQUIRE))
+        {
+            __atomic_store_n(&next->handoff, blocks[i], __ATOMIC_RELEASE);
+        }
+        else
+        {
+            shell_free(blocks[i]);
+        }
+        void *handed = __atomic_load_n(&self->handoff, __ATOMIC_ACQUIRE);
+        if (handed)
+        {
+            shell_free(handed);
+            __atomic_store_n(&self->handoff, NULL, __ATOMIC_RELEASE);
+        }
+
+        tags[i]++;
+        blocks[i] = shell_malloc(random_size(&self->seed));
+        blocks[i][0] = tags[i];
+    }
+    pthread_barrier_wait(&start_barrier);
+
+    for (int i = 0; i < WINDOW; i++)
+    {
+        shell_free(blocks[i]);
+    }
+    return NULL;
+}
+
+// Run `threads` workers and return the elapsed wall time
+static double run_round(int threads, long operations)
+{
+    pthread_t ids[MAX_THREADS];
+    thread_count = threads;
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i] = (Worker){operations, (unsigned int)i * 7919 + 1, NULL, 0};
+        pthread_create(&ids[i], NULL, run_worker, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = bench_now_ns();
+    pthread_barrier_wait(&start_barrier);
+    double elapsed = (bench_now_ns() - start) / 1e9;
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+        if (workers[i].handoff)
+        {
+            shell_free(workers[i].handoff);
+        }
+        if (workers[i].corrupted)
+        {
+            fprintf(stderr, "thread %d: %ld corrupted blocks\n", i, workers[i].corrupted);
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_barrier_destroy(&start_barrier);
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init("alloc_bench", &argc, argv);
+    long operations = argc > 1 ? atol(argv[1]) : 1000000;
+    int max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    if (max_threads < 1)
+        max_threads = 1;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    init_memory_manager(1024 * 1024);
+    run_round(1, operations / 10 + 1); // warm up
+
+    BenchSamples samples = {0};
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        for (int round = 0; round < rounds; round++)
+        {
+            double elapsed = run_round(threads, operations);
+            bench_sample(&samples, threads * operations / elapsed / 1e6);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "threads=%d", threads);
+        bench_report(name, "Mops/s", &samples);
+    }
+    bench_note("one operation is a free and an allocation; %ld online CPUs", sysconf(_SC_NPROCESSORS_ONLN));
+    free(samples.values);
+
+    MemoryStats stats = get_memory_stats();
+    if (stats.current_usage != 0)
+    {
+        fprintf(stderr, "%zu bytes still allocated\n", stats.current_usage);
+        return EXIT_FAILURE;
+    }
+    cleanup_memory_manager();
+    return EXIT_SUCCESS;
+}
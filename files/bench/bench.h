@@ -0,0 +1,158 @@
+// Shared helpers for the benchmarks. Each benchmark warms up before it
+// measures, can pin itself to one CPU, and reports every case as
+// percentiles over its samples: a table row by default, or with --json
+// one JSON object per line, so results from two builds can be diffed.
+//
+// BENCH_CPU picks the CPU to pin to (default: the last online one);
+// BENCH_CPU=-1 leaves the process unpinned.
+//
+// Include this before any other header.
+#ifndef BENCH_H
+#define BENCH_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sched_setaffinity
+#endif
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct
+{
+    double *values;
+    size_t count;
+    size_t capacity;
+} BenchSamples;
+
+static const char *bench_name = "";
+static int bench_json = 0;
+static int bench_header_printed = 0;
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Take --json out of the arguments so the benchmark sees only its own
+static inline void bench_init(const char *name, int *argc, char **argv)
+{
+    bench_name = name;
+    int kept = 1;
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+            bench_json = 1;
+        else
+            argv[kept++] = argv[i];
+    }
+    *argc = kept;
+    argv[kept] = NULL;
+}
+
+// Keep the scheduler from moving the benchmark between CPUs mid-run
+static inline void bench_pin_cpu(void)
+{
+    const char *requested = getenv("BENCH_CPU");
+    int cpu = requested ? atoi(requested) : (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (cpu < 0)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        perror("sched_setaffinity");
+}
+
+static inline void bench_sample(BenchSamples *samples, double value)
+{
+    if (samples->count == samples->capacity)
+    {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 64;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(double));
+        if (!samples->values)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    samples->values[samples->count++] = value;
+}
+
+static inline int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted samples
+static inline double bench_percentile(const BenchSamples *samples, double percent)
+{
+    size_t rank = (size_t)(percent / 100 * samples->count + 0.5);
+    if (rank > 0)
+        rank--;
+    if (rank >= samples->count)
+        rank = samples->count - 1;
+    return samples->values[rank];
+}
+
+// Print one case and empty the samples for the next
+static inline void bench_report(const char *name, const char *unit, BenchSamples *samples)
+{
+    if (samples->count == 0)
+        return;
+    qsort(samples->values, samples->count, sizeof(double), compare_doubles);
+
+    double sum = 0;
+    for (size_t i = 0; i < samples->count; i++)
+        sum += samples->values[i];
+    double mean = sum / samples->count;
+    double min = samples->values[0];
+    double max = samples->values[samples->count - 1];
+    double p50 = bench_percentile(samples, 50);
+    double p90 = bench_percentile(samples, 90);
+    double p99 = bench_percentile(samples, 99);
+
+    if (bench_json)
+    {
+        printf("{\"bench\": \"%s\", \"case\": \"%s\", \"unit\": \"%s\", \"n\": %zu, \"mean\": %.6g, "
+               "\"min\": %.6g, \"p50\": %.6g, \"p90\": %.6g, \"p99\": %.6g, \"max\": %.6g}\n",
+               bench_name, name, unit, samples->count, mean, min, p50, p90, p99, max);
+    }
+    else
+    {
+        if (!bench_header_printed)
+        {
+            printf("%-26s %-8s %7s %11s %11s %11s %11s %11s %11s\n", bench_name, "unit", "n", "mean", "min", "p50",
+                   "p90", "p99", "max");
+            bench_header_printed = 1;
+        }
+        printf("%-26s %-8s %7zu %11.5g %11.5g %11.5g %11.5g %11.5g %11.5g\n", name, unit, samples->count, mean, min,
+               p50, p90, p99, max);
+    }
+    fflush(stdout);
+    samples->count = 0;
+}
+
+// Extra context for a human reader; left out of the JSON output
+static inline void bench_note(const char *format, ...)
+{
+    if (bench_json)
+        return;
+    va_list args;
+    va_start(args, format);
+    putchar('(');
+    vprintf(format, args);
+    printf(")\n");
+    va_end(args);
+}
+
+#endif // BENCH_H
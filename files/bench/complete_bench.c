@@ -0,0 +1,117 @@
+// Measures command completion against a PATH directory holding tens of
+// thousands of executables: building the trie, completing prefixes that
+// match everything, many, a few or one name, and picking up a new
+// executable through inotify.
+//
+// Usage: complete_bench [--json] [executables] [completions]
+#include "bench.h"
+#include "../shell.h"
+#include <sys/stat.h>
+
+static const char *stems[] = {"git", "gcc", "python", "perl", "ls", "ld", "make", "mk", "docker", "dpkg"};
+
+#define STEM_COUNT (sizeof(stems) / sizeof(stems[0]))
+
+static void create_executable(const char *dir, const char *name)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if (fd == -1)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+static double time_completion(const char *line, size_t *total)
+{
+    Completions result;
+    uint64_t start = bench_now_ns();
+    *total = complete_line(line, strlen(line), &result);
+    double elapsed = (bench_now_ns() - start) / 1e3;
+    completions_free(&result);
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    bench_init("complete_bench", &argc, argv);
+    int executables = argc > 1 ? atoi(argv[1]) : 30000;
+    int completions = argc > 2 ? atoi(argv[2]) : 500;
+    bench_pin_cpu();
+
+    char dir[] = "/tmp/complete_bench.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < executables; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%s-%d", stems[i % STEM_COUNT], i);
+        create_executable(dir, name);
+    }
+    char path_env[PATH_MAX + 16];
+    snprintf(path_env, sizeof(path_env), "%s:/usr/bin:/bin", dir);
+    setenv("PATH", path_env, 1);
+
+    BenchSamples samples = {0};
+    for (int round = 0; round < 5; round++)
+    {
+        completion_reset();
+        uint64_t start = bench_now_ns();
+        completion_prepare();
+        bench_sample(&samples, (bench_now_ns() - start) / 1e3);
+    }
+    bench_report("build trie", "us", &samples);
+
+    struct
+    {
+        const char *name;
+        const char *line;
+    } cases[] = {
+        {"every name", ""},
+        {"stem prefix", "git-"},
+        {"few names", "perl-123"},
+        {"unique name", "docker-29998"},
+        {"no match", "zzz"},
+        {"after a pipe", "ls | mk"},
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        size_t total;
+        time_completion(cases[c].line, &total); // warm up
+        for (int i = 0; i < completions; i++)
+            bench_sample(&samples, time_completion(cases[c].line, &total));
+        bench_report(cases[c].name, "us", &samples);
+        bench_note("%zu candidates", total);
+    }
+
+    // Each round adds an executable; the next completion applies the event
+    for (int i = 0; i < completions; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "fresh-%d", i);
+        create_executable(dir, name);
+        size_t total;
+        bench_sample(&samples, time_completion(name, &total));
+        if (total != 1)
+        {
+            fprintf(stderr, "complete_bench: %s was not picked up\n", name);
+            return EXIT_FAILURE;
+        }
+    }
+    bench_report("new executable", "us", &samples);
+    bench_note("%d executables in one PATH directory", executables);
+
+    completion_reset();
+    free(samples.values);
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        fprintf(stderr, "complete_bench: could not remove %s\n", dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+// Compares the cat, cp and tee builtins with the coreutils programs by
+// running the same command lines through `myshell -c`, once with the
+// builtin and once with the program's full path. Output that goes to the
+// shell's stdout is drained here through a pipe.
+//
+// Usage: copy_bench [--json] [megabytes] [runs] [shell binary]
+#include "bench.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/wait.h>
+
+static char drain_buffer[1 << 20];
+
+// Run one command line and return the elapsed wall time in seconds
+static double run_once(const char *shell, const char *command)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start = bench_now_ns();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(shell, shell, "-c", command, (char *)NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    else if (pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    while (read(fds[0], drain_buffer, sizeof(drain_buffer)) > 0)
+        ;
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "copy_bench: '%s' failed\n", command);
+        exit(EXIT_FAILURE);
+    }
+    return (bench_now_ns() - start) / 1e9;
+}
+
+static void write_source(const char *path, long megabytes)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    unsigned int seed = 1;
+    for (size_t i = 0; i < sizeof(drain_buffer); i++)
+        drain_buffer[i] = rand_r(&seed);
+    for (long i = 0; i < megabytes; i++)
+    {
+        if (write(fd, drain_buffer, sizeof(drain_buffer)) != (ssize_t)sizeof(drain_buffer))
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    bench_init("copy_bench", &argc, argv);
+    long megabytes = argc > 1 ? atol(argv[1]) : 256;
+    int runs = argc > 2 ? atoi(argv[2]) : 10;
+    const char *shell = argc > 3 ? argv[3] : "./myshell";
+
+    char dir[] = "/tmp/copy_bench.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    char source[PATH_MAX], target[PATH_MAX], extra[PATH_MAX];
+    snprintf(source, sizeof(source), "%s/source", dir);
+    snprintf(target, sizeof(target), "%s/target", dir);
+    snprintf(extra, sizeof(extra), "%s/extra", dir);
+    write_source(source, megabytes);
+
+    // %1$s is the utility prefix: empty for the builtin, /bin/ for coreutils
+    struct
+    {
+        const char *name;
+        const char *format;
+    } cases[] = {
+        {"cat file to file", "%1$scat %2$s > %3$s"},
+        {"cat file to pipe", "%1$scat %2$s"},
+        {"cp file file", "%1$scp %2$s %3$s"},
+        {"tee to file, pipe", "cat %2$s | %1$stee %3$s"},
+        {"tee to two files", "cat %2$s | %1$stee %3$s %4$s > /dev/null"},
+    };
+
+    BenchSamples samples = {0};
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        for (int external = 0; external <= 1; external++)
+        {
+            char command[4 * PATH_MAX];
+            snprintf(command, sizeof(command), cases[c].format, external ? "/bin/" : "", source, target, extra);
+            run_once(shell, command); // warm up
+            for (int i = 0; i < runs; i++)
+                bench_sample(&samples, megabytes / run_once(shell, command));
+
+            char name[128];
+            snprintf(name, sizeof(name), "%s %s", external ? "coreutils" : "builtin", cases[c].name);
+            bench_report(name, "MiB/s", &samples);
+        }
+    }
+    bench_note("%ld MiB source file", megabytes);
+
+    unlink(source);
+    unlink(target);
+    unlink(extra);
+    rmdir(dir);
+    free(samples.values);
+    return EXIT_SUCCESS;
+}
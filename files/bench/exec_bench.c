@@ -0,0 +1,77 @@
+// Times execute_command directly, linked into the benchmark with the rest
+// of the shell, so each sample is one command's round trip: launch, run
+// and wait, without the cost of reading and parsing input.
+//
+// Usage: exec_bench [--json] [commands] [rounds]
+#include "bench.h"
+#include "../shell.h"
+
+// One command, parsed fresh each time as the prompt would
+static double measure_command(const char *line, Arena *arena)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", line);
+    Command *cmd = parse_command(buffer, arena);
+    if (!cmd)
+    {
+        fprintf(stderr, "exec_bench: cannot parse '%s'\n", line);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start = bench_now_ns();
+    int status = execute_command(cmd);
+    double elapsed = (bench_now_ns() - start) / 1e3;
+    arena_reset(arena);
+
+    if (status != 0)
+    {
+        fprintf(stderr, "exec_bench: '%s' exited with %d\n", line, status);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    bench_init("exec_bench", &argc, argv);
+    int commands = argc > 1 ? atoi(argv[1]) : 500;
+    int rounds = argc > 2 ? atoi(argv[2]) : 4;
+    bench_pin_cpu();
+
+    shell_script_mode = 1;
+    initialize_shell();
+    int use_spawn = spawn_enabled;
+
+    struct
+    {
+        const char *name;
+        const char *line;
+        int spawn;
+    } cases[] = {
+        {"builtin true", "true", 1},
+        {"spawn /bin/true", "/bin/true", 1},
+        {"fork /bin/true", "/bin/true", 0},
+        {"spawn pipeline", "/bin/true | /bin/true", 1},
+        {"fork pipeline", "/bin/true | /bin/true", 0},
+    };
+
+    Arena arena;
+    arena_init(&arena, COMMAND_ARENA_SIZE);
+    BenchSamples samples = {0};
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        spawn_enabled = cases[c].spawn && use_spawn;
+        for (int i = 0; i < commands / 10 + 1; i++)
+            measure_command(cases[c].line, &arena); // warm up
+        for (int i = 0; i < commands * rounds; i++)
+            bench_sample(&samples, measure_command(cases[c].line, &arena));
+        bench_report(cases[c].name, "us/cmd", &samples);
+    }
+    if (!use_spawn)
+        bench_note("posix_spawn is disabled, so the spawn cases fork too");
+    free(samples.values);
+
+    arena_destroy(&arena);
+    shell_cleanup();
+    return EXIT_SUCCESS;
+}
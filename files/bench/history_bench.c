@@ -0,0 +1,113 @@
+// Measures the history index on a large synthetic history file: the
+// first load, which indexes the whole file, a load from the saved index,
+// and reverse searches that find a recent entry, an old one, or nothing.
+//
+// Usage: history_bench [--json] [entries] [searches]
+#include "bench.h"
+#include "../shell.h"
+#include <limits.h>
+
+static const char *commands[] = {
+    "ls -la", "cd src", "git status", "git diff --stat", "make -j8", "vim shell.c",
+    "grep -rn parse_command .", "cat /etc/hosts", "ssh build-host", "docker ps -a",
+    "kubectl get pods -n staging", "tail -f /var/log/syslog", "find . -name '*.o'",
+    "python3 manage.py migrate", "curl -s http://localhost:8080/health", "htop",
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static void write_history(const char *path, long entries)
+{
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    // One old entry that only a search reaching far back will find
+    fprintf(out, "echo needle\n");
+    unsigned int seed = 1;
+    for (long i = 0; i < entries; i++)
+    {
+        // Numbers keep most entries distinct, as real arguments do
+        fprintf(out, "%s # %u\n", commands[rand_r(&seed) % COMMAND_COUNT], rand_r(&seed) % 100000);
+    }
+    fclose(out);
+}
+
+// history_close saves the index first, so a following load can use it
+static double time_load(void)
+{
+    uint64_t start = bench_now_ns();
+    history_count();
+    return (bench_now_ns() - start) / 1e3;
+}
+
+int main(int argc, char **argv)
+{
+    bench_init("history_bench", &argc, argv);
+    long entries = argc > 1 ? atol(argv[1]) : 1000000;
+    int searches = argc > 2 ? atoi(argv[2]) : 200;
+    bench_pin_cpu();
+
+    char dir[] = "/tmp/history_bench.XXXXXX";
+    char path[PATH_MAX];
+    char index_path[PATH_MAX + 8];
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf(path, sizeof(path), "%s/history", dir);
+    snprintf(index_path, sizeof(index_path), "%s.index", path);
+    write_history(path, entries);
+    setenv("MYSHELL_HISTFILE", path, 1);
+
+    BenchSamples samples = {0};
+    for (int round = 0; round < 5; round++)
+    {
+        history_close();
+        unlink(index_path);
+        bench_sample(&samples, time_load());
+    }
+    bench_report("load, no index", "us", &samples);
+
+    for (int round = 0; round < 5; round++)
+    {
+        history_close();
+        bench_sample(&samples, time_load());
+    }
+    bench_report("load, saved index", "us", &samples);
+
+    struct
+    {
+        const char *name;
+        const char *text;
+        int prefix;
+    } cases[] = {
+        {"search recent", "kubectl get", 0},
+        {"search prefix", "git d", 1},
+        {"search oldest", "needle", 0},
+        {"search missing", "no such command", 0},
+        {"search 2 chars", "zq", 0},
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        history_search(cases[c].text, cases[c].prefix, -1); // warm up
+        for (int i = 0; i < searches; i++)
+        {
+            uint64_t start = bench_now_ns();
+            history_search(cases[c].text, cases[c].prefix, -1);
+            bench_sample(&samples, (bench_now_ns() - start) / 1e3);
+        }
+        bench_report(cases[c].name, "us", &samples);
+    }
+    bench_note("%ld entries", entries);
+
+    history_close();
+    unlink(index_path);
+    unlink(path);
+    rmdir(dir);
+    free(samples.values);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+// Compares shell_malloc/shell_free/shell_realloc with the C library's
+// allocator on the same allocation trace. The trace is generated from a
+// fixed seed, so every run and every allocator sees the same requests:
+//
+//   commands  the size mix of parsing and running commands: mostly small
+//             strings and nodes, some buffers of a few KB, rarely a big one
+//   buffers   line and output buffers that grow with realloc as they fill
+//
+// Each case replays the trace in batches and reports nanoseconds per
+// allocator call.
+//
+// Usage: malloc_bench [--json] [operations] [rounds]
+#include "bench.h"
+#include "../memory_manager.h"
+
+#define LIVE_SLOTS 2048
+#define BATCH 4096
+
+typedef enum
+{
+    OP_MALLOC,
+    OP_FREE,
+    OP_REALLOC
+} OpKind;
+
+typedef struct
+{
+    OpKind kind;
+    int slot;
+    size_t size;
+} Op;
+
+typedef struct
+{
+    const char *name;
+    void *(*malloc_fn)(size_t);
+    void (*free_fn)(void *);
+    void *(*realloc_fn)(void *, size_t);
+} Allocator;
+
+// The shell's entry points are macros that record the call site
+static void *shell_malloc_fn(size_t size)
+{
+    return shell_malloc(size);
+}
+
+static void shell_free_fn(void *ptr)
+{
+    shell_free(ptr);
+}
+
+static void *shell_realloc_fn(void *ptr, size_t size)
+{
+    return shell_realloc(ptr, size);
+}
+
+static const Allocator allocators[] = {
+    {"shell", shell_malloc_fn, shell_free_fn, shell_realloc_fn},
+    {"glibc", malloc, free, realloc},
+};
+
+static uint64_t rng_state;
+
+static uint32_t next_random(void)
+{
+    rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(rng_state >> 33);
+}
+
+static size_t command_size(void)
+{
+    uint32_t r = next_random() % 1000;
+    if (r < 850)
+        return 16 + next_random() % 241; // words, tokens, nodes
+    if (r < 995)
+        return 1024 + next_random() % 3073; // buffers, argument vectors
+    return 65536 + next_random() % 196609; // file contents, big expansions
+}
+
+// Build a trace that keeps up to LIVE_SLOTS blocks live. A slot is
+// filled, resized or emptied; `realloc_share` out of 100 operations on a
+// live slot grow it instead of freeing it.
+static Op *build_trace(long count, int realloc_share, int growing)
+{
+    Op *ops = malloc(count * sizeof(Op));
+    size_t sizes[LIVE_SLOTS] = {0};
+    if (!ops)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (long i = 0; i < count; i++)
+    {
+        int slot = next_random() % LIVE_SLOTS;
+        Op *op = &ops[i];
+        op->slot = slot;
+        if (sizes[slot] == 0)
+        {
+            op->kind = OP_MALLOC;
+            op->size = growing ? 64 : command_size();
+        }
+        else if ((int)(next_random() % 100) < realloc_share)
+        {
+            op->kind = OP_REALLOC;
+            op->size = growing ? sizes[slot] + sizes[slot] / 2 : command_size();
+            if (op->size > 1024 * 1024)
+                op->size = 64;
+        }
+        else
+        {
+            op->kind = OP_FREE;
+            op->size = 0;
+        }
+        sizes[slot] = op->size;
+    }
+    return ops;
+}
+
+// Replay the trace, sampling the cost of each batch of operations
+static void replay(const Allocator *allocator, const Op *ops, long count, BenchSamples *samples)
+{
+    void *slots[LIVE_SLOTS] = {0};
+
+    for (long start = 0; start < count; start += BATCH)
+    {
+        long end = start + BATCH < count ? start + BATCH : count;
+        uint64_t begin = bench_now_ns();
+        for (long i = start; i < end; i++)
+        {
+            const Op *op = &ops[i];
+            switch (op->kind)
+            {
+            case OP_MALLOC:
+                slots[op->slot] = allocator->malloc_fn(op->size);
+                *(char *)slots[op->slot] = 1;
+                break;
+            case OP_REALLOC:
+                slots[op->slot] = allocator->realloc_fn(slots[op->slot], op->size);
+                ((char *)slots[op->slot])[op->size - 1] = 1;
+                break;
+            case OP_FREE:
+                allocator->free_fn(slots[op->slot]);
+                slots[op->slot] = NULL;
+                break;
+            }
+        }
+        if (samples)
+            bench_sample(samples, (double)(bench_now_ns() - begin) / (end - start));
+    }
+
+    for (int i = 0; i < LIVE_SLOTS; i++)
+        allocator->free_fn(slots[i]);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init("malloc_bench", &argc, argv);
+    long operations = argc > 1 ? atol(argv[1]) : 400000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    bench_pin_cpu();
+
+    init_memory_manager(1024 * 1024);
+
+    struct
+    {
+        const char *name;
+        int realloc_share;
+        int growing;
+    } mixes[] = {
+        {"commands", 10, 0},
+        {"buffers", 70, 1},
+    };
+
+    BenchSamples samples = {0};
+    for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++)
+    {
+        rng_state = 42;
+        Op *ops = build_trace(operations, mixes[m].realloc_share, mixes[m].growing);
+        for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++)
+        {
+            replay(&allocators[a], ops, operations, NULL); // warm up
+            for (int round = 0; round < rounds; round++)
+                replay(&allocators[a], ops, operations, &samples);
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s/%s", allocators[a].name, mixes[m].name);
+            bench_report(name, "ns/op", &samples);
+        }
+        free(ops);
+    }
+    bench_note("%ld operations per round in batches of %d", operations, BATCH);
+    free(samples.values);
+
+    if (get_memory_stats().current_usage != 0)
+    {
+        fprintf(stderr, "malloc_bench: shell allocator still has blocks in use\n");
+        return EXIT_FAILURE;
+    }
+    cleanup_memory_manager();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+// Measures parser throughput by running parse_command over every line of
+// a generated multi-megabyte script and of each script named on the
+// command line. A real script is repeated until it is at least as big as
+// the generated one, so every case parses a comparable amount.
+//
+// Usage: parse_bench [--json] [-m megabytes] [-r rounds] [script ...]
+#include "bench.h"
+#include "../shell.h"
+
+static double now_seconds(void)
+{
+    return bench_now_ns() / 1e9;
+}
+
+// A mix of plain words, quoting, escapes, pipes and redirections
+static const char *sample_lines[] = {
+    "ls -la /usr/local/bin",
+    "grep -n \"static int\" process.c | sort | uniq -c > /tmp/counts.txt",
+    "echo 'single quoted | not a pipe' and\\ escaped\\ spaces",
+    "cat < input.txt | tr a-z A-Z >> output.log",
+    "find . -name '*.c' -newer Makefile | xargs wc -l",
+    "printf \"%s\\n\" \"$HOME\" \"a \\\"quoted\\\" word\"",
+    "sleep 10 &",
+    "# a comment line that the lexer skips",
+};
+
+static char *generate_script(size_t target, size_t *len)
+{
+    size_t count = sizeof(sample_lines) / sizeof(sample_lines[0]);
+    char *script = malloc(target + 256);
+    size_t used = 0;
+
+    for (size_t i = 0; used < target; i++)
+    {
+        size_t n = strlen(sample_lines[i % count]);
+        memcpy(script + used, sample_lines[i % count], n);
+        used += n;
+        script[used++] = '\n';
+    }
+    *len = used;
+    return script;
+}
+
+// Read a script and repeat it up to at least `target` bytes
+static char *read_script(const char *path, size_t target, size_t *len)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    if (size <= 0)
+    {
+        fprintf(stderr, "%s: empty script\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t copies = target / size + 1;
+    char *script = malloc(copies * (size + 1) + 1);
+    size_t read = fread(script, 1, size, file);
+    fclose(file);
+    if (read && script[read - 1] != '\n')
+        script[read++] = '\n';
+    for (size_t i = 1; i < copies; i++)
+        memcpy(script + i * read, script, read);
+    *len = copies * read;
+    return script;
+}
+
+// Parse the whole script `rounds` times, sampling MB/s per round
+static void run_case(const char *name, const char *script, size_t len, int rounds, Arena *arena)
+{
+    // The parser works in place, so every round starts from a fresh copy
+    char *work = malloc(len + 1);
+    BenchSamples samples = {0};
+    size_t lines = 0;
+    size_t commands = 0;
+
+    for (int round = -1; round < rounds; round++)
+    {
+        memcpy(work, script, len);
+        work[len] = '\0';
+
+        double start = now_seconds();
+        char *line = work;
+        char *end = work + len;
+        lines = commands = 0;
+        while (line < end)
+        {
+            char *newline = memchr(line, '\n', end - line);
+            if (newline)
+                *newline = '\0';
+
+            if (parse_command(line, arena))
+                commands++;
+            arena_reset(arena);
+            lines++;
+            line = newline ? newline + 1 : end;
+        }
+        double elapsed = now_seconds() - start;
+
+        // Round -1 warms up the caches and the arena
+        if (round >= 0)
+            bench_sample(&samples, len / elapsed / (1024 * 1024));
+    }
+
+    bench_report(name, "MB/s", &samples);
+    bench_note("%s: %zu bytes, %zu lines, %zu parsed to commands", name, len, lines, commands);
+    free(samples.values);
+    free(work);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init("parse_bench", &argc, argv);
+    double megabytes = 8;
+    int rounds = 10;
+    int first_script = 1;
+    while (first_script + 1 < argc && argv[first_script][0] == '-')
+    {
+        if (strcmp(argv[first_script], "-m") == 0)
+            megabytes = atof(argv[first_script + 1]);
+        else if (strcmp(argv[first_script], "-r") == 0)
+            rounds = atoi(argv[first_script + 1]);
+        else
+            break;
+        first_script += 2;
+    }
+    bench_pin_cpu();
+
+    Arena arena;
+    init_memory_manager(1024 * 1024);
+    arena_init(&arena, COMMAND_ARENA_SIZE);
+
+    size_t target = (size_t)(megabytes * 1024 * 1024);
+    size_t len;
+    char *script = generate_script(target, &len);
+    run_case("synthetic", script, len, rounds, &arena);
+    free(script);
+
+    for (int i = first_script; i < argc; i++)
+    {
+        script = read_script(argv[i], target, &len);
+        const char *name = strrchr(argv[i], '/');
+        run_case(name ? name + 1 : argv[i], script, len, rounds, &arena);
+        free(script);
+    }
+
+    arena_destroy(&arena);
+    cleanup_memory_manager();
+    return EXIT_SUCCESS;
+}
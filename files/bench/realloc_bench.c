@@ -0,0 +1,97 @@
+// Measures the cost of growing a buffer a little at a time with
+// shell_realloc, the way input lines and history grow. With in-place
+// growth the time per call stays flat as the buffer gets bigger; when
+// every call has to copy, it rises with the buffer size.
+//
+// Each size is also grown the way shell_realloc used to grow a block:
+// allocate, copy and free on every call. That is quadratic, so it is
+// only run up to COPY_MAX bytes.
+//
+// Usage: realloc_bench [--json] [step bytes] [max kilobytes] [rounds]
+#include "bench.h"
+#include "../memory_manager.h"
+
+#define COPY_MAX (1024 * 1024)
+
+// Grow a buffer to `size` bytes, `step` at a time. Returns nanoseconds
+// per call and counts the calls that moved the buffer.
+static double grow(size_t size, size_t step, int copy, size_t *calls, size_t *moves)
+{
+    char *buffer = NULL;
+    *calls = *moves = 0;
+
+    uint64_t start = bench_now_ns();
+    for (size_t length = step; length <= size; length += step)
+    {
+        char *grown;
+        if (copy)
+        {
+            grown = shell_malloc(length);
+            if (grown && buffer)
+            {
+                memcpy(grown, buffer, length - step);
+                shell_free(buffer);
+            }
+        }
+        else
+        {
+            grown = shell_realloc(buffer, length);
+        }
+        if (!grown)
+        {
+            fprintf(stderr, "allocation of %zu bytes failed\n", length);
+            exit(EXIT_FAILURE);
+        }
+        if (buffer && grown != buffer)
+            (*moves)++;
+        buffer = grown;
+        buffer[length - 1] = 1;
+        (*calls)++;
+    }
+    double elapsed = bench_now_ns() - start;
+
+    shell_free(buffer);
+    return elapsed / *calls;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init("realloc_bench", &argc, argv);
+    size_t step = argc > 1 ? (size_t)atol(argv[1]) : 64;
+    size_t max_size = (argc > 2 ? (size_t)atol(argv[2]) : 16384) * 1024;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    bench_pin_cpu();
+
+    init_memory_manager(1024 * 1024);
+    size_t calls, moves;
+    grow(4096, step, 0, &calls, &moves); // warm up
+
+    BenchSamples samples = {0};
+    for (size_t size = 4096; size <= max_size; size *= 4)
+    {
+        char name[32];
+        size_t total_moves = 0;
+        for (int round = 0; round < rounds; round++)
+        {
+            bench_sample(&samples, grow(size, step, 0, &calls, &moves));
+            total_moves += moves;
+        }
+        snprintf(name, sizeof(name), "realloc/%zu", size);
+        bench_report(name, "ns/call", &samples);
+        bench_note("%zu calls, %zu moves per round", calls, total_moves / rounds);
+
+        if (size <= COPY_MAX)
+        {
+            for (int round = 0; round < rounds; round++)
+                bench_sample(&samples, grow(size, step, 1, &calls, &moves));
+            snprintf(name, sizeof(name), "copy/%zu", size);
+            bench_report(name, "ns/call", &samples);
+        }
+    }
+    bench_note("buffers of %zu KB and up have a mapping of their own and grow with mremap",
+               (size_t)LARGE_MAPPING_THRESHOLD / 1024);
+    free(samples.values);
+
+    cleanup_memory_manager();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+// Compares the cost per command of the shell's posix_spawn path and its
+// fork fallback by piping batches of trivial external commands into
+// myshell. /bin/true is named by path: a bare `true` runs in-process.
+//
+// Usage: spawn_bench [--json] [commands] [rounds] [shell binary]
+#include "bench.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+
+static double now_seconds(void)
+{
+    return bench_now_ns() / 1e9;
+}
+
+// Feed `count` commands to the shell and return the elapsed wall time
+static double run_batch(const char *shell, int count, int use_fork)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+
+        if (use_fork)
+            setenv("MYSHELL_NO_SPAWN", "1", 1);
+        else
+            unsetenv("MYSHELL_NO_SPAWN");
+
+        execl(shell, shell, (char *)NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    else if (pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    close(fds[0]);
+    FILE *in = fdopen(fds[1], "w");
+    for (int i = 0; i < count; i++)
+    {
+        fputs("/bin/true\n", in);
+    }
+    fputs("exit\n", in);
+    fclose(in);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return now_seconds() - start;
+}
+
+int main(int argc, char **argv)
+{
+    bench_init("spawn_bench", &argc, argv);
+    int count = argc > 1 ? atoi(argv[1]) : 1000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    const char *shell = argc > 3 ? argv[3] : "./myshell";
+    bench_pin_cpu();
+
+    // Warm up the page cache and the binary
+    run_batch(shell, count / 10 + 1, 0);
+
+    BenchSamples samples = {0};
+    for (int use_fork = 0; use_fork <= 1; use_fork++)
+    {
+        for (int round = 0; round < rounds; round++)
+            bench_sample(&samples, run_batch(shell, count, use_fork) / count * 1e6);
+        bench_report(use_fork ? "fork /bin/true" : "spawn /bin/true", "us/cmd", &samples);
+    }
+    bench_note("each sample is the mean of a batch of %d commands", count);
+    free(samples.values);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+// Compares startup-to-first-exec latency of `myshell -c` with the
+// prompt-driven mode fed through a pipe, by repeatedly starting the shell
+// to run one external command and timing each run until the shell exits.
+//
+// Usage: startup_bench [--json] [runs] [shell binary]
+#include "bench.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+
+static double now_seconds(void)
+{
+    return bench_now_ns() / 1e9;
+}
+
+// Start the shell once and return the elapsed wall time
+static double run_once(const char *shell, int script_mode)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+
+        if (script_mode)
+            execl(shell, shell, "-c", "/bin/true", (char *)NULL);
+        else
+            execl(shell, shell, (char *)NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    else if (pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    close(fds[0]);
+    if (!script_mode)
+    {
+        const char *input = "/bin/true\nexit\n";
+        if (write(fds[1], input, strlen(input)) < 0)
+            perror("write");
+    }
+    close(fds[1]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return now_seconds() - start;
+}
+
+int main(int argc, char **argv)
+{
+    bench_init("startup_bench", &argc, argv);
+    int runs = argc > 1 ? atoi(argv[1]) : 500;
+    const char *shell = argc > 2 ? argv[2] : "./myshell";
+    bench_pin_cpu();
+
+    // Warm up the page cache and the binary
+    for (int i = 0; i < 20; i++)
+        run_once(shell, i & 1);
+
+    BenchSamples samples = {0};
+    for (int script_mode = 1; script_mode >= 0; script_mode--)
+    {
+        for (int i = 0; i < runs; i++)
+            bench_sample(&samples, run_once(shell, script_mode) * 1e6);
+        bench_report(script_mode ? "myshell -c" : "myshell < stdin", "us", &samples);
+    }
+    free(samples.values);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+# An interactive session, replayed by transcript_bench and parsed by
+# parse_bench. It runs in a scratch directory and only writes there.
+pwd
+echo "session started in $PWD"
+BUILD=release
+TARGET=myshell
+echo building $TARGET in $BUILD mode
+printf "%s\n" alpha beta gamma delta epsilon > words.txt
+printf "%s %s\n" 3 three 1 one 2 two > numbers.txt
+ls
+ls -l words.txt numbers.txt
+cat words.txt
+wc -l words.txt
+wc -c < numbers.txt
+sort numbers.txt
+sort -r words.txt | head -n 2
+cat words.txt | grep -v eta | tr a-z A-Z
+grep -n a words.txt > matches.txt
+cat matches.txt | wc -l
+cut -d ' ' -f 2 numbers.txt | sort | uniq -c
+echo "$BUILD build" >> log.txt
+echo "$TARGET linked" >> log.txt
+cat log.txt
+for word in alpha beta gamma
+do
+    echo checking $word
+done
+for n in 1 2 3 4 5; do echo $n; done
+COUNT=
+while test "$COUNT" != xxx
+do
+    COUNT=${COUNT}x
+done
+echo count=$COUNT
+if test -f words.txt
+then
+    echo words present
+else
+    echo words missing
+fi
+if grep -q gamma words.txt; then echo found gamma; fi
+if test -d /tmp; then echo tmp exists; fi
+false
+echo last status $?
+mkdir -p out
+cp words.txt out/words.copy
+ls out
+cd out
+pwd
+cat words.copy | head -n 1
+cd ..
+rm -r out
+hash
+jobs
+echo session done
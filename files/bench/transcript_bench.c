@@ -0,0 +1,159 @@
+// Replays a recorded command transcript through myshell, end to end:
+// parsing, expansion, control flow, builtins, pipelines and external
+// commands. The transcript is repeated into one large script, which is
+// run both as a script file and fed to the prompt through a pipe. Each
+// replay runs in a fresh scratch directory, with the parsed-script cache
+// kept there too.
+//
+// Usage: transcript_bench [--json] [-n repeats] [-r rounds] [transcript] [shell binary]
+#include "bench.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static char scratch[] = "/tmp/transcript_bench.XXXXXX";
+
+// Write `repeats` copies of the transcript to a script in the scratch
+// directory; returns the number of lines in one copy
+static int build_script(const char *transcript, int repeats, const char *path)
+{
+    FILE *in = fopen(transcript, "r");
+    if (!in)
+    {
+        perror(transcript);
+        exit(EXIT_FAILURE);
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    rewind(in);
+    char *text = malloc(size + 1);
+    size_t length = fread(text, 1, size, in);
+    fclose(in);
+
+    int lines = 0;
+    for (size_t i = 0; i < length; i++)
+        lines += text[i] == '\n';
+
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < repeats; i++)
+        fwrite(text, 1, length, out);
+    fclose(out);
+    free(text);
+    return lines;
+}
+
+static void remove_tree(const char *path)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execlp("rm", "rm", "-rf", path, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+// Run the script once in a clean working directory and return the
+// elapsed wall time in milliseconds
+static double replay(const char *shell, const char *script, int use_stdin)
+{
+    char work[PATH_MAX];
+    snprintf(work, sizeof(work), "%s/work", scratch);
+    remove_tree(work);
+    if (mkdir(work, 0700) != 0)
+    {
+        perror(work);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start = bench_now_ns();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (chdir(work) != 0)
+            _exit(EXIT_FAILURE);
+        int devnull = open("/dev/null", O_RDWR);
+        int in = use_stdin ? open(script, O_RDONLY) : devnull;
+        dup2(in, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        setenv("MYSHELL_CACHE_DIR", scratch, 1);
+
+        if (use_stdin)
+            execl(shell, shell, (char *)NULL);
+        else
+            execl(shell, shell, script, (char *)NULL);
+        _exit(127);
+    }
+    else if (pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    double elapsed = (bench_now_ns() - start) / 1e6;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127)
+    {
+        fprintf(stderr, "transcript_bench: %s failed to run the transcript\n", shell);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    bench_init("transcript_bench", &argc, argv);
+    int repeats = 40;
+    int rounds = 10;
+    int arg = 1;
+    while (arg + 1 < argc && argv[arg][0] == '-')
+    {
+        if (strcmp(argv[arg], "-n") == 0)
+            repeats = atoi(argv[arg + 1]);
+        else if (strcmp(argv[arg], "-r") == 0)
+            rounds = atoi(argv[arg + 1]);
+        else
+            break;
+        arg += 2;
+    }
+    const char *transcript = arg < argc ? argv[arg] : "bench/transcript.sh";
+    char shell[PATH_MAX];
+    if (!realpath(arg + 1 < argc ? argv[arg + 1] : "./myshell", shell))
+    {
+        perror("myshell");
+        return EXIT_FAILURE;
+    }
+    bench_pin_cpu();
+
+    if (!mkdtemp(scratch))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    char script[PATH_MAX];
+    snprintf(script, sizeof(script), "%s/transcript.sh", scratch);
+    int lines = build_script(transcript, repeats, script);
+
+    BenchSamples samples = {0};
+    for (int use_stdin = 0; use_stdin <= 1; use_stdin++)
+    {
+        // The first replay also warms the script cache
+        replay(shell, script, use_stdin);
+        for (int round = 0; round < rounds; round++)
+            bench_sample(&samples, replay(shell, script, use_stdin));
+        bench_report(use_stdin ? "transcript < stdin" : "transcript script", "ms", &samples);
+    }
+    bench_note("%d copies of a %d-line transcript", repeats, lines);
+
+    remove_tree(scratch);
+    free(samples.values);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,561 @@
+#include "shell.h"
+#include <sys/stat.h>
+#include <ctype.h>
+#include <limits.h>
+
+typedef int (*BuiltinFunc)(char **args);
+
+typedef struct
+{
+    const char *name;
+    BuiltinFunc func;
+    const char *usage;
+    const char *description;
+} Builtin;
+
+// Keep sorted by name (strcmp order): find_builtin uses a binary search
+static const Builtin builtins[] = {
+    {"[", shell_test, "[ expr ]", "Evaluate a conditional expression"},
+    {"bg", shell_bg, "bg [job_id]", "Continue job in background"},
+    {"cat", shell_cat, "cat [-u] [file ...]", "Concatenate files to standard output"},
+    {"cd", shell_cd, "cd [dir]", "Change directory"},
+    {"cp", shell_cp, "cp source ... target", "Copy files"},
+    {"echo", shell_echo, "echo [-neE] [arg ...]", "Write arguments to standard output"},
+    {"exit", shell_exit, "exit [n]", "Exit the shell with status n"},
+    {"false", shell_false, "false", "Return an unsuccessful status"},
+    {"fg", shell_fg, "fg [job_id]", "Bring job to foreground"},
+    {"hash", shell_hash, "hash [-r] [name ...]", "Show, reset or seed command locations"},
+    {"help", shell_help, "help", "Display this help message"},
+    {"history", shell_history, "history [n | -s | -p text]", "List history, or search it for text (-p: prefix)"},
+    {"jobs", shell_jobs, "jobs", "List background jobs"},
+    {"memcheck", shell_memcheck, "memcheck", "Check for memory leaks"},
+    {"memstat", shell_memstat, "memstat [-b | --json]", "Display memory statistics (-b: every block)"},
+    {"parallel", shell_parallel, "parallel [-j n] [cmd]", "Run a command per input line, n at a time"},
+    {"printf", shell_printf, "printf format [arg ...]", "Format and print arguments"},
+    {"pwd", shell_pwd, "pwd", "Print working directory"},
+    {"stats", shell_stats, "stats [-r] [--json]", "Show per-command start and run latency"},
+    {"tee", shell_tee, "tee [-a] [file ...]", "Copy standard input to files and standard output"},
+    {"test", shell_test, "test expr", "Evaluate a conditional expression"},
+    {"time", shell_time, "time [cmd ...]", "Report real, user and sys time and max RSS"},
+    {"true", shell_true, "true", "Return a successful status"},
+};
+
+#define BUILTIN_COUNT (sizeof(builtins) / sizeof(builtins[0]))
+
+static int compare_builtin(const void *key, const void *entry)
+{
+    return strcmp(key, ((const Builtin *)entry)->name);
+}
+
+static const Builtin *find_builtin(const char *name)
+{
+    return bsearch(name, builtins, BUILTIN_COUNT, sizeof(Builtin), compare_builtin);
+}
+
+// Names in sorted order, for completion; NULL past the last
+const char *builtin_name(size_t index)
+{
+    return index < BUILTIN_COUNT ? builtins[index].name : NULL;
+}
+
+int is_builtin(const char *name)
+{
+    return find_builtin(name) != NULL;
+}
+
+// Returns the builtin's exit status, or -1 if args[0] is not a builtin
+int execute_builtin(Command *cmd)
+{
+    const Builtin *builtin = find_builtin(cmd->args[0]);
+    if (!builtin)
+        return -1;
+    return builtin->func(cmd->args);
+}
+
+int shell_help(char **args)
+{
+    (void)args;
+    printf("MyShell - A simple shell implementation\n");
+    printf("Built-in commands:\n");
+    for (size_t i = 0; i < BUILTIN_COUNT; i++)
+    {
+        printf("  %-24s %s\n", builtins[i].usage, builtins[i].description);
+    }
+    return 0;
+}
+
+int shell_true(char **args)
+{
+    (void)args;
+    return 0;
+}
+
+int shell_false(char **args)
+{
+    (void)args;
+    return 1;
+}
+
+// Print one backslash escape starting after the backslash and return the
+// number of characters consumed, or -1 for \c (stop all output). echo and
+// printf's %b spell octal as \0nnn; printf formats use \nnn.
+static int print_escape(const char *s, int zero_octal)
+{
+    const char *start = s;
+
+    static const char names[] = "abefnrtv\\";
+    static const char values[] = "\a\b\033\f\n\r\t\v\\";
+
+    if (*s == 'c')
+        return -1;
+
+    const char *name = *s ? strchr(names, *s) : NULL;
+    if (name)
+    {
+        putchar(values[name - names]);
+        return 1;
+    }
+
+    if (*s >= '0' && *s <= '7' && (!zero_octal || *s == '0'))
+    {
+        int value = 0;
+        if (zero_octal)
+            s++;
+        for (int digits = 0; digits < 3 && *s >= '0' && *s <= '7'; digits++, s++)
+        {
+            value = value * 8 + (*s - '0');
+        }
+        putchar(value);
+        return (int)(s - start);
+    }
+
+    // Unknown escape: print it unchanged
+    putchar('\\');
+    if (!*s)
+        return 0;
+    putchar(*s);
+    return 1;
+}
+
+// Print `s`, expanding escapes; returns 0, or -1 if \c stopped output
+static int print_escaped(const char *s, int octal_needs_zero)
+{
+    while (*s)
+    {
+        if (*s != '\\')
+        {
+            putchar(*s++);
+            continue;
+        }
+        int used = print_escape(s + 1, octal_needs_zero);
+        if (used < 0)
+            return -1;
+        s += 1 + used;
+    }
+    return 0;
+}
+
+int shell_echo(char **args)
+{
+    int newline = 1;
+    int escapes = 0;
+    int i = 1;
+
+    // Leading option words made only of n, e and E
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++)
+    {
+        const char *opt = args[i] + 1;
+        if (strspn(opt, "neE") != strlen(opt))
+            break;
+        for (; *opt; opt++)
+        {
+            if (*opt == 'n')
+                newline = 0;
+            else if (*opt == 'e')
+                escapes = 1;
+            else
+                escapes = 0;
+        }
+    }
+
+    for (int first = i; args[i]; i++)
+    {
+        if (i > first)
+            putchar(' ');
+        if (!escapes)
+            fputs(args[i], stdout);
+        else if (print_escaped(args[i], 1) < 0)
+            return 0;
+    }
+    if (newline)
+        putchar('\n');
+    return 0;
+}
+
+// Numeric printf argument: accepts 'c / "c for a character code
+static long long printf_number(const char *arg, int *status)
+{
+    if (!arg)
+        return 0;
+    if (arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char)arg[1];
+
+    char *end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 0);
+    if (end == arg || *end != '\0' || errno == ERANGE)
+    {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        *status = 1;
+    }
+    return value;
+}
+
+// Floating-point argument for %f, %e, %g and %a; 0 when missing
+static double printf_float(const char *arg, int *status)
+{
+    if (!arg)
+        return 0;
+    if (arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char)arg[1];
+
+    char *end;
+    errno = 0;
+    double value = strtod(arg, &end);
+    if (end == arg || *end != '\0' || errno == ERANGE)
+    {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        *status = 1;
+    }
+    return value;
+}
+
+int shell_printf(char **args)
+{
+    if (!args[1])
+    {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *format = args[1];
+    char **argp = args + 2;
+    int status = 0;
+
+    // The format is reused until every argument has been consumed
+    do
+    {
+        int consumed = 0;
+        for (const char *f = format; *f; f++)
+        {
+            if (*f == '\\')
+            {
+                int used = print_escape(f + 1, 0);
+                if (used < 0)
+                    return status;
+                f += used;
+                continue;
+            }
+            if (*f != '%')
+            {
+                putchar(*f);
+                continue;
+            }
+            if (f[1] == '%')
+            {
+                putchar('%');
+                f++;
+                continue;
+            }
+
+            // Copy flags, width and precision into a conversion spec
+            char spec[32];
+            size_t len = 0;
+            spec[len++] = *f++;
+            while (*f && strchr("-+ #0123456789.", *f) && len < sizeof(spec) - 4)
+                spec[len++] = *f++;
+            if (!*f)
+                break;
+
+            const char *arg = *argp;
+            if (arg)
+            {
+                argp++;
+                consumed = 1;
+            }
+
+            switch (*f)
+            {
+            case 'd':
+            case 'i':
+                spec[len++] = 'l';
+                spec[len++] = 'l';
+                spec[len++] = *f;
+                spec[len] = '\0';
+                printf(spec, printf_number(arg, &status));
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                spec[len++] = 'l';
+                spec[len++] = 'l';
+                spec[len++] = *f;
+                spec[len] = '\0';
+                printf(spec, (unsigned long long)printf_number(arg, &status));
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                spec[len++] = *f;
+                spec[len] = '\0';
+                printf(spec, printf_float(arg, &status));
+                break;
+            case 'c':
+                spec[len++] = 'c';
+                spec[len] = '\0';
+                printf(spec, arg ? arg[0] : '\0');
+                break;
+            case 's':
+                spec[len++] = 's';
+                spec[len] = '\0';
+                printf(spec, arg ? arg : "");
+                break;
+            case 'b':
+                if (arg && print_escaped(arg, 1) < 0)
+                    return status;
+                break;
+            default:
+                fprintf(stderr, "printf: %%%c: invalid directive\n", *f);
+                return 1;
+            }
+        }
+        if (!consumed)
+            break;
+    } while (*argp);
+
+    return status;
+}
+
+// Recursive-descent evaluator for test/[ over args[pos..end)
+typedef struct
+{
+    char **args;
+    int pos;
+    int end;
+    int error;
+} TestState;
+
+static int test_or(TestState *ts);
+
+static int parse_integer(TestState *ts, const char *s, long long *out)
+{
+    char *end;
+    errno = 0;
+    *out = strtoll(s, &end, 10);
+    while (isspace((unsigned char)*end))
+        end++;
+    if (end == s || *end != '\0' || errno == ERANGE)
+    {
+        fprintf(stderr, "test: %s: integer expression expected\n", s);
+        ts->error = 1;
+        return 0;
+    }
+    return 1;
+}
+
+static int test_unary(const char *op, const char *operand, int *result)
+{
+    struct stat st;
+
+    if (strcmp(op, "-n") == 0)
+        *result = operand[0] != '\0';
+    else if (strcmp(op, "-z") == 0)
+        *result = operand[0] == '\0';
+    else if (strcmp(op, "-e") == 0)
+        *result = stat(operand, &st) == 0;
+    else if (strcmp(op, "-f") == 0)
+        *result = stat(operand, &st) == 0 && S_ISREG(st.st_mode);
+    else if (strcmp(op, "-d") == 0)
+        *result = stat(operand, &st) == 0 && S_ISDIR(st.st_mode);
+    else if (strcmp(op, "-s") == 0)
+        *result = stat(operand, &st) == 0 && st.st_size > 0;
+    else if (strcmp(op, "-h") == 0 || strcmp(op, "-L") == 0)
+        *result = lstat(operand, &st) == 0 && S_ISLNK(st.st_mode);
+    else if (strcmp(op, "-p") == 0)
+        *result = stat(operand, &st) == 0 && S_ISFIFO(st.st_mode);
+    else if (strcmp(op, "-r") == 0)
+        *result = access(operand, R_OK) == 0;
+    else if (strcmp(op, "-w") == 0)
+        *result = access(operand, W_OK) == 0;
+    else if (strcmp(op, "-x") == 0)
+        *result = access(operand, X_OK) == 0;
+    else
+        return 0;
+    return 1;
+}
+
+static int test_binary(TestState *ts, const char *left, const char *op, const char *right, int *result)
+{
+    long long a, b;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        *result = strcmp(left, right) == 0;
+    else if (strcmp(op, "!=") == 0)
+        *result = strcmp(left, right) != 0;
+    else if (strcmp(op, "<") == 0)
+        *result = strcmp(left, right) < 0;
+    else if (strcmp(op, ">") == 0)
+        *result = strcmp(left, right) > 0;
+    else
+    {
+        static const char *int_ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+        int which = -1;
+        for (int i = 0; i < 6; i++)
+        {
+            if (strcmp(op, int_ops[i]) == 0)
+                which = i;
+        }
+        if (which < 0)
+            return 0;
+
+        if (!parse_integer(ts, left, &a) || !parse_integer(ts, right, &b))
+            return 1;
+        switch (which)
+        {
+        case 0:
+            *result = a == b;
+            break;
+        case 1:
+            *result = a != b;
+            break;
+        case 2:
+            *result = a < b;
+            break;
+        case 3:
+            *result = a <= b;
+            break;
+        case 4:
+            *result = a > b;
+            break;
+        default:
+            *result = a >= b;
+            break;
+        }
+    }
+    return 1;
+}
+
+static int test_primary(TestState *ts)
+{
+    int result = 0;
+    int remaining = ts->end - ts->pos;
+
+    if (remaining <= 0)
+    {
+        fprintf(stderr, "test: argument expected\n");
+        ts->error = 1;
+        return 0;
+    }
+
+    const char *word = ts->args[ts->pos];
+
+    if (strcmp(word, "!") == 0)
+    {
+        ts->pos++;
+        return !test_primary(ts);
+    }
+
+    if (strcmp(word, "(") == 0 && remaining >= 3)
+    {
+        ts->pos++;
+        result = test_or(ts);
+        if (ts->pos >= ts->end || strcmp(ts->args[ts->pos], ")") != 0)
+        {
+            fprintf(stderr, "test: ')' expected\n");
+            ts->error = 1;
+            return 0;
+        }
+        ts->pos++;
+        return result;
+    }
+
+    // A binary operator takes precedence over a unary reading
+    if (remaining >= 3 && test_binary(ts, word, ts->args[ts->pos + 1], ts->args[ts->pos + 2], &result))
+    {
+        ts->pos += 3;
+        return result;
+    }
+
+    if (remaining >= 2 && word[0] == '-' && test_unary(word, ts->args[ts->pos + 1], &result))
+    {
+        ts->pos += 2;
+        return result;
+    }
+
+    // A lone string is true when non-empty
+    ts->pos++;
+    return word[0] != '\0';
+}
+
+static int test_and(TestState *ts)
+{
+    int result = test_primary(ts);
+    while (ts->pos < ts->end && strcmp(ts->args[ts->pos], "-a") == 0)
+    {
+        ts->pos++;
+        int right = test_primary(ts);
+        result = result && right;
+    }
+    return result;
+}
+
+static int test_or(TestState *ts)
+{
+    int result = test_and(ts);
+    while (ts->pos < ts->end && strcmp(ts->args[ts->pos], "-o") == 0)
+    {
+        ts->pos++;
+        int right = test_and(ts);
+        result = result || right;
+    }
+    return result;
+}
+
+int shell_test(char **args)
+{
+    int argc = 0;
+    while (args[argc])
+        argc++;
+
+    // "[" needs a closing "]", which is not part of the expression
+    if (strcmp(args[0], "[") == 0)
+    {
+        if (strcmp(args[argc - 1], "]") != 0)
+        {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    // No expression is false
+    if (argc <= 1)
+        return 1;
+
+    TestState ts = {args, 1, argc, 0};
+    int result = test_or(&ts);
+    if (!ts.error && ts.pos != ts.end)
+    {
+        fprintf(stderr, "test: %s: unexpected argument\n", args[ts.pos]);
+        ts.error = 1;
+    }
+    if (ts.error)
+        return 2;
+    return result ? 0 : 1;
+}
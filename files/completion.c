@@ -0,0 +1,483 @@
+#define _GNU_SOURCE // memrchr
+#include "shell.h"
+#include <dirent.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+// Tab completion. Command names come from the builtins and from a trie of
+// the executables in $PATH. The trie is built once, before the first key
+// is read, and kept current from inotify events on the PATH directories,
+// which are applied when Tab is pressed. A completion only walks the typed
+// prefix and the names it shows, however many the directories hold.
+//
+// Each trie node records which PATH directories hold the name ending
+// there (a bit per directory), and how many names are in its subtree, so
+// the candidates for a prefix are counted without being visited.
+
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+#define MAX_PATH_DIRS 64
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Nodes are addressed by index; 0 is the root, so it also means "none"
+typedef struct
+{
+    uint64_t dirs;    // PATH directories holding this name; 0: not a name
+    uint32_t child;   // first child; children are sorted by byte
+    uint32_t sibling;
+    uint32_t count;   // names in this subtree
+    unsigned char byte;
+} TrieNode;
+
+// Trie nodes can outgrow the shell's pool, so they use libc
+static TrieNode *nodes = NULL;
+static uint32_t node_count = 0;
+static uint32_t node_capacity = 0;
+
+static char *path_dirs[MAX_PATH_DIRS];
+static int watches[MAX_PATH_DIRS];
+static int dir_count = 0;
+static char *trie_path_env = NULL; // $PATH the trie was built from
+static int inotify_fd = -1;
+
+static uint32_t new_node(unsigned char byte)
+{
+    if (node_count == node_capacity)
+    {
+        uint32_t capacity = node_capacity ? node_capacity * 2 : 4096;
+        TrieNode *grown = realloc(nodes, capacity * sizeof(TrieNode));
+        if (!grown)
+            return 0;
+        nodes = grown;
+        node_capacity = capacity;
+    }
+    nodes[node_count] = (TrieNode){0, 0, 0, 0, byte};
+    return node_count++;
+}
+
+// The child of `parent` for `byte`, created in order when `create` is set
+static uint32_t child_of(uint32_t parent, unsigned char byte, int create)
+{
+    uint32_t *link = &nodes[parent].child;
+    while (*link && nodes[*link].byte < byte)
+        link = &nodes[*link].sibling;
+    if (*link && nodes[*link].byte == byte)
+        return *link;
+    if (!create)
+        return 0;
+
+    uint32_t node = new_node(byte);
+    if (!node)
+        return 0;
+    // new_node may have moved the array under `link`
+    link = &nodes[parent].child;
+    while (*link && nodes[*link].byte < byte)
+        link = &nodes[*link].sibling;
+    nodes[node].sibling = *link;
+    *link = node;
+    return node;
+}
+
+static uint32_t find_node(const char *name, size_t length)
+{
+    uint32_t node = 0;
+    for (size_t i = 0; i < length && (i == 0 || node); i++)
+        node = child_of(node, (unsigned char)name[i], 0);
+    return length == 0 ? 0 : node;
+}
+
+static void adjust_counts(const char *name, int delta)
+{
+    uint32_t node = 0;
+    nodes[0].count += delta;
+    for (size_t i = 0; name[i]; i++)
+    {
+        node = child_of(node, (unsigned char)name[i], 0);
+        nodes[node].count += delta;
+    }
+}
+
+static void add_name(const char *name, int dir)
+{
+    uint32_t node = 0;
+    for (size_t i = 0; name[i]; i++)
+    {
+        node = child_of(node, (unsigned char)name[i], 1);
+        if (!node)
+            return;
+    }
+    if (node == 0)
+        return;
+    if (nodes[node].dirs == 0)
+        adjust_counts(name, 1);
+    nodes[node].dirs |= 1ULL << dir;
+}
+
+static void remove_name(const char *name, int dir)
+{
+    uint32_t node = find_node(name, strlen(name));
+    if (!node || !(nodes[node].dirs & (1ULL << dir)))
+        return;
+    nodes[node].dirs &= ~(1ULL << dir);
+    if (nodes[node].dirs == 0)
+        adjust_counts(name, -1);
+}
+
+// Executables are regular files (or links to them) with an execute bit
+static int is_executable(int dir_fd, const char *name)
+{
+    struct stat st;
+    return fstatat(dir_fd, name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111);
+}
+
+static void scan_dir(int dir)
+{
+    DIR *stream = opendir(path_dirs[dir]);
+    if (!stream)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(stream)))
+    {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR)
+            continue;
+        if (is_executable(dirfd(stream), entry->d_name))
+            add_name(entry->d_name, dir);
+    }
+    closedir(stream);
+}
+
+static void free_trie(void)
+{
+    for (int i = 0; i < dir_count; i++)
+        free(path_dirs[i]);
+    dir_count = 0;
+    if (inotify_fd != -1)
+        close(inotify_fd);
+    inotify_fd = -1;
+    free(nodes);
+    nodes = NULL;
+    node_count = node_capacity = 0;
+    free(trie_path_env);
+    trie_path_env = NULL;
+}
+
+static void build_trie(const char *path_env)
+{
+    free_trie();
+    trie_path_env = strdup(path_env);
+    if (!trie_path_env || new_node(0) != 0)
+        return;
+
+    // Watches go in first, so nothing added during the scan is missed
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    const char *start = path_env;
+    while (dir_count < MAX_PATH_DIRS)
+    {
+        const char *end = strchr(start, ':');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        char *dir = length ? strndup(start, length) : strdup(".");
+
+        int duplicate = 0;
+        for (int i = 0; dir && i < dir_count; i++)
+            duplicate |= strcmp(path_dirs[i], dir) == 0;
+        if (dir && !duplicate)
+        {
+            watches[dir_count] = inotify_fd == -1 ? -1 : inotify_add_watch(inotify_fd, dir, WATCH_EVENTS);
+            path_dirs[dir_count++] = dir;
+        }
+        else
+        {
+            free(dir);
+        }
+        if (!end)
+            break;
+        start = end + 1;
+    }
+
+    for (int i = 0; i < dir_count; i++)
+        scan_dir(i);
+}
+
+// Apply what changed in the PATH directories since the last completion
+static void apply_events(void)
+{
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    while (inotify_fd != -1 && (length = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *pos = buffer; pos < buffer + length;)
+        {
+            struct inotify_event *event = (struct inotify_event *)pos;
+            pos += sizeof(struct inotify_event) + event->len;
+
+            // A lost event or a vanished directory needs a full rescan
+            if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF))
+            {
+                char *path_env = strdup(trie_path_env);
+                if (path_env)
+                    build_trie(path_env);
+                free(path_env);
+                return;
+            }
+
+            int dir = 0;
+            while (dir < dir_count && watches[dir] != event->wd)
+                dir++;
+            if (dir == dir_count || event->len == 0 || event->name[0] == '.')
+                continue;
+
+            int present = 0;
+            if (event->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB))
+            {
+                int dir_fd = open(path_dirs[dir], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                present = dir_fd != -1 && is_executable(dir_fd, event->name);
+                if (dir_fd != -1)
+                    close(dir_fd);
+            }
+            if (present)
+                add_name(event->name, dir);
+            else
+                remove_name(event->name, dir);
+        }
+    }
+}
+
+// Build the trie for the current $PATH, or bring it up to date
+void completion_prepare(void)
+{
+    const char *path_env = getenv("PATH");
+    if (!path_env)
+        path_env = DEFAULT_PATH;
+
+    if (!trie_path_env || strcmp(trie_path_env, path_env) != 0)
+        build_trie(path_env);
+    else
+        apply_events();
+}
+
+void completion_reset(void)
+{
+    free_trie();
+}
+
+static void add_common(Completions *result, const char *text, size_t length)
+{
+    if (result->total == 0)
+    {
+        result->common_length = length < sizeof(result->common) - 1 ? length : sizeof(result->common) - 1;
+        memcpy(result->common, text, result->common_length);
+        result->common[result->common_length] = '\0';
+        return;
+    }
+    size_t same = 0;
+    while (same < result->common_length && same < length && result->common[same] == text[same])
+        same++;
+    result->common_length = same;
+    result->common[same] = '\0';
+}
+
+static void show(Completions *result, const char *name, int is_dir)
+{
+    if (result->shown_count == COMPLETION_SHOW)
+        return;
+    char *copy = malloc(strlen(name) + 2);
+    if (!copy)
+        return;
+    strcpy(copy, name);
+    if (is_dir)
+        strcat(copy, "/");
+    result->shown[result->shown_count++] = copy;
+}
+
+static void add_candidate(Completions *result, const char *name, int is_dir)
+{
+    add_common(result, name, strlen(name));
+    show(result, name, is_dir);
+    result->total++;
+    result->suffix = is_dir ? '/' : ' ';
+}
+
+// List the names under `node` in order until the shown list is full
+static void show_subtree(Completions *result, uint32_t node, char *name, size_t length)
+{
+    if (nodes[node].dirs)
+    {
+        name[length] = '\0';
+        show(result, name, 0);
+    }
+    for (uint32_t child = nodes[node].child; child && result->shown_count < COMPLETION_SHOW;
+         child = nodes[child].sibling)
+    {
+        if (nodes[child].count == 0 || length + 1 >= NAME_MAX)
+            continue;
+        name[length] = nodes[child].byte;
+        show_subtree(result, child, name, length + 1);
+    }
+}
+
+static void complete_command(Completions *result, const char *prefix)
+{
+    size_t prefix_length = strlen(prefix);
+    uint32_t node = nodes && prefix_length ? find_node(prefix, prefix_length) : 0;
+    int in_trie = nodes && (node || prefix_length == 0) && nodes[node].count > 0;
+
+    // Builtins the trie also holds (echo, test, ...) are counted once
+    for (size_t i = 0; builtin_name(i); i++)
+    {
+        const char *name = builtin_name(i);
+        uint32_t same = nodes ? find_node(name, strlen(name)) : 0;
+        if (strncmp(name, prefix, prefix_length) == 0 && !(same && nodes[same].dirs))
+            add_candidate(result, name, 0);
+    }
+    if (!in_trie)
+        return;
+
+    // The names under the node share the prefix plus every byte down to
+    // the first fork or name
+    char name[NAME_MAX + 1];
+    size_t length = prefix_length < NAME_MAX ? prefix_length : NAME_MAX;
+    memcpy(name, prefix, length);
+    uint32_t shared = node;
+    while (!nodes[shared].dirs && length < NAME_MAX)
+    {
+        uint32_t only = 0;
+        int live = 0;
+        for (uint32_t child = nodes[shared].child; child; child = nodes[child].sibling)
+        {
+            if (nodes[child].count)
+            {
+                only = child;
+                live++;
+            }
+        }
+        if (live != 1)
+            break;
+        name[length++] = nodes[only].byte;
+        shared = only;
+    }
+    add_common(result, name, length);
+    result->total += nodes[node].count;
+    result->suffix = ' ';
+
+    memcpy(name, prefix, prefix_length < NAME_MAX ? prefix_length : NAME_MAX);
+    show_subtree(result, node, name, prefix_length < NAME_MAX ? prefix_length : NAME_MAX);
+}
+
+static void complete_path(Completions *result, const char *word)
+{
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    char dir[PATH_MAX];
+
+    if (!slash)
+        snprintf(dir, sizeof(dir), ".");
+    else if (slash == word)
+        snprintf(dir, sizeof(dir), "/");
+    else if (word[0] == '~' && word + 1 == slash && getenv("HOME"))
+        snprintf(dir, sizeof(dir), "%s", getenv("HOME"));
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - word), word);
+
+    DIR *stream = opendir(dir);
+    if (!stream)
+        return;
+
+    size_t base_length = strlen(base);
+    struct dirent *entry;
+    while ((entry = readdir(stream)))
+    {
+        const char *name = entry->d_name;
+        if (strncmp(name, base, base_length) != 0 || (name[0] == '.' && base[0] != '.') ||
+            strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+        {
+            struct stat st;
+            is_dir = fstatat(dirfd(stream), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        add_candidate(result, name, is_dir);
+    }
+    closedir(stream);
+}
+
+static int compare_shown(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int is_word_break(char c)
+{
+    return c == ' ' || c == '\t' || c == '|' || c == ';' || c == '&' || c == '<' || c == '>';
+}
+
+// A word is a command name at the start of a line, after a pipe or a
+// separator, or after a keyword that starts a command list
+static int in_command_position(const char *line, size_t start)
+{
+    size_t end = start;
+    while (end > 0 && (line[end - 1] == ' ' || line[end - 1] == '\t'))
+        end--;
+    if (end == 0 || line[end - 1] == '|' || line[end - 1] == ';' || line[end - 1] == '&')
+        return 1;
+
+    static const char *keywords[] = {"if", "then", "else", "elif", "while", "do"};
+    size_t begin = end;
+    while (begin > 0 && !is_word_break(line[begin - 1]))
+        begin--;
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+    {
+        if (end - begin == strlen(keywords[i]) && strncmp(line + begin, keywords[i], end - begin) == 0)
+            return in_command_position(line, begin);
+    }
+    return 0;
+}
+
+// Complete the word before `cursor`. The text from replace_start to the
+// cursor is to be replaced by `common`, and when there is exactly one
+// candidate, followed by `suffix`. Returns the number of candidates.
+size_t complete_line(const char *line, size_t cursor, Completions *result)
+{
+    memset(result, 0, sizeof(Completions));
+
+    // Backslash-escaped breaks belong to the word
+    size_t start = cursor;
+    while (start > 0 && (!is_word_break(line[start - 1]) || (start > 1 && line[start - 2] == '\\')))
+        start--;
+
+    char word[PATH_MAX];
+    size_t length = 0;
+    for (size_t i = start; i < cursor && length < sizeof(word) - 1; i++)
+    {
+        if (line[i] == '\\' && i + 1 < cursor)
+            i++;
+        word[length++] = line[i];
+    }
+    word[length] = '\0';
+
+    const char *slash = memrchr(line + start, '/', cursor - start);
+    result->replace_start = slash ? (size_t)(slash - line) + 1 : start;
+
+    if (!strchr(word, '/') && in_command_position(line, start))
+    {
+        completion_prepare();
+        complete_command(result, word);
+    }
+    else
+    {
+        complete_path(result, word);
+    }
+
+    qsort(result->shown, result->shown_count, sizeof(char *), compare_shown);
+    return result->total;
+}
+
+void completions_free(Completions *result)
+{
+    for (size_t i = 0; i < result->shown_count; i++)
+        free(result->shown[i]);
+    result->shown_count = 0;
+}
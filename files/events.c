@@ -0,0 +1,143 @@
+#include "shell.h"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+
+// The shell keeps SIGINT, SIGTSTP and SIGCHLD blocked and receives them
+// through a signalfd, so all signal work (reaping, job updates, output)
+// happens in normal context from the main loop instead of in a handler.
+
+sigset_t child_sigmask; // the mask the shell started with, for children
+
+static int signal_fd = -1;
+static int epoll_fd = -1;
+static int stdin_pollable = 0;
+
+void setup_signal_handlers(void)
+{
+    sigset_t handled;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTSTP);
+    sigaddset(&handled, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &handled, &child_sigmask);
+
+    // Reclaiming the terminal from a finished job must not stop the shell
+    signal(SIGTTOU, SIG_IGN);
+
+    signal_fd = signalfd(-1, &handled, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1)
+    {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Builtins that wait for their own children call this first: in a forked
+// pipeline stage the shell's signals start out unblocked, and a SIGCHLD
+// that is not blocked never reaches the signal fd
+void block_shell_signals(sigset_t *saved)
+{
+    sigset_t handled;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTSTP);
+    sigaddset(&handled, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &handled, saved);
+}
+
+// The epoll set is only needed once the shell waits on stdin, which a
+// script or -c string never does
+static void watch_stdin(void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = signal_fd};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+
+    // Regular files cannot be polled (EPERM); they are always readable
+    event.data.fd = STDIN_FILENO;
+    stdin_pollable = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0;
+}
+
+void dispatch_signals(void)
+{
+    struct signalfd_siginfo info;
+    int child_exited = 0;
+
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        // A burst of SIGCHLDs needs only one reaping pass
+        if (info.ssi_signo == SIGCHLD)
+            child_exited = 1;
+        else
+            handle_signal((int)info.ssi_signo);
+    }
+
+    if (child_exited)
+        handle_signal(SIGCHLD);
+}
+
+void wait_for_input(void)
+{
+    if (epoll_fd == -1)
+        watch_stdin();
+
+    if (!stdin_pollable)
+    {
+        dispatch_signals();
+        return;
+    }
+
+    for (;;)
+    {
+        struct epoll_event events[2];
+        int input_ready = 0;
+        int count = epoll_wait(epoll_fd, events, 2, -1);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.fd == signal_fd)
+                dispatch_signals();
+            else
+                input_ready = 1;
+        }
+        if (input_ready)
+            return;
+    }
+}
+
+void wait_for_signal(void)
+{
+    struct pollfd pfd = {.fd = signal_fd, .events = POLLIN};
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+        ;
+    dispatch_signals();
+}
+
+// Sleep until fd is readable or a signal arrives, handling the signal;
+// returns 1 when fd is readable
+int wait_for_fd(int fd)
+{
+    struct pollfd pfds[2] = {{.fd = signal_fd, .events = POLLIN}, {.fd = fd, .events = POLLIN}};
+    while (poll(pfds, 2, -1) == -1)
+    {
+        if (errno != EINTR)
+            return 1; // let the caller's read report the problem
+    }
+    if (pfds[0].revents)
+        dispatch_signals();
+    return pfds[1].revents != 0;
+}
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE // copy_file_range, splice, tee
+#include "shell.h"
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+// In-process cat, cp and tee. Data moves between descriptors inside the
+// kernel where it can: copy_file_range between regular files (a reflink
+// on filesystems that share extents), sendfile out of a regular file,
+// and splice/tee when a pipe is involved. Anything else goes through a
+// large page-aligned buffer. Options the builtins do not implement are
+// handed to the real utility, so scripts see the usual behaviour.
+//
+// Like a loop, a copy counts as a running command list: Ctrl+C sets
+// command_interrupted, which is checked between chunks and while waiting
+// for input.
+
+#define COPY_CHUNK (64L * 1024 * 1024) // per kernel copy call
+#define BUFFER_SIZE (1024 * 1024)
+#define UNSUPPORTED -2                  // nothing moved; try the next way
+
+typedef enum
+{
+    COPY_RANGE,
+    COPY_SENDFILE,
+    COPY_SPLICE
+} CopyMethod;
+
+// Sleep until fd has data, handling signals meanwhile; 0 on Ctrl+C.
+// Regular files never block, and a forked stage dies of SIGINT instead.
+static int wait_readable(int fd, const struct stat *st)
+{
+    while (!S_ISREG(st->st_mode))
+    {
+        if (wait_for_fd(fd))
+            return 1;
+        if (command_interrupted || !shell_running)
+            return 0;
+    }
+    dispatch_signals();
+    return !command_interrupted && shell_running;
+}
+
+static int copy_errno_unsupported(int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP || err == EBADF ||
+           err == ESPIPE;
+}
+
+// One kernel-side copy loop; returns 0 at end of input, -1 with errno set
+// on failure, or UNSUPPORTED if the very first call was refused
+static int kernel_copy(CopyMethod method, int in, const struct stat *in_st, int out)
+{
+    int moved = 0;
+    for (;;)
+    {
+        if (!wait_readable(in, in_st))
+        {
+            errno = EINTR;
+            return -1;
+        }
+
+        ssize_t count;
+        if (method == COPY_RANGE)
+            count = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+        else if (method == COPY_SENDFILE)
+            count = sendfile(out, in, NULL, COPY_CHUNK);
+        else
+            count = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (count == 0)
+            return 0;
+        if (count < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return !moved && copy_errno_unsupported(errno) ? UNSUPPORTED : -1;
+        }
+        moved = 1;
+    }
+}
+
+static char *copy_buffer(void)
+{
+    static char *buffer = NULL;
+    if (!buffer)
+        buffer = aligned_alloc(sysconf(_SC_PAGESIZE), BUFFER_SIZE);
+    return buffer;
+}
+
+static int write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+// Copy through userspace to every output; returns 0, or -1 with errno set
+static int buffered_copy(int in, const struct stat *in_st, const int *outs, int out_count)
+{
+    char *buffer = copy_buffer();
+    if (!buffer)
+        return -1;
+    if (S_ISREG(in_st->st_mode))
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (;;)
+    {
+        if (!wait_readable(in, in_st))
+        {
+            errno = EINTR;
+            return -1;
+        }
+        ssize_t count = read(in, buffer, BUFFER_SIZE);
+        if (count == 0)
+            return 0;
+        if (count < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return -1;
+        }
+        for (int i = 0; i < out_count; i++)
+        {
+            if (write_all(outs[i], buffer, count) != 0)
+                return -1;
+        }
+    }
+}
+
+// Move all of `in` to `out`, the cheapest way the pair allows
+static int copy_fd(int in, int out)
+{
+    struct stat in_st, out_st;
+    if (fstat(in, &in_st) != 0 || fstat(out, &out_st) != 0)
+        return -1;
+
+    int result = UNSUPPORTED;
+    if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode))
+        result = kernel_copy(COPY_RANGE, in, &in_st, out);
+    if (result == UNSUPPORTED && S_ISREG(in_st.st_mode))
+        result = kernel_copy(COPY_SENDFILE, in, &in_st, out);
+    if (result == UNSUPPORTED && (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)))
+        result = kernel_copy(COPY_SPLICE, in, &in_st, out);
+    if (result == UNSUPPORTED)
+        result = buffered_copy(in, &in_st, &out, 1);
+    return result;
+}
+
+// Copying a non-empty file onto itself would never end, or would
+// truncate the input before it is read
+static int copy_onto_itself(int in, int out)
+{
+    struct stat in_st, out_st;
+    return fstat(in, &in_st) == 0 && fstat(out, &out_st) == 0 && S_ISREG(in_st.st_mode) &&
+           in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino && in_st.st_size > 0;
+}
+
+// Options the builtin does not implement are left to the real utility
+static int run_utility(char **args)
+{
+    const char *path = path_cache_lookup(args[0]);
+    if (!path)
+    {
+        fprintf(stderr, "%s: %s: unsupported option\n", args[0], args[1]);
+        return 2;
+    }
+    fflush(stdout);
+
+    // A forked pipeline stage can become the utility outright
+    if (in_pipeline_stage)
+    {
+        execv(path, args);
+        perror(path);
+        return 126;
+    }
+
+    // The utility runs under its full path, so it is not taken for the builtin
+    char *name = args[0];
+    Command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = COMMAND_PIPELINE;
+    cmd.args = args;
+    args[0] = (char *)path;
+
+    sigset_t saved_mask;
+    block_shell_signals(&saved_mask);
+    int status = execute_pipeline(&cmd);
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+    args[0] = name;
+    return status;
+}
+
+// Skips the options in `allowed`, setting the matching flags; returns the
+// index of the first operand, or -1 for an option left to the utility
+static int parse_options(char **args, const char *allowed, int *flags)
+{
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++)
+    {
+        if (strcmp(args[i], "--") == 0)
+            return i + 1;
+        for (const char *opt = args[i] + 1; *opt; opt++)
+        {
+            const char *known = strchr(allowed, *opt);
+            if (!known)
+                return -1;
+            *flags |= 1 << (known - allowed);
+        }
+    }
+    return i;
+}
+
+// Reports a failure; EINTR means Ctrl+C, which is already on screen
+static int copy_failed(const char *name, const char *operand)
+{
+    if (errno == EINTR)
+        return 128 + SIGINT;
+    fprintf(stderr, "%s: %s: %s\n", name, operand, strerror(errno));
+    return 1;
+}
+
+int shell_cat(char **args)
+{
+    int flags = 0;
+    int first = parse_options(args, "u", &flags); // -u: output is never buffered here
+    if (first < 0)
+        return run_utility(args);
+
+    fflush(stdout);
+    loop_depth++;
+    int status = 0;
+    for (int i = first; (args[i] || i == first) && status != 128 + SIGINT; i++)
+    {
+        const char *name = args[i] ? args[i] : "-";
+        int in = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+        if (in == -1)
+        {
+            status = copy_failed("cat", name);
+            continue;
+        }
+
+        if (copy_onto_itself(in, STDOUT_FILENO))
+        {
+            fprintf(stderr, "cat: %s: input file is output file\n", name);
+            status = 1;
+        }
+        else if (copy_fd(in, STDOUT_FILENO) != 0)
+        {
+            status = copy_failed("cat", name);
+        }
+        if (in != STDIN_FILENO)
+            close(in);
+        if (!args[i])
+            break;
+    }
+    loop_depth--;
+    return status;
+}
+
+static int copy_file(const char *source, const char *target)
+{
+    int in = open(source, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in == -1 || fstat(in, &st) != 0)
+    {
+        int status = copy_failed("cp", source);
+        if (in != -1)
+            close(in);
+        return status;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "cp: -r not specified; omitting directory '%s'\n", source);
+        close(in);
+        return 1;
+    }
+
+    // Opened without O_TRUNC, so the check below runs before any loss
+    int out = open(target, O_WRONLY | O_CREAT | O_CLOEXEC, st.st_mode & 07777);
+    if (out == -1)
+    {
+        close(in);
+        return copy_failed("cp", target);
+    }
+
+    int status = 0;
+    if (copy_onto_itself(in, out))
+    {
+        fprintf(stderr, "cp: '%s' and '%s' are the same file\n", source, target);
+        status = 1;
+    }
+    else if (ftruncate(out, 0) != 0 || copy_fd(in, out) != 0)
+    {
+        status = copy_failed("cp", target);
+    }
+    if (close(out) != 0 && status == 0)
+        status = copy_failed("cp", target);
+    close(in);
+    return status;
+}
+
+int shell_cp(char **args)
+{
+    int flags = 0;
+    int first = parse_options(args, "", &flags);
+    if (first < 0)
+        return run_utility(args);
+
+    int count = 0;
+    while (args[first + count])
+        count++;
+    if (count < 2)
+    {
+        fprintf(stderr, count ? "cp: missing destination file operand after '%s'\n" : "cp: missing file operand\n",
+                args[first]);
+        return 1;
+    }
+
+    // Into a directory, every source keeps its name
+    const char *target = args[first + count - 1];
+    struct stat st;
+    int into_dir = stat(target, &st) == 0 && S_ISDIR(st.st_mode);
+    if (count > 2 && !into_dir)
+    {
+        fprintf(stderr, "cp: target '%s' is not a directory\n", target);
+        return 1;
+    }
+
+    loop_depth++;
+    int status = 0;
+    for (int i = first; i < first + count - 1 && !command_interrupted; i++)
+    {
+        char path[PATH_MAX];
+        if (into_dir)
+        {
+            const char *base = strrchr(args[i], '/');
+            snprintf(path, sizeof(path), "%s/%s", target, base ? base + 1 : args[i]);
+        }
+        int result = copy_file(args[i], into_dir ? path : target);
+        if (result != 0)
+            status = result;
+    }
+    loop_depth--;
+    return status;
+}
+
+// tee(2) duplicates pipe contents without consuming them. Every output
+// but the last gets a duplicate through a scratch pipe; the last one is
+// spliced the data itself. Needs at least two outputs. Returns
+// UNSUPPORTED, before anything is written, if the first output refuses.
+static int splice_tee(const int *outs, int out_count)
+{
+    int scratch[2];
+    if (pipe2(scratch, O_CLOEXEC) != 0)
+        return UNSUPPORTED;
+    fcntl(scratch[1], F_SETPIPE_SZ, BUFFER_SIZE);
+
+    struct stat in_st;
+    fstat(STDIN_FILENO, &in_st);
+    int result = 0;
+    int moved = 0;
+    for (;;)
+    {
+        if (!wait_readable(STDIN_FILENO, &in_st))
+        {
+            errno = EINTR;
+            result = -1;
+            break;
+        }
+
+        // The first duplicate fixes how much this round moves
+        ssize_t round = tee(STDIN_FILENO, scratch[1], BUFFER_SIZE, 0);
+        if (round <= 0)
+        {
+            if (round < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            result = round == 0 ? 0 : !moved && copy_errno_unsupported(errno) ? UNSUPPORTED : -1;
+            break;
+        }
+
+        for (int i = 0; i < out_count && result == 0; i++)
+        {
+            if (i > 0 && i < out_count - 1 && tee(STDIN_FILENO, scratch[1], round, 0) != round)
+            {
+                errno = EIO;
+                result = -1;
+            }
+            int from = i < out_count - 1 ? scratch[0] : STDIN_FILENO;
+            for (ssize_t left = round; left > 0 && result == 0;)
+            {
+                ssize_t count = splice(from, NULL, outs[i], NULL, left, SPLICE_F_MOVE);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                    result = !moved && i == 0 && copy_errno_unsupported(errno) ? UNSUPPORTED : -1;
+                else
+                    left -= count;
+            }
+        }
+        if (result != 0)
+            break;
+        moved = 1;
+    }
+    close(scratch[0]);
+    close(scratch[1]);
+    return result;
+}
+
+int shell_tee(char **args)
+{
+    int flags = 0;
+    int first = parse_options(args, "a", &flags);
+    if (first < 0)
+        return run_utility(args);
+    int append = flags & 1;
+
+    // A glob can name any number of outputs
+    int count = 1;
+    while (args[first + count - 1])
+        count++;
+    int *outs = malloc(count * sizeof(int));
+    if (!outs)
+    {
+        fprintf(stderr, "tee: out of memory\n");
+        return 1;
+    }
+    int out_count = 0;
+    int status = 0;
+
+    fflush(stdout);
+    outs[out_count++] = STDOUT_FILENO;
+    for (int i = first; args[i]; i++)
+    {
+        int fd = open(args[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666);
+        if (fd == -1)
+        {
+            status = copy_failed("tee", args[i]);
+            continue;
+        }
+        outs[out_count++] = fd;
+    }
+
+    // Splicing needs stdin to be a pipe and outputs that take spliced
+    // data at the current offset: pipes, or regular files not in append mode
+    struct stat st;
+    int can_splice = fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+    for (int i = 0; i < out_count && can_splice; i++)
+    {
+        can_splice = fstat(outs[i], &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode)) &&
+                     !(fcntl(outs[i], F_GETFL) & O_APPEND);
+    }
+
+    loop_depth++;
+    int result;
+    if (out_count == 1)
+        result = copy_fd(STDIN_FILENO, STDOUT_FILENO);
+    else
+        result = can_splice ? splice_tee(outs, out_count) : UNSUPPORTED;
+    if (result == UNSUPPORTED)
+    {
+        fstat(STDIN_FILENO, &st);
+        result = buffered_copy(STDIN_FILENO, &st, outs, out_count);
+    }
+    loop_depth--;
+    if (result != 0)
+        status = copy_failed("tee", "write error");
+
+    for (int i = 1; i < out_count; i++)
+        close(outs[i]);
+    free(outs);
+    return status;
+}
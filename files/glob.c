@@ -0,0 +1,672 @@
+#define _GNU_SOURCE // qsort_r
+#include "shell.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Brace and pathname expansion. The lexer turns unquoted *, ?, [ and
+// braces into markers, so quoted ones never expand. Braces expand first,
+// left to right; every result is then matched against the filesystem and
+// its matches sorted. A pattern that matches nothing stays as typed.
+//
+// Directory listings are cached sorted, keyed by device and inode, and
+// reused while the directory's mtime is unchanged, so globbing a large
+// directory again costs a stat instead of a readdir. Segments without
+// glob characters are joined without listing anything, and the literal
+// start of a segment narrows a sorted listing by binary search.
+
+#define DIR_CACHE_SLOTS 64
+
+// A listing taken within this long of the directory's last change may
+// have missed a change that kept the same mtime, so it is not reused
+#define RACY_NS 1000000000LL
+
+typedef struct
+{
+    uint32_t name;      // offset into the listing's names
+    unsigned char type; // d_type
+} DirEntry;
+
+typedef struct
+{
+    dev_t device;
+    ino_t inode;
+    struct timespec mtime;
+    int trusted;
+    int pinned;         // in use by a glob further up the path
+    int sorted;
+    uint64_t last_used;
+    char *names;        // NUL-terminated, back to back
+    DirEntry *entries;  // sorted by name once the listing is reused
+    size_t count;
+} DirListing;
+
+// Listings can outgrow the shell's pool, so they use libc
+static DirListing dir_cache[DIR_CACHE_SLOTS];
+static uint64_t cache_clock = 0;
+
+typedef struct
+{
+    WordList *list;
+    size_t first;  // where this pattern's matches start in the list
+    int dirs_only; // the pattern ended in '/'
+    int failed;    // errno of the first failure, or 0
+    Arena *arena;
+    char path[PATH_MAX];
+} GlobState;
+
+// Append a word, doubling the arena-backed array when it fills up; the
+// array always has room for its NULL terminator
+int word_list_add(WordList *list, char *word, Arena *arena)
+{
+    if (list->count + 1 >= list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : MAX_ARGS;
+        char **words = arena_alloc(arena, capacity * sizeof(char *));
+        if (!words)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        if (list->count)
+            memcpy(words, list->words, list->count * sizeof(char *));
+        list->words = words;
+        list->capacity = capacity;
+    }
+    list->words[list->count++] = word;
+    list->words[list->count] = NULL;
+    return 0;
+}
+
+static void free_listing(DirListing *listing)
+{
+    free(listing->names);
+    free(listing->entries);
+    memset(listing, 0, sizeof(DirListing));
+}
+
+void glob_cache_reset(void)
+{
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+        free_listing(&dir_cache[i]);
+}
+
+static int compare_entries(const void *a, const void *b, void *names)
+{
+    return strcmp((char *)names + ((const DirEntry *)a)->name, (char *)names + ((const DirEntry *)b)->name);
+}
+
+static int64_t timespec_ns(struct timespec time)
+{
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+// Read the directory open on fd into `listing`; 0 on success
+static int read_listing(DirListing *listing, int fd, const struct stat *st)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    DIR *dir = fdopendir(fd);
+    if (!dir)
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t names_size = 0, names_capacity = 0, entry_capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+
+        size_t length = strlen(name) + 1;
+        if (names_size + length > names_capacity)
+        {
+            names_capacity = names_capacity ? names_capacity * 2 : 16384;
+            if (names_capacity < names_size + length)
+                names_capacity = names_size + length;
+            char *grown = realloc(listing->names, names_capacity);
+            if (!grown)
+                break;
+            listing->names = grown;
+        }
+        if (listing->count == entry_capacity)
+        {
+            entry_capacity = entry_capacity ? entry_capacity * 2 : 512;
+            DirEntry *grown = realloc(listing->entries, entry_capacity * sizeof(DirEntry));
+            if (!grown)
+                break;
+            listing->entries = grown;
+        }
+        memcpy(listing->names + names_size, name, length);
+        listing->entries[listing->count++] = (DirEntry){(uint32_t)names_size, entry->d_type};
+        names_size += length;
+    }
+    int failed = entry != NULL;
+    closedir(dir);
+    if (failed)
+    {
+        free_listing(listing);
+        return -1;
+    }
+
+    listing->device = st->st_dev;
+    listing->inode = st->st_ino;
+    listing->mtime = st->st_mtim;
+    listing->trusted = timespec_ns(now) - timespec_ns(st->st_mtim) > RACY_NS;
+    return 0;
+}
+
+// The listing of `path`, from the cache when it is still current. A new
+// listing is scanned in readdir order, since the directory may change
+// before the next glob; one that is reused is sorted for binary search.
+// The caller pins it while descending, so deeper levels cannot evict it.
+static DirListing *get_listing(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    DirListing *slot = NULL;
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+    {
+        DirListing *listing = &dir_cache[i];
+        if (listing->names && listing->device == st.st_dev && listing->inode == st.st_ino)
+        {
+            // A pinned listing is reused even if stale, as a glob above holds it
+            if (listing->pinned || (listing->trusted && listing->mtime.tv_sec == st.st_mtim.tv_sec &&
+                                    listing->mtime.tv_nsec == st.st_mtim.tv_nsec))
+            {
+                if (!listing->sorted && !listing->pinned)
+                {
+                    qsort_r(listing->entries, listing->count, sizeof(DirEntry), compare_entries, listing->names);
+                    listing->sorted = 1;
+                }
+                listing->last_used = ++cache_clock;
+                return listing;
+            }
+            slot = listing;
+            break;
+        }
+        if (listing->pinned)
+            continue;
+        if (!slot || (slot->names && (!listing->names || listing->last_used < slot->last_used)))
+            slot = listing;
+    }
+    if (!slot)
+        return NULL;
+
+    free_listing(slot);
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) != 0)
+    {
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    if (read_listing(slot, fd, &st) != 0)
+        return NULL;
+    slot->last_used = ++cache_clock;
+    return slot;
+}
+
+// Size of the bracket expression after a GLOB_CLASS, including its ']',
+// or 0 if it is never closed within the segment
+static size_t class_length(const char *p)
+{
+    size_t i = 0;
+    if (p[i] == '!' || p[i] == '^')
+        i++;
+    if (p[i] == ']')
+        i++;
+    while (p[i] && p[i] != ']' && p[i] != '/')
+        i++;
+    return p[i] == ']' ? i + 1 : 0;
+}
+
+static int class_matches(const char *p, size_t length, unsigned char c)
+{
+    int negate = *p == '!' || *p == '^';
+    int found = 0;
+    for (size_t i = negate; i < length - 1;)
+    {
+        unsigned char low = p[i];
+        if (i + 2 < length - 1 && p[i + 1] == '-')
+        {
+            found |= c >= low && c <= (unsigned char)p[i + 2];
+            i += 3;
+        }
+        else
+        {
+            found |= c == low;
+            i++;
+        }
+    }
+    return found != negate;
+}
+
+// Match one path segment against a segment pattern, backtracking to the
+// last '*' on a mismatch
+static int match_segment(const char *pattern, const char *name)
+{
+    const char *star_pattern = NULL;
+    const char *star_name = NULL;
+    while (*name)
+    {
+        if (*pattern == GLOB_STAR)
+        {
+            star_pattern = ++pattern;
+            star_name = name;
+            continue;
+        }
+        if (*pattern == GLOB_ANY || *pattern == *name)
+        {
+            pattern++;
+            name++;
+            continue;
+        }
+        if (*pattern == GLOB_CLASS)
+        {
+            size_t length = class_length(pattern + 1);
+            if (class_matches(pattern + 1, length, *name))
+            {
+                pattern += 1 + length;
+                name++;
+                continue;
+            }
+        }
+        if (!star_pattern)
+            return 0;
+        pattern = star_pattern;
+        name = ++star_name;
+    }
+    while (*pattern == GLOB_STAR)
+        pattern++;
+    return *pattern == '\0';
+}
+
+static char marker_char(char c)
+{
+    switch (c)
+    {
+    case GLOB_STAR:
+        return '*';
+    case GLOB_ANY:
+        return '?';
+    case GLOB_CLASS:
+        return '[';
+    case BRACE_OPEN:
+        return '{';
+    case BRACE_COMMA:
+        return ',';
+    case BRACE_CLOSE:
+        return '}';
+    default:
+        return c;
+    }
+}
+
+// Turn every marker back into the character it stands for
+static void unmark(char *word)
+{
+    for (; *word; word++)
+        *word = marker_char(*word);
+}
+
+// Leave only markers that still mean something to the matcher: braces
+// are done with, a '[' that is never closed is literal, and so is
+// everything inside a bracket expression. Returns whether any remain.
+static int prepare_pattern(char *word)
+{
+    int globs = 0;
+    for (char *p = word; *p; p++)
+    {
+        if (*p == GLOB_CLASS)
+        {
+            size_t length = class_length(p + 1);
+            if (!length)
+            {
+                *p = '[';
+                continue;
+            }
+            for (size_t i = 1; i <= length; i++)
+                p[i] = marker_char(p[i]);
+            p += length;
+            globs = 1;
+        }
+        else if (*p == GLOB_STAR || *p == GLOB_ANY)
+            globs = 1;
+        else
+            *p = marker_char(*p);
+    }
+    return globs;
+}
+
+static void add_match(GlobState *state, const char *path)
+{
+    char *copy = arena_strdup(state->arena, path);
+    if (!copy || word_list_add(state->list, copy, state->arena) != 0)
+        state->failed = ENOMEM;
+}
+
+static int is_directory(const char *path, unsigned char type)
+{
+    struct stat st;
+    if (type == DT_DIR)
+        return 1;
+    if (type != DT_LNK && type != DT_UNKNOWN)
+        return 0;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// The last segment has been appended to state->path, `length` bytes long
+static void finish_match(GlobState *state, size_t length, unsigned char type)
+{
+    if (!state->dirs_only)
+    {
+        add_match(state, state->path);
+        return;
+    }
+    if (length + 2 > sizeof(state->path) || !is_directory(state->path, type))
+        return;
+    state->path[length] = '/';
+    state->path[length + 1] = '\0';
+    add_match(state, state->path);
+}
+
+// Match segments[0..count) below state->path, whose first `length` bytes
+// are the directory reached so far ("" for the current one)
+static void glob_segments(GlobState *state, size_t length, char **segments, int count)
+{
+    const char *segment = segments[0];
+    int last = count == 1;
+
+    // A literal segment needs no listing; only a final one must exist
+    if (!strpbrk(segment, GLOB_MARKERS))
+    {
+        size_t n = strlen(segment);
+        if (length + n + 2 > sizeof(state->path))
+            return;
+        memcpy(state->path + length, segment, n + 1);
+        struct stat st;
+        if (!last)
+        {
+            state->path[length + n] = '/';
+            glob_segments(state, length + n + 1, segments + 1, count - 1);
+        }
+        else if (lstat(state->path, &st) == 0)
+        {
+            finish_match(state, length + n, S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN);
+        }
+        return;
+    }
+
+    state->path[length] = '\0';
+    DirListing *listing = get_listing(length ? state->path : ".");
+    if (!listing)
+        return;
+    listing->pinned++;
+
+    // Names sharing the segment's literal start are one sorted run, and a
+    // literal end after the last '*' rules names out before matching
+    size_t prefix = strcspn(segment, GLOB_MARKERS);
+    const char *tail = strrchr(segment, GLOB_STAR);
+    size_t tail_length = 0;
+    if (tail && !strpbrk(++tail, GLOB_MARKERS))
+        tail_length = strlen(tail);
+    size_t low = 0, high = listing->count;
+    while (listing->sorted && low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (strncmp(listing->names + listing->entries[mid].name, segment, prefix) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    for (size_t i = low; i < listing->count && !state->failed; i++)
+    {
+        const char *name = listing->names + listing->entries[i].name;
+        if (strncmp(name, segment, prefix) != 0)
+        {
+            if (listing->sorted)
+                break;
+            continue;
+        }
+        size_t n = strlen(name);
+        if (n < tail_length || memcmp(name + n - tail_length, tail, tail_length) != 0)
+            continue;
+        // Hidden names only match a pattern that starts with a literal '.'
+        if ((name[0] == '.' && segment[0] != '.') || !match_segment(segment, name))
+            continue;
+
+        if (length + n + 2 > sizeof(state->path))
+            continue;
+        memcpy(state->path + length, name, n + 1);
+        if (last)
+            finish_match(state, length + n, listing->entries[i].type);
+        else if (is_directory(state->path, listing->entries[i].type))
+        {
+            state->path[length + n] = '/';
+            glob_segments(state, length + n + 1, segments + 1, count - 1);
+        }
+    }
+    listing->pinned--;
+}
+
+static int compare_words(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Pathname expansion of one brace-expanded word, which is modified;
+// 0, or -1 with errno set
+static int glob_word(char *word, WordList *list, Arena *arena)
+{
+    if (!prepare_pattern(word))
+        return word_list_add(list, word, arena);
+
+    // Split a copy at its slashes, so the word stays whole for no match
+    GlobState state = {.list = list, .first = list->count, .arena = arena};
+    char *p = arena_strdup(arena, word);
+    if (!p)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    char *segments[256];
+    int count = 0;
+    size_t length = 0;
+    if (*p == '/')
+        state.path[length++] = '/';
+    while (*p)
+    {
+        while (*p == '/')
+            *p++ = '\0';
+        if (!*p)
+        {
+            state.dirs_only = count > 0;
+            break;
+        }
+        if (count == (int)(sizeof(segments) / sizeof(segments[0])))
+        {
+            count = 0; // too deep to be a real path; left as typed
+            break;
+        }
+        segments[count++] = p;
+        p += strcspn(p, "/");
+    }
+
+    if (count > 0)
+        glob_segments(&state, length, segments, count);
+    if (state.failed)
+    {
+        errno = state.failed;
+        return -1;
+    }
+    if (list->count == state.first)
+    {
+        unmark(word);
+        return word_list_add(list, word, arena);
+    }
+    qsort(list->words + state.first, list->count - state.first, sizeof(char *), compare_words);
+    return 0;
+}
+
+// A {first..last} sequence of integers or single characters
+static int parse_sequence(const char *body, size_t length, long *first, long *last, int *letters)
+{
+    char text[64];
+    if (length >= sizeof(text))
+        return 0;
+    memcpy(text, body, length);
+    text[length] = '\0';
+
+    char *dots = strstr(text, "..");
+    if (!dots || dots == text || dots[2] == '\0')
+        return 0;
+    *dots = '\0';
+    const char *end_text = dots + 2;
+
+    *letters = !text[1] && !end_text[1] && isalpha((unsigned char)text[0]) && isalpha((unsigned char)end_text[0]);
+    if (*letters)
+    {
+        *first = (unsigned char)text[0];
+        *last = (unsigned char)end_text[0];
+        return 1;
+    }
+    char *end;
+    *first = strtol(text, &end, 10);
+    if (*end || end == text)
+        return 0;
+    *last = strtol(end_text, &end, 10);
+    return !*end;
+}
+
+// The first brace expression that expands: a comma list or a sequence
+static char *find_braces(char *word, char **close)
+{
+    for (char *open = strchr(word, BRACE_OPEN); open; open = strchr(open + 1, BRACE_OPEN))
+    {
+        int depth = 0;
+        int commas = 0;
+        for (char *p = open; *p; p++)
+        {
+            if (*p == BRACE_OPEN)
+                depth++;
+            else if (*p == BRACE_COMMA && depth == 1)
+                commas++;
+            else if (*p == BRACE_CLOSE && --depth == 0)
+            {
+                long first, last;
+                int letters;
+                if (commas || parse_sequence(open + 1, p - open - 1, &first, &last, &letters))
+                {
+                    *close = p;
+                    return open;
+                }
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+// word[0..prefix) + middle + suffix, in the arena
+static char *splice_word(Arena *arena, const char *word, size_t prefix, const char *middle, size_t middle_length,
+                         const char *suffix)
+{
+    size_t suffix_length = strlen(suffix);
+    char *result = arena_alloc(arena, prefix + middle_length + suffix_length + 1);
+    if (!result)
+        return NULL;
+    memcpy(result, word, prefix);
+    memcpy(result + prefix, middle, middle_length);
+    memcpy(result + prefix + middle_length, suffix, suffix_length + 1);
+    return result;
+}
+
+// Brace-expand `word` onto `words`; 0, or -1 with errno set
+static int expand_braces(char *word, WordList *words, Arena *arena)
+{
+    char *close;
+    char *open = find_braces(word, &close);
+    if (!open)
+        return word_list_add(words, word, arena);
+
+    size_t prefix = open - word;
+    long first, last;
+    int letters;
+    char *body = open + 1;
+    if (parse_sequence(body, close - body, &first, &last, &letters))
+    {
+        long step = first <= last ? 1 : -1;
+        for (long value = first;; value += step)
+        {
+            char text[32];
+            int n = letters ? snprintf(text, sizeof(text), "%c", (int)value)
+                            : snprintf(text, sizeof(text), "%ld", value);
+            char *result = splice_word(arena, word, prefix, text, n, close + 1);
+            if (!result)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+            if (expand_braces(result, words, arena) != 0)
+                return -1;
+            if (value == last)
+                break;
+        }
+        return 0;
+    }
+
+    // Split at the commas of this level only; nested lists expand later
+    int depth = 0;
+    char *start = body;
+    for (char *p = body; p <= close; p++)
+    {
+        if (*p == BRACE_OPEN)
+            depth++;
+        else if (*p == BRACE_CLOSE && p != close)
+            depth--;
+        else if ((*p == BRACE_COMMA && depth == 0) || p == close)
+        {
+            char *result = splice_word(arena, word, prefix, start, p - start, close + 1);
+            if (!result)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+            if (expand_braces(result, words, arena) != 0)
+                return -1;
+            start = p + 1;
+        }
+    }
+    return 0;
+}
+
+// Append the brace and glob expansion of a marked word to `list`;
+// 0, or -1 with errno set
+int expand_glob(const char *word, WordList *list, Arena *arena)
+{
+    char *copy = arena_strdup(arena, word);
+    if (!copy)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    WordList words = {0};
+    if (expand_braces(copy, &words, arena) != 0)
+        return -1;
+    for (size_t i = 0; i < words.count; i++)
+    {
+        if (glob_word(words.words[i], list, arena) != 0)
+            return -1;
+    }
+    return 0;
+}
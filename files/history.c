@@ -0,0 +1,595 @@
+#define _GNU_SOURCE // memmem, mremap
+#include "shell.h"
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Command history is one append-only text file, an entry per line, shared
+// by every shell. A shell appends to it under flock and otherwise only
+// reads it through a shared mapping. Nothing is read at startup: the
+// first lookup indexes the file and saves the index beside it, so later
+// shells load that and only index what was appended since.
+//
+// The index holds each entry's offset and, per block of HISTORY_BLOCK
+// entries, a signature: a bitmap of the hashed bigrams and trigrams in
+// the block's entries. A line start counts as a character, so prefixes
+// have grams of their own. A search skips every block whose signature
+// lacks one of the query's grams and scans the rest.
+
+#define HISTORY_INDEX_MAGIC "MYSHHI\0"
+#define HISTORY_INDEX_VERSION 1
+#define HISTORY_BLOCK 64
+#define SIGNATURE_SHIFT 12 // 4096 bits per block
+#define SIGNATURE_WORDS ((1 << SIGNATURE_SHIFT) / 64)
+#define LINE_START '\002'
+#define TAIL_HASH_BYTES 64
+
+typedef struct
+{
+    uint64_t bits[SIGNATURE_WORDS];
+} Signature;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t indexed_size; // bytes of the history file covered
+    uint64_t tail_hash;    // of the last bytes covered, to spot a rewritten file
+    uint64_t device;
+    uint64_t inode;
+} HistoryIndexHeader;
+
+// A query as the signature words it needs, zero words left out
+typedef struct
+{
+    uint32_t word[SIGNATURE_WORDS];
+    uint64_t mask[SIGNATURE_WORDS];
+    int count;
+} GramQuery;
+
+static char history_path[PATH_MAX];
+static int history_fd = -1;
+static int history_failed = 0; // no history file; stop trying
+static int index_loaded = 0;
+static struct stat history_st;
+
+static const char *history_map = NULL;
+static size_t map_size = 0;
+static size_t indexed_size = 0;
+
+// Index arrays can outgrow the shell's pool, so they use libc
+static uint32_t *offsets = NULL;
+static uint32_t entry_count = 0;
+static uint32_t entry_capacity = 0;
+static Signature *signatures = NULL;
+static uint32_t saved_count = 0; // entries covered by the index file
+static char *last_added = NULL;
+
+// The history file is $MYSHELL_HISTFILE, else ~/.myshell_history; an
+// empty MYSHELL_HISTFILE turns history off
+static int open_history(void)
+{
+    if (history_fd != -1)
+        return 0;
+    if (history_failed)
+        return -1;
+
+    const char *env = getenv("MYSHELL_HISTFILE");
+    const char *home = getenv("HOME");
+    int written;
+    if (env)
+        written = snprintf(history_path, sizeof(history_path), "%s", env);
+    else if (home && *home)
+        written = snprintf(history_path, sizeof(history_path), "%s/.myshell_history", home);
+    else
+        written = 0;
+
+    if (written > 0 && (size_t)written < sizeof(history_path))
+        history_fd = open(history_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history_fd == -1 || fstat(history_fd, &history_st) != 0)
+    {
+        if (written > 0)
+            perror(history_path);
+        if (history_fd != -1)
+            close(history_fd);
+        history_fd = -1;
+        history_failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// Records an interactive line. Blank lines and repeats of the previous
+// line are left out. One write per entry on an O_APPEND descriptor, under
+// an exclusive lock, keeps entries from concurrent shells whole.
+void history_add(const char *line)
+{
+    const char *text = line + strspn(line, " \t");
+    if (*text == '\0' || (last_added && strcmp(last_added, line) == 0))
+        return;
+    if (open_history() != 0)
+        return;
+
+    struct iovec parts[2] = {{(void *)line, strlen(line)}, {"\n", 1}};
+    flock(history_fd, LOCK_EX);
+    int iov_index = 0;
+    while (iov_index < 2)
+    {
+        ssize_t written = writev(history_fd, parts + iov_index, 2 - iov_index);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("history");
+            break;
+        }
+        // A short write leaves the rest of the entry to go out next
+        while (iov_index < 2 && (size_t)written >= parts[iov_index].iov_len)
+            written -= parts[iov_index++].iov_len;
+        if (iov_index < 2)
+        {
+            parts[iov_index].iov_base = (char *)parts[iov_index].iov_base + written;
+            parts[iov_index].iov_len -= written;
+        }
+    }
+    flock(history_fd, LOCK_UN);
+
+    free(last_added);
+    last_added = strdup(line);
+}
+
+static inline void set_gram(Signature *signature, uint32_t gram)
+{
+    uint32_t bit = (gram * 2654435761u) >> (32 - SIGNATURE_SHIFT);
+    signature->bits[bit / 64] |= 1ULL << (bit % 64);
+}
+
+// Bigrams are tagged above the 24 bits a trigram uses
+static void sign_text(Signature *signature, const char *text, size_t length, int line_start)
+{
+    uint32_t prev2 = 0;
+    uint32_t prev = LINE_START;
+    size_t seen = line_start ? 1 : 0;
+
+    for (size_t i = 0; i < length; i++, seen++)
+    {
+        uint32_t c = (unsigned char)text[i];
+        if (seen >= 1)
+            set_gram(signature, 1u << 24 | prev << 8 | c);
+        if (seen >= 2)
+            set_gram(signature, prev2 << 16 | prev << 8 | c);
+        prev2 = prev;
+        prev = c;
+    }
+}
+
+static void reset_index(void)
+{
+    entry_count = 0;
+    indexed_size = 0;
+    saved_count = 0;
+}
+
+static int reserve_entries(uint32_t count)
+{
+    if (count <= entry_capacity)
+        return 0;
+
+    uint32_t capacity = entry_capacity ? entry_capacity : 1024;
+    while (capacity < count)
+        capacity *= 2;
+    uint32_t *grown_offsets = realloc(offsets, capacity * sizeof(uint32_t));
+    if (!grown_offsets)
+        return -1;
+    offsets = grown_offsets;
+    Signature *grown_signatures = realloc(signatures, capacity / HISTORY_BLOCK * sizeof(Signature));
+    if (!grown_signatures)
+        return -1;
+    signatures = grown_signatures;
+    entry_capacity = capacity;
+    return 0;
+}
+
+static int add_entry(size_t offset, size_t length)
+{
+    if (reserve_entries(entry_count + 1) != 0)
+        return -1;
+    Signature *signature = &signatures[entry_count / HISTORY_BLOCK];
+    if (entry_count % HISTORY_BLOCK == 0)
+        memset(signature, 0, sizeof(Signature));
+    offsets[entry_count++] = offset;
+    sign_text(signature, history_map + offset, length, 1);
+    return 0;
+}
+
+// Index the complete lines past what is indexed already; a line another
+// shell is still writing waits for the next refresh
+static void index_entries(size_t size)
+{
+    // Offsets are 32 bits; beyond 4 GB the file is no longer indexed
+    if (size > UINT32_MAX)
+        size = UINT32_MAX;
+
+    const char *pos = history_map + indexed_size;
+    const char *end = history_map + size;
+    const char *newline;
+    while (pos < end && (newline = memchr(pos, '\n', end - pos)))
+    {
+        if (add_entry(pos - history_map, newline - pos) != 0)
+            break;
+        pos = newline + 1;
+    }
+    indexed_size = pos - history_map;
+}
+
+// FNV-1a over the bytes just before `size`
+static uint64_t tail_hash(size_t size)
+{
+    size_t start = size > TAIL_HASH_BYTES ? size - TAIL_HASH_BYTES : 0;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = start; i < size; i++)
+    {
+        hash ^= (unsigned char)history_map[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int read_exact(int fd, void *data, size_t size, off_t offset)
+{
+    char *pos = data;
+    while (size > 0)
+    {
+        ssize_t got = pread(fd, pos, size, offset);
+        if (got <= 0)
+        {
+            if (got == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        pos += got;
+        offset += got;
+        size -= got;
+    }
+    return 0;
+}
+
+static int index_file_path(char *out, size_t size)
+{
+    int written = snprintf(out, size, "%s.index", history_path);
+    return written > 0 && (size_t)written < size ? 0 : -1;
+}
+
+// Take over a saved index if it still describes a prefix of the history
+// file; anything stale or corrupt is ignored and the file indexed afresh
+static void load_index(size_t size)
+{
+    char path[PATH_MAX];
+    HistoryIndexHeader header;
+    struct stat st;
+
+    if (index_file_path(path, sizeof(path)) != 0)
+        return;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    uint64_t blocks = 0;
+    int valid = fstat(fd, &st) == 0 && read_exact(fd, &header, sizeof(header), 0) == 0 &&
+                memcmp(header.magic, HISTORY_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+                header.version == HISTORY_INDEX_VERSION && header.device == (uint64_t)history_st.st_dev &&
+                header.inode == (uint64_t)history_st.st_ino && header.entry_count > 0 && header.indexed_size > 0 &&
+                header.indexed_size <= size && header.indexed_size <= UINT32_MAX &&
+                history_map[header.indexed_size - 1] == '\n' && header.tail_hash == tail_hash(header.indexed_size);
+    if (valid)
+    {
+        blocks = (header.entry_count + HISTORY_BLOCK - 1) / HISTORY_BLOCK;
+        valid = (uint64_t)st.st_size ==
+                    sizeof(header) + header.entry_count * sizeof(uint32_t) + blocks * sizeof(Signature) &&
+                reserve_entries(blocks * HISTORY_BLOCK) == 0 &&
+                read_exact(fd, offsets, header.entry_count * sizeof(uint32_t), sizeof(header)) == 0 &&
+                read_exact(fd, signatures, blocks * sizeof(Signature),
+                           sizeof(header) + header.entry_count * sizeof(uint32_t)) == 0;
+    }
+    close(fd);
+
+    // Entries must be in order and end where the next begins
+    for (uint32_t i = 0; valid && i < header.entry_count; i++)
+    {
+        uint32_t end = i + 1 < header.entry_count ? offsets[i + 1] : header.indexed_size;
+        valid = (i == 0 ? offsets[0] == 0 : offsets[i] > offsets[i - 1]) && end > offsets[i] &&
+                end <= header.indexed_size && history_map[end - 1] == '\n';
+    }
+    if (!valid)
+        return;
+
+    entry_count = header.entry_count;
+    saved_count = entry_count;
+    indexed_size = header.indexed_size;
+}
+
+// Map and index whatever this and other shells have appended
+static int refresh_history(void)
+{
+    struct stat st;
+    if (open_history() != 0 || fstat(history_fd, &st) != 0)
+        return -1;
+
+    size_t size = st.st_size;
+    if (size < indexed_size)
+    {
+        // Truncated or rewritten underneath us: start over
+        reset_index();
+    }
+    if (size != map_size)
+    {
+        void *map;
+        if (size == 0)
+            map = NULL;
+        else if (map_size == 0)
+            map = mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0);
+        else
+            map = mremap((void *)history_map, map_size, size, MREMAP_MAYMOVE);
+        if (size > 0 && map == MAP_FAILED)
+        {
+            perror("history");
+            return -1;
+        }
+        if (size == 0 && map_size > 0)
+            munmap((void *)history_map, map_size);
+        history_map = map;
+        map_size = size;
+    }
+
+    if (!index_loaded && size > 0)
+    {
+        load_index(size);
+        index_loaded = 1;
+    }
+    index_entries(size);
+    return 0;
+}
+
+static const char *entry_text(uint32_t index, size_t *length)
+{
+    size_t end = index + 1 < entry_count ? offsets[index + 1] : indexed_size;
+    *length = end - 1 - offsets[index];
+    return history_map + offsets[index];
+}
+
+uint32_t history_count(void)
+{
+    return refresh_history() == 0 ? entry_count : 0;
+}
+
+// The entry's text, not NUL-terminated; valid until the next refresh
+const char *history_entry(uint32_t index, size_t *length)
+{
+    if (index >= entry_count)
+        return NULL;
+    return entry_text(index, length);
+}
+
+static void build_query(GramQuery *query, const char *text, size_t length, int prefix)
+{
+    Signature signature;
+    memset(&signature, 0, sizeof(signature));
+    sign_text(&signature, text, length, prefix);
+
+    query->count = 0;
+    for (uint32_t w = 0; w < SIGNATURE_WORDS; w++)
+    {
+        if (signature.bits[w])
+        {
+            query->word[query->count] = w;
+            query->mask[query->count++] = signature.bits[w];
+        }
+    }
+}
+
+static int block_may_match(const Signature *signature, const GramQuery *query)
+{
+    for (int i = 0; i < query->count; i++)
+    {
+        if ((signature->bits[query->word[i]] & query->mask[i]) != query->mask[i])
+            return 0;
+    }
+    return 1;
+}
+
+// memmem is slow to set up for the one- and two-character needles of a
+// search still being typed; memchr to the first character is faster
+static const char *find_text(const char *haystack, size_t length, const char *text, size_t text_length)
+{
+    if (text_length == 0 || text_length > 2)
+        return memmem(haystack, length, text, text_length);
+
+    const char *end = haystack + length;
+    const char *pos = haystack;
+    while ((pos = memchr(pos, text[0], end - pos)))
+    {
+        if (text_length == 1 || (pos + 1 < end && pos[1] == text[1]))
+            return pos;
+        pos++;
+    }
+    return NULL;
+}
+
+static long search_before(const char *text, int prefix, long before)
+{
+    size_t text_length = strlen(text);
+    GramQuery query;
+    build_query(&query, text, text_length, prefix);
+
+    for (long i = before - 1; i >= 0;)
+    {
+        long block = i / HISTORY_BLOCK;
+        if (!block_may_match(&signatures[block], &query))
+        {
+            i = block * HISTORY_BLOCK - 1;
+            continue;
+        }
+
+        // The block's entries are contiguous in the file, so one memmem
+        // rules out a block the signature could not
+        size_t length;
+        const char *entry = entry_text(i, &length);
+        const char *first = history_map + offsets[block * HISTORY_BLOCK];
+        if (!prefix && !find_text(first, entry + length - first, text, text_length))
+        {
+            i = block * HISTORY_BLOCK - 1;
+            continue;
+        }
+
+        for (; i >= block * HISTORY_BLOCK; i--)
+        {
+            entry = entry_text(i, &length);
+            if (prefix ? length >= text_length && memcmp(entry, text, text_length) == 0
+                       : find_text(entry, length, text, text_length) != NULL)
+                return i;
+        }
+    }
+    return -1;
+}
+
+// Index of the newest entry before `before` (-1: the end) containing
+// `text`, or with `prefix` starting with it; -1 if there is none
+long history_search(const char *text, int prefix, long before)
+{
+    if (refresh_history() != 0)
+        return -1;
+    if (before < 0 || before > (long)entry_count)
+        before = entry_count;
+    return search_before(text, prefix, before);
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+    const char *pos = data;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, pos, size);
+        if (written <= 0)
+        {
+            if (written == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        pos += written;
+        size -= written;
+    }
+    return 0;
+}
+
+// Best effort, like the script cache: write a private temporary and
+// rename it into place so no shell ever reads a half-written index
+static void save_index(void)
+{
+    char path[PATH_MAX];
+    char temp_path[PATH_MAX + 32];
+    if (entry_count <= saved_count || index_file_path(path, sizeof(path)) != 0)
+        return;
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", path, (int)getpid());
+
+    HistoryIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HISTORY_INDEX_MAGIC, sizeof(header.magic));
+    header.version = HISTORY_INDEX_VERSION;
+    header.entry_count = entry_count;
+    header.indexed_size = indexed_size;
+    header.tail_hash = tail_hash(indexed_size);
+    header.device = history_st.st_dev;
+    header.inode = history_st.st_ino;
+    size_t blocks = (entry_count + HISTORY_BLOCK - 1) / HISTORY_BLOCK;
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return;
+    if (write_all(fd, &header, sizeof(header)) != 0 ||
+        write_all(fd, offsets, entry_count * sizeof(uint32_t)) != 0 ||
+        write_all(fd, signatures, blocks * sizeof(Signature)) != 0)
+    {
+        close(fd);
+        unlink(temp_path);
+        return;
+    }
+    if (close(fd) != 0 || rename(temp_path, path) != 0)
+        unlink(temp_path);
+    saved_count = entry_count;
+}
+
+void history_close(void)
+{
+    if (history_fd != -1)
+        save_index();
+    if (map_size > 0)
+        munmap((void *)history_map, map_size);
+    if (history_fd != -1)
+        close(history_fd);
+
+    free(offsets);
+    free(signatures);
+    free(last_added);
+    offsets = NULL;
+    signatures = NULL;
+    last_added = NULL;
+    entry_capacity = 0;
+    history_map = NULL;
+    map_size = 0;
+    history_fd = -1;
+    index_loaded = 0;
+    reset_index();
+}
+
+static void print_entry(uint32_t index)
+{
+    size_t length;
+    const char *text = entry_text(index, &length);
+    printf("%5u  %.*s\n", index + 1, (int)length, text);
+}
+
+int shell_history(char **args)
+{
+    if (args[1] && (strcmp(args[1], "-s") == 0 || strcmp(args[1], "-p") == 0))
+    {
+        if (!args[2])
+        {
+            fprintf(stderr, "history: %s: option requires an argument\n", args[1]);
+            return 2;
+        }
+        if (refresh_history() != 0)
+            return 1;
+
+        // Newest first, as a reverse search steps through them
+        int prefix = args[1][1] == 'p';
+        int found = 0;
+        for (long i = search_before(args[2], prefix, entry_count); i >= 0; i = search_before(args[2], prefix, i))
+        {
+            print_entry(i);
+            found = 1;
+        }
+        return found ? 0 : 1;
+    }
+
+    long count = -1;
+    if (args[1])
+    {
+        char *end;
+        count = strtol(args[1], &end, 10);
+        if (*end != '\0' || count < 0)
+        {
+            fprintf(stderr, "history: %s: numeric argument required\n", args[1]);
+            return 2;
+        }
+    }
+    if (refresh_history() != 0)
+        return 1;
+
+    uint32_t first = count >= 0 && (uint32_t)count < entry_count ? entry_count - count : 0;
+    for (uint32_t i = first; i < entry_count; i++)
+        print_entry(i);
+    return 0;
+}
@@ -0,0 +1,646 @@
+#include "shell.h"
+#include <ctype.h>
+
+// Control flow: pipelines read from a CommandReader are assembled into
+// if/while/for nodes once, and the resulting tree is walked to run them.
+// Loop bodies are never re-lexed; per-run work ($ expansion) happens in
+// the arena above a mark that is released right after each command.
+
+int command_interrupted = 0; // Ctrl+C asked the running command list to stop
+int loop_depth = 0;
+
+static const char *keywords[] = {"if", "then", "elif", "else", "fi", "while", "do", "done", "for"};
+
+static int is_name_start(char c)
+{
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static const char *keyword_of(const Command *cmd)
+{
+    if (!cmd->args[0])
+        return NULL;
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+    {
+        if (strcmp(cmd->args[0], keywords[i]) == 0)
+            return keywords[i];
+    }
+    return NULL;
+}
+
+static int is_keyword(const char *keyword, const char *name)
+{
+    return keyword && strcmp(keyword, name) == 0;
+}
+
+static void syntax_error(const char *token)
+{
+    fprintf(stderr, "syntax error near unexpected token '%s'\n", token);
+}
+
+int list_opens_block(const Command *list)
+{
+    for (; list; list = list->list_next)
+    {
+        const char *keyword = keyword_of(list);
+        if (is_keyword(keyword, "if") || is_keyword(keyword, "while") || is_keyword(keyword, "for"))
+            return 1;
+    }
+    return 0;
+}
+
+// Copy every string a list of pipelines points at into the arena, for
+// lines that must outlive the input buffer they were parsed in
+int relocate_commands(Command *list, Arena *arena)
+{
+    for (; list; list = list->list_next)
+    {
+        for (Command *stage = list; stage; stage = stage->next)
+        {
+            for (int i = 0; stage->args[i]; i++)
+            {
+                if (!(stage->args[i] = arena_strdup(arena, stage->args[i])))
+                    return -1;
+            }
+            if (stage->input_file && !(stage->input_file = arena_strdup(arena, stage->input_file)))
+                return -1;
+            if (stage->output_file && !(stage->output_file = arena_strdup(arena, stage->output_file)))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// Next non-empty pipeline, reading another line when none are pending
+static int next_pipeline(CommandReader *reader, int nested, Command **out)
+{
+    for (;;)
+    {
+        if (!reader->pending)
+        {
+            int status = reader->next(reader, nested, &reader->pending);
+            if (status <= 0)
+            {
+                reader->pending = NULL;
+                return status;
+            }
+        }
+
+        Command *cmd = reader->pending;
+        reader->pending = cmd->list_next;
+        cmd->list_next = NULL;
+        if (cmd->args[0])
+        {
+            *out = cmd;
+            return 1;
+        }
+    }
+}
+
+// Drop a leading keyword; whatever followed it on the line is read next
+static void push_back_rest(CommandReader *reader, Command *cmd)
+{
+    int i = 0;
+    do
+    {
+        cmd->args[i] = cmd->args[i + 1];
+    } while (cmd->args[i++]);
+
+    if (cmd->args[0])
+    {
+        cmd->list_next = reader->pending;
+        reader->pending = cmd;
+    }
+}
+
+static int parse_node(CommandReader *reader, Command *cmd, Command **node);
+
+// Read commands until one starting with a keyword in `terminators`
+static int parse_block(CommandReader *reader, const char *const *terminators, Command **list,
+                       const char **found)
+{
+    Command *head = NULL;
+    Command *tail = NULL;
+
+    for (;;)
+    {
+        Command *cmd;
+        int status = next_pipeline(reader, 1, &cmd);
+        if (status <= 0)
+        {
+            if (status == 0)
+                fprintf(stderr, "syntax error: unexpected end of file\n");
+            return -1;
+        }
+
+        const char *keyword = keyword_of(cmd);
+        for (const char *const *t = terminators; *t && keyword; t++)
+        {
+            if (strcmp(keyword, *t) != 0)
+                continue;
+
+            // 'fi' and 'done' close the construct and must stand alone
+            if ((is_keyword(keyword, "fi") || is_keyword(keyword, "done")) && (cmd->args[1] || cmd->next))
+            {
+                syntax_error(cmd->args[1] ? cmd->args[1] : "|");
+                return -1;
+            }
+            push_back_rest(reader, cmd);
+            *list = head;
+            *found = keyword;
+            return 0;
+        }
+
+        Command *node;
+        if (parse_node(reader, cmd, &node) != 0)
+            return -1;
+        if (!head)
+            head = node;
+        else
+            tail->list_next = node;
+        tail = node;
+    }
+}
+
+static Command *new_node(CommandReader *reader, CommandType type)
+{
+    Command *node = new_command(reader->arena);
+    if (node)
+        node->type = type;
+    return node;
+}
+
+// The keyword has already been consumed; parses condition, branches and
+// any elif chain up to the closing 'fi'
+static int parse_if(CommandReader *reader, Command **node)
+{
+    static const char *const then_terms[] = {"then", NULL};
+    static const char *const body_terms[] = {"elif", "else", "fi", NULL};
+    static const char *const else_terms[] = {"fi", NULL};
+    const char *found;
+
+    Command *cmd = new_node(reader, COMMAND_IF);
+    if (!cmd)
+        return -1;
+    if (parse_block(reader, then_terms, &cmd->condition, &found) != 0)
+        return -1;
+    if (!cmd->condition)
+    {
+        syntax_error("then");
+        return -1;
+    }
+    if (parse_block(reader, body_terms, &cmd->body, &found) != 0)
+        return -1;
+
+    if (is_keyword(found, "elif"))
+    {
+        if (parse_if(reader, &cmd->else_body) != 0)
+            return -1;
+    }
+    else if (is_keyword(found, "else"))
+    {
+        if (parse_block(reader, else_terms, &cmd->else_body, &found) != 0)
+            return -1;
+    }
+
+    *node = cmd;
+    return 0;
+}
+
+static int parse_node(CommandReader *reader, Command *cmd, Command **node)
+{
+    static const char *const do_terms[] = {"do", NULL};
+    static const char *const done_terms[] = {"done", NULL};
+    const char *keyword = keyword_of(cmd);
+    const char *found;
+
+    if (!keyword)
+    {
+        *node = cmd;
+        return 0;
+    }
+
+    if (is_keyword(keyword, "if"))
+    {
+        push_back_rest(reader, cmd);
+        return parse_if(reader, node);
+    }
+
+    if (is_keyword(keyword, "while"))
+    {
+        push_back_rest(reader, cmd);
+        Command *loop = new_node(reader, COMMAND_WHILE);
+        if (!loop || parse_block(reader, do_terms, &loop->condition, &found) != 0)
+            return -1;
+        if (!loop->condition)
+        {
+            syntax_error("do");
+            return -1;
+        }
+        if (parse_block(reader, done_terms, &loop->body, &found) != 0)
+            return -1;
+        *node = loop;
+        return 0;
+    }
+
+    if (is_keyword(keyword, "for") && !cmd->next && !cmd->background)
+    {
+        // for NAME in WORDS...: keep NAME and the words in args
+        char *name = cmd->args[1];
+        if (!name || !cmd->args[2] || strcmp(cmd->args[2], "in") != 0)
+        {
+            syntax_error(name ? (cmd->args[2] ? cmd->args[2] : "newline") : "newline");
+            return -1;
+        }
+        const char *c = name + 1;
+        while (is_name_char(*c))
+            c++;
+        if (!is_name_start(*name) || *c)
+        {
+            fprintf(stderr, "for: '%s': not a valid identifier\n", name);
+            return -1;
+        }
+
+        Command *loop = cmd;
+        loop->type = COMMAND_FOR;
+        int i = 0;
+        loop->args[i++] = name;
+        for (int j = 3; cmd->args[j]; j++)
+            loop->args[i++] = cmd->args[j];
+        loop->args[i] = NULL;
+
+        Command *empty;
+        if (parse_block(reader, do_terms, &empty, &found) != 0)
+            return -1;
+        if (empty)
+        {
+            syntax_error(empty->args[0]);
+            return -1;
+        }
+        if (parse_block(reader, done_terms, &loop->body, &found) != 0)
+            return -1;
+        *node = loop;
+        return 0;
+    }
+
+    syntax_error(keyword);
+    return -1;
+}
+
+// Reads one input line's worth of commands, continuing onto further lines
+// while an if/while/for block is open
+int read_command_list(CommandReader *reader, Command **list)
+{
+    Command *head = NULL;
+    Command *tail = NULL;
+
+    do
+    {
+        Command *cmd;
+        Command *node;
+        int status = next_pipeline(reader, 0, &cmd);
+        if (status == 0 && head)
+            break;
+        if (status <= 0)
+            return status;
+
+        if (parse_node(reader, cmd, &node) != 0)
+        {
+            reader->pending = NULL;
+            return -1;
+        }
+        if (!head)
+            head = node;
+        else
+            tail->list_next = node;
+        tail = node;
+    } while (reader->pending);
+
+    *list = head;
+    return 1;
+}
+
+// Replace each EXPAND_MARKER with the value of $name, ${name} or $?.
+// With out NULL nothing is written and only the length is returned.
+static size_t expand_word(const char *word, char *out)
+{
+    size_t length = 0;
+
+    while (*word)
+    {
+        if (*word != EXPAND_MARKER)
+        {
+            if (out)
+                out[length] = *word;
+            length++;
+            word++;
+            continue;
+        }
+        word++;
+
+        char name[256];
+        char status[16];
+        const char *value = "$"; // a '$' that starts no name stays literal
+        const char *end = word;
+        if (*word == '?')
+        {
+            snprintf(status, sizeof(status), "%d", last_exit_status);
+            value = status;
+            end = word + 1;
+        }
+        else if (*word == '{' && is_name_start(word[1]))
+        {
+            end = word + 2;
+            while (is_name_char(*end))
+                end++;
+            if (*end == '}' && (size_t)(end - word - 1) < sizeof(name))
+            {
+                memcpy(name, word + 1, end - word - 1);
+                name[end - word - 1] = '\0';
+                value = get_variable(name);
+                end++;
+            }
+            else
+                end = word;
+        }
+        else if (is_name_start(*word))
+        {
+            while (is_name_char(*end))
+                end++;
+            size_t n = (size_t)(end - word) < sizeof(name) ? (size_t)(end - word) : sizeof(name) - 1;
+            memcpy(name, word, n);
+            name[n] = '\0';
+            value = get_variable(name);
+        }
+        word = end;
+
+        // Unset variables expand to nothing
+        if (value)
+        {
+            size_t n = strlen(value);
+            if (out)
+                memcpy(out + length, value, n);
+            length += n;
+        }
+    }
+
+    if (out)
+        out[length] = '\0';
+    return length;
+}
+
+static char *expand_string(char *word, Arena *arena)
+{
+    if (!strchr(word, EXPAND_MARKER))
+        return word;
+
+    char *out = arena_alloc(arena, expand_word(word, NULL) + 1);
+    if (out)
+        expand_word(word, out);
+    return out;
+}
+
+// Expand every word of args into a NULL-terminated array in the arena.
+// Braces and globs can turn one word into many, so it grows as needed.
+// Returns the array, or NULL after reporting the error.
+static char **expand_args(char **args, Arena *arena)
+{
+    WordList list = {0};
+    int failed = 0;
+    for (int i = 0; args[i] && !failed; i++)
+    {
+        char *word = expand_string(args[i], arena);
+        if (!word)
+        {
+            errno = ENOMEM;
+            failed = 1;
+        }
+        else if (!strpbrk(word, GLOB_MARKERS))
+            failed = word_list_add(&list, word, arena) != 0;
+        else
+            failed = expand_glob(word, &list, arena) != 0;
+    }
+    if (failed)
+    {
+        fprintf(stderr, "expansion: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    // Every word can expand to nothing, but the array is still terminated
+    static char *no_words[] = {NULL};
+    return list.words ? list.words : no_words;
+}
+
+// A redirection target must expand to exactly one word
+static char *expand_target(char *word, Arena *arena)
+{
+    char *expanded = expand_string(word, arena);
+    WordList matches = {0};
+    if (expanded && !strpbrk(expanded, GLOB_MARKERS))
+        return expanded;
+    if (!expanded || expand_glob(expanded, &matches, arena) != 0)
+        fprintf(stderr, "expansion: %s\n", strerror(expanded ? errno : ENOMEM));
+    else if (matches.count != 1)
+        fprintf(stderr, "expansion: ambiguous redirect\n");
+    else
+        return matches.words[0];
+    return NULL;
+}
+
+// Returns the pipeline itself when nothing expands, else a copy in the
+// arena; NULL after reporting an error
+Command *expand_pipeline(Command *cmd, Arena *arena)
+{
+    Command *stage;
+    for (stage = cmd; stage && !stage->expand; stage = stage->next)
+        ;
+    if (!stage)
+        return cmd;
+
+    Command *head = NULL;
+    Command *tail = NULL;
+    for (stage = cmd; stage; stage = stage->next)
+    {
+        Command *copy = arena_alloc(arena, sizeof(Command));
+        if (!copy)
+        {
+            fprintf(stderr, "expansion: out of memory\n");
+            return NULL;
+        }
+        memcpy(copy, stage, sizeof(Command));
+        copy->next = NULL;
+
+        if (stage->expand)
+        {
+            if (!(copy->args = expand_args(stage->args, arena)))
+                return NULL;
+            if (stage->input_file && !(copy->input_file = expand_target(stage->input_file, arena)))
+                return NULL;
+            if (stage->output_file && !(copy->output_file = expand_target(stage->output_file, arena)))
+                return NULL;
+        }
+
+        if (!head)
+            head = copy;
+        else
+            tail->next = copy;
+        tail = copy;
+    }
+    return head;
+}
+
+// NAME=value on its own sets a shell variable
+static int run_assignment(const Command *cmd)
+{
+    const char *word = cmd->args[0];
+    const char *equals = strchr(word, '=');
+    if (cmd->pipe_count > 0 || cmd->args[1] || cmd->input_file || cmd->output_file || !equals ||
+        !is_name_start(*word))
+        return 0;
+
+    char name[256];
+    size_t n = equals - word;
+    for (size_t i = 1; i < n; i++)
+    {
+        if (!is_name_char(word[i]))
+            return 0;
+    }
+    if (n >= sizeof(name))
+        return 0;
+    memcpy(name, word, n);
+    name[n] = '\0';
+
+    last_exit_status = set_variable(name, equals + 1) == 0 ? 0 : 1;
+    return 1;
+}
+
+static void execute_pipeline_node(Command *cmd, Arena *arena)
+{
+    ArenaMark mark = arena_mark(arena);
+    Command *expanded = expand_pipeline(cmd, arena);
+
+    if (!expanded)
+    {
+        last_exit_status = 1;
+    }
+    else if (expanded->args[0] && strcmp(expanded->args[0], "time") == 0)
+    {
+        // `time` covers the whole pipeline, so it is peeled off here rather
+        // than run as a builtin in the first stage
+        Command *timed = arena_alloc(arena, sizeof(Command));
+        if (timed)
+        {
+            memcpy(timed, expanded, sizeof(Command));
+            timed->args++;
+            time_command(timed);
+        }
+    }
+    else if (!run_assignment(expanded))
+    {
+        execute_command(expanded);
+    }
+
+    // Everything the command needed is gone before the next one runs
+    arena_release(arena, mark);
+}
+
+static void execute_if(Command *cmd, Arena *arena)
+{
+    execute_list(cmd->condition, arena);
+    if (!shell_running || command_interrupted)
+        return;
+
+    if (last_exit_status == 0)
+        execute_list(cmd->body, arena);
+    else if (cmd->else_body)
+        execute_list(cmd->else_body, arena);
+    else
+        last_exit_status = 0;
+}
+
+static void execute_while(Command *cmd, Arena *arena)
+{
+    int status = 0;
+
+    loop_depth++;
+    for (;;)
+    {
+        execute_list(cmd->condition, arena);
+        if (last_exit_status != 0 || !shell_running || command_interrupted)
+            break;
+
+        last_exit_status = 0;
+        execute_list(cmd->body, arena);
+        status = last_exit_status;
+
+        // A body of builtins never waits on the event loop, so check for
+        // Ctrl+C and finished children here
+        dispatch_signals();
+        if (!shell_running || command_interrupted)
+            break;
+    }
+    loop_depth--;
+    last_exit_status = status;
+}
+
+static void execute_for(Command *cmd, Arena *arena)
+{
+    ArenaMark mark = arena_mark(arena);
+    int status = 0;
+
+    // The words are expanded once, before the first pass
+    char **words = cmd->args + 1;
+    if (cmd->expand && !(words = expand_args(cmd->args + 1, arena)))
+    {
+        arena_release(arena, mark);
+        last_exit_status = 1;
+        return;
+    }
+
+    loop_depth++;
+    for (int i = 0; words[i] && shell_running && !command_interrupted; i++)
+    {
+        if (set_variable(cmd->args[0], words[i]) != 0)
+        {
+            status = 1;
+            break;
+        }
+
+        last_exit_status = 0;
+        execute_list(cmd->body, arena);
+        status = last_exit_status;
+        dispatch_signals();
+    }
+    loop_depth--;
+    arena_release(arena, mark);
+    last_exit_status = status;
+}
+
+// Runs a list of commands; the exit status is that of the last one run
+int execute_list(Command *list, Arena *arena)
+{
+    for (; list && shell_running && !command_interrupted; list = list->list_next)
+    {
+        switch (list->type)
+        {
+        case COMMAND_PIPELINE:
+            execute_pipeline_node(list, arena);
+            break;
+        case COMMAND_IF:
+            execute_if(list, arena);
+            break;
+        case COMMAND_WHILE:
+            execute_while(list, arena);
+            break;
+        case COMMAND_FOR:
+            execute_for(list, arena);
+            break;
+        }
+    }
+    return last_exit_status;
+}
@@ -0,0 +1,547 @@
+#define _GNU_SOURCE // memmem
+#include "shell.h"
+#include <sys/ioctl.h>
+#include <termios.h>
+
+// Line editor for an interactive terminal. The terminal is put in raw
+// mode while a line is edited and restored before the line is returned,
+// so commands always run with the settings the user had. Ctrl+C and
+// Ctrl+Z arrive as keys here rather than as signals.
+//
+//   Left/Right, Ctrl+B/F   move          Home/End, Ctrl+A/E  line start/end
+//   Backspace, Delete      delete        Ctrl+D              delete, or EOF
+//   Ctrl+U/K               kill to start/end of line
+//   Ctrl+W                 kill the word before the cursor
+//   Up/Down, Ctrl+P/N      history       Ctrl+R              reverse search
+//   Tab                    complete      Ctrl+L              clear screen
+//   Ctrl+C                 abandon the line
+
+#define CTRL_KEY(key) ((key) & 0x1f)
+#define KEY_ESCAPE 27
+#define KEY_BACKSPACE 127
+
+// Keys decoded from escape sequences, outside the byte range
+enum
+{
+    KEY_UP = 256,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_NONE
+};
+
+typedef struct
+{
+    const char *prompt;
+    size_t prompt_width;
+    char *text; // the line, NUL-terminated
+    size_t length;
+    size_t cursor;
+    long history_index; // entry shown, or the history count when editing a new line
+    char *saved;        // the new line, while history is being browsed
+} LineState;
+
+// Grown as needed and kept between lines, like the input buffer
+static char *line_buffer = NULL;
+static size_t line_capacity = 0;
+
+static unsigned char key_buffer[256];
+static size_t key_start = 0;
+static size_t key_end = 0;
+
+static int reserve_line(LineState *state, size_t length)
+{
+    if (length + 1 <= line_capacity)
+        return 0;
+    size_t capacity = line_capacity ? line_capacity : 256;
+    while (capacity < length + 1)
+        capacity *= 2;
+    char *grown = realloc(line_buffer, capacity);
+    if (!grown)
+        return -1;
+    line_buffer = grown;
+    line_capacity = capacity;
+    state->text = grown;
+    return 0;
+}
+
+static void write_all(const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(STDOUT_FILENO, data, size);
+        if (written <= 0)
+        {
+            if (written == -1 && errno == EINTR)
+                continue;
+            return;
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+static size_t terminal_width(void)
+{
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+        return size.ws_col;
+    return 80;
+}
+
+// Next byte of input, or -1 at end of input. Signals that arrive while
+// waiting are handled; `redraw` is set when that may have printed.
+static int read_byte(int *redraw)
+{
+    while (key_start == key_end)
+    {
+        if (!wait_for_fd(STDIN_FILENO))
+        {
+            *redraw = 1;
+            continue;
+        }
+        ssize_t count = read(STDIN_FILENO, key_buffer, sizeof(key_buffer));
+        if (count == 0 || (count < 0 && errno != EINTR && errno != EAGAIN))
+            return -1;
+        if (count > 0)
+        {
+            key_start = 0;
+            key_end = count;
+        }
+    }
+    return key_buffer[key_start++];
+}
+
+// Decodes the VT100/xterm sequences for the keys the editor handles
+static int read_key(int *redraw)
+{
+    int c = read_byte(redraw);
+    if (c != KEY_ESCAPE)
+        return c;
+
+    // A lone Escape is followed by nothing already buffered
+    if (key_start == key_end)
+        return KEY_ESCAPE;
+    int kind = read_byte(redraw);
+    if (kind != '[' && kind != 'O')
+        return KEY_NONE;
+
+    int code = read_byte(redraw);
+    if (code >= '0' && code <= '9')
+    {
+        // ESC [ n ~, possibly with ;modifiers in between
+        int number = code - '0';
+        while ((code = read_byte(redraw)) >= '0' && code <= '9')
+            number = number * 10 + code - '0';
+        while (code == ';' || (code >= '0' && code <= '9'))
+            code = read_byte(redraw);
+        if (code != '~')
+            return KEY_NONE;
+        switch (number)
+        {
+        case 1:
+        case 7:
+            return KEY_HOME;
+        case 3:
+            return KEY_DELETE;
+        case 4:
+        case 8:
+            return KEY_END;
+        }
+        return KEY_NONE;
+    }
+    switch (code)
+    {
+    case 'A':
+        return KEY_UP;
+    case 'B':
+        return KEY_DOWN;
+    case 'C':
+        return KEY_RIGHT;
+    case 'D':
+        return KEY_LEFT;
+    case 'H':
+        return KEY_HOME;
+    case 'F':
+        return KEY_END;
+    }
+    return KEY_NONE;
+}
+
+// Redraw the prompt and line in one write, scrolled horizontally so the
+// cursor stays on screen
+static void refresh_line(LineState *state)
+{
+    size_t width = terminal_width();
+    size_t room = width > state->prompt_width + 1 ? width - state->prompt_width - 1 : 1;
+    size_t first = state->cursor > room ? state->cursor - room : 0;
+    size_t shown = state->length - first < room ? state->length - first : room;
+
+    char *out = malloc(state->prompt_width + shown + 32);
+    if (!out)
+        return;
+    size_t used = 0;
+    out[used++] = '\r';
+    memcpy(out + used, state->prompt, state->prompt_width);
+    used += state->prompt_width;
+    memcpy(out + used, state->text + first, shown);
+    used += shown;
+    used += sprintf(out + used, "\x1b[K\r");
+    size_t column = state->prompt_width + state->cursor - first;
+    if (column > 0)
+        used += sprintf(out + used, "\x1b[%zuC", column);
+    write_all(out, used);
+    free(out);
+}
+
+static int insert_text(LineState *state, const char *text, size_t length)
+{
+    if (reserve_line(state, state->length + length) != 0)
+        return -1;
+    memmove(state->text + state->cursor + length, state->text + state->cursor, state->length - state->cursor + 1);
+    memcpy(state->text + state->cursor, text, length);
+    state->length += length;
+    state->cursor += length;
+    return 0;
+}
+
+static void delete_text(LineState *state, size_t from, size_t to)
+{
+    memmove(state->text + from, state->text + to, state->length - to + 1);
+    state->length -= to - from;
+    state->cursor = from;
+}
+
+static void set_text(LineState *state, const char *text, size_t length)
+{
+    if (reserve_line(state, length) != 0)
+        return;
+    memcpy(state->text, text, length);
+    state->text[length] = '\0';
+    state->length = state->cursor = length;
+}
+
+// Step through history; the line being typed is kept to come back to
+static void browse_history(LineState *state, int step)
+{
+    long count = history_count();
+    long index = state->history_index + step;
+    if (index < 0 || index > count)
+        return;
+
+    if (state->history_index == count)
+    {
+        free(state->saved);
+        state->saved = strdup(state->text);
+    }
+    state->history_index = index;
+    if (index == count)
+    {
+        set_text(state, state->saved ? state->saved : "", state->saved ? strlen(state->saved) : 0);
+        return;
+    }
+    size_t length;
+    const char *entry = history_entry(index, &length);
+    if (entry)
+        set_text(state, entry, length);
+}
+
+// Ctrl+R: search back through history as the query is typed. Ctrl+R
+// again finds the next older match; Enter runs the match, Ctrl+G or
+// Ctrl+C gives up, and any other key keeps the match for editing.
+static int reverse_search(LineState *state, int *redraw)
+{
+    char query[256];
+    size_t query_length = 0;
+    long match = -1;
+    char *original = strdup(state->text);
+    int failed = 0;
+
+    for (;;)
+    {
+        char line[1024];
+        int used = snprintf(line, sizeof(line), "\r(%sreverse-i-search)`%.*s': %s\x1b[K", failed ? "failed " : "",
+                            (int)query_length, query, match >= 0 ? state->text : "");
+        write_all(line, used < (int)sizeof(line) ? (size_t)used : sizeof(line) - 1);
+
+        int key = read_key(redraw);
+        long before = -1;
+        if (key == CTRL_KEY('r'))
+        {
+            before = match;
+        }
+        else if (key == KEY_BACKSPACE || key == CTRL_KEY('h'))
+        {
+            if (query_length > 0)
+                query_length--;
+        }
+        else if (key >= 32 && key < KEY_BACKSPACE && query_length < sizeof(query) - 1)
+        {
+            query[query_length++] = (char)key;
+        }
+        else
+        {
+            if (key == CTRL_KEY('g') || key == CTRL_KEY('c') || key < 0)
+                set_text(state, original ? original : "", original ? strlen(original) : 0);
+            free(original);
+            return key == '\r' || key == '\n' ? '\r' : key < 0 ? key : KEY_NONE;
+        }
+
+        query[query_length] = '\0';
+        long found = query_length ? history_search(query, 0, before) : -1;
+        failed = query_length && found < 0;
+        if (found >= 0)
+        {
+            size_t length;
+            const char *entry = history_entry(found, &length);
+            set_text(state, entry, length);
+            match = found;
+            state->history_index = match;
+            const char *at = memmem(state->text, state->length, query, query_length);
+            state->cursor = at ? (size_t)(at - state->text) : 0;
+        }
+        else if (!query_length)
+        {
+            match = -1;
+        }
+    }
+}
+
+// Escape what the parser would otherwise treat specially
+static size_t escape_text(const char *text, size_t length, char *out)
+{
+    size_t used = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (strchr(" \t\\'\"|&;<>$#", text[i]))
+            out[used++] = '\\';
+        out[used++] = text[i];
+    }
+    return used;
+}
+
+static void list_candidates(LineState *state, const Completions *result)
+{
+    size_t widest = 0;
+    for (size_t i = 0; i < result->shown_count; i++)
+    {
+        size_t length = strlen(result->shown[i]);
+        if (length > widest)
+            widest = length;
+    }
+    size_t column_width = widest + 2;
+    size_t columns = terminal_width() / column_width;
+    if (columns == 0)
+        columns = 1;
+    size_t rows = (result->shown_count + columns - 1) / columns;
+
+    printf("\n");
+    for (size_t row = 0; row < rows; row++)
+    {
+        for (size_t column = 0; column < columns; column++)
+        {
+            size_t i = column * rows + row;
+            if (i < result->shown_count)
+                printf("%-*s", (int)column_width, result->shown[i]);
+        }
+        printf("\n");
+    }
+    if (result->total > result->shown_count)
+        printf("(%zu more)\n", result->total - result->shown_count);
+    fflush(stdout);
+    refresh_line(state);
+}
+
+// Tab: extend the word as far as every candidate agrees, finish it if
+// there is only one, or list the candidates when it cannot be extended
+static void complete(LineState *state)
+{
+    Completions result;
+    size_t total = complete_line(state->text, state->cursor, &result);
+    if (total == 0)
+    {
+        write_all("\a", 1);
+        return;
+    }
+
+    // The typed text, unescaped, is a prefix of `common`
+    size_t typed = 0;
+    for (size_t i = result.replace_start; i < state->cursor; i++, typed++)
+    {
+        if (state->text[i] == '\\' && i + 1 < state->cursor)
+            i++;
+    }
+
+    char *escaped = malloc(2 * result.common_length + 2);
+    if (escaped)
+    {
+        size_t length = escape_text(result.common, result.common_length, escaped);
+        if (total == 1)
+            escaped[length++] = result.suffix;
+        if (total == 1 || result.common_length > typed)
+        {
+            delete_text(state, result.replace_start, state->cursor);
+            insert_text(state, escaped, length);
+            refresh_line(state);
+        }
+        else
+        {
+            list_candidates(state, &result);
+        }
+        free(escaped);
+    }
+    completions_free(&result);
+}
+
+static int enable_raw_mode(struct termios *saved)
+{
+    if (tcgetattr(STDIN_FILENO, saved) != 0)
+        return -1;
+
+    struct termios raw = *saved;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cflag |= CS8;
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+}
+
+// Reads one line with editing. The line stays valid until the next call;
+// NULL means end of input. Falls back to plain reads when the terminal
+// cannot be put in raw mode or cannot handle the escape sequences.
+char *edit_line(const char *prompt)
+{
+    struct termios saved;
+    const char *term = getenv("TERM");
+    if (!term || strcmp(term, "dumb") == 0 || enable_raw_mode(&saved) != 0)
+    {
+        printf("%s", prompt);
+        fflush(stdout);
+        return read_line();
+    }
+
+    LineState state = {prompt, strlen(prompt), NULL, 0, 0, 0, NULL};
+    if (reserve_line(&state, 0) != 0)
+    {
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+        return read_line();
+    }
+    state.text = line_buffer;
+    state.text[0] = '\0';
+    state.history_index = history_count();
+
+    // Built while the shell would otherwise sit waiting for the first key
+    completion_prepare();
+    refresh_line(&state);
+
+    char *line = line_buffer;
+    for (;;)
+    {
+        int redraw = 0;
+        int key = read_key(&redraw);
+        if (redraw)
+            refresh_line(&state);
+        if (key == CTRL_KEY('r'))
+        {
+            key = reverse_search(&state, &redraw);
+            refresh_line(&state);
+        }
+
+        if (key < 0 || (key == CTRL_KEY('d') && state.length == 0))
+        {
+            line = NULL;
+            break;
+        }
+        if (key == '\r' || key == '\n')
+            break;
+
+        switch (key)
+        {
+        case CTRL_KEY('c'):
+            write_all("^C\r\n", 4);
+            delete_text(&state, 0, state.length);
+            state.history_index = history_count();
+            break;
+        case CTRL_KEY('a'):
+        case KEY_HOME:
+            state.cursor = 0;
+            break;
+        case CTRL_KEY('e'):
+        case KEY_END:
+            state.cursor = state.length;
+            break;
+        case CTRL_KEY('b'):
+        case KEY_LEFT:
+            if (state.cursor > 0)
+                state.cursor--;
+            break;
+        case CTRL_KEY('f'):
+        case KEY_RIGHT:
+            if (state.cursor < state.length)
+                state.cursor++;
+            break;
+        case KEY_BACKSPACE:
+        case CTRL_KEY('h'):
+            if (state.cursor > 0)
+                delete_text(&state, state.cursor - 1, state.cursor);
+            break;
+        case CTRL_KEY('d'):
+        case KEY_DELETE:
+            if (state.cursor < state.length)
+                delete_text(&state, state.cursor, state.cursor + 1);
+            break;
+        case CTRL_KEY('u'):
+            delete_text(&state, 0, state.cursor);
+            break;
+        case CTRL_KEY('k'):
+            state.text[state.cursor] = '\0';
+            state.length = state.cursor;
+            break;
+        case CTRL_KEY('w'):
+        {
+            size_t start = state.cursor;
+            while (start > 0 && state.text[start - 1] == ' ')
+                start--;
+            while (start > 0 && state.text[start - 1] != ' ')
+                start--;
+            delete_text(&state, start, state.cursor);
+            break;
+        }
+        case CTRL_KEY('p'):
+        case KEY_UP:
+            browse_history(&state, -1);
+            break;
+        case CTRL_KEY('n'):
+        case KEY_DOWN:
+            browse_history(&state, 1);
+            break;
+        case CTRL_KEY('l'):
+            write_all("\x1b[H\x1b[2J", 7);
+            break;
+        case '\t':
+            complete(&state);
+            continue;
+        default:
+            // Bytes of a UTF-8 character go in as typed
+            if ((key >= 32 && key < KEY_BACKSPACE) || (key >= 128 && key < 256))
+            {
+                char c = (char)key;
+                insert_text(&state, &c, 1);
+            }
+            break;
+        }
+        refresh_line(&state);
+    }
+
+    // Leave the cursor below the line, where the command's output goes
+    state.cursor = state.length;
+    refresh_line(&state);
+    write_all("\r\n", 2);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    free(state.saved);
+    return line;
+}
@@ -1,261 +1,1679 @@
-#include "memory_manager.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-// Global memory pool
-static MemoryPool memory_pool = {0};
-static MemoryStats memory_stats = {0};
-
-void init_memory_manager(size_t pool_size)
-{
-    // Allocate memory pool
-    memory_pool.start = malloc(pool_size);
-    if (!memory_pool.start)
-    {
-        fprintf(stderr, "Failed to initialize memory pool\n");
-        exit(1);
-    }
-
-    // Initialize pool properties
-    memory_pool.total_size = pool_size;
-    memory_pool.used_size = 0;
-
-    // Create initial free block
-    memory_pool.blocks = malloc(sizeof(MemoryBlock));
-    memory_pool.blocks->address = memory_pool.start;
-    memory_pool.blocks->size = pool_size;
-    memory_pool.blocks->is_free = true;
-    memory_pool.blocks->next = NULL;
-
-    // Initialize statistics
-    memset(&memory_stats, 0, sizeof(MemoryStats));
-}
-
-static MemoryBlock *find_free_block(size_t size)
-{
-    MemoryBlock *current = memory_pool.blocks;
-    while (current)
-    {
-        if (current->is_free && current->size >= size)
-        {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
-}
-
-static void split_block(MemoryBlock *block, size_t size)
-{
-    if (block->size > size + sizeof(MemoryBlock) + 32)
-    { // Min block size = 32 bytes
-        size_t remaining_size = block->size - size;
-        void *split_addr = (char *)block->address + size;
-
-        MemoryBlock *new_block = malloc(sizeof(MemoryBlock));
-        new_block->address = split_addr;
-        new_block->size = remaining_size;
-        new_block->is_free = true;
-        new_block->next = block->next;
-
-        block->size = size;
-        block->next = new_block;
-    }
-}
-
-void *shell_malloc(size_t size)
-{
-    if (size == 0)
-        return NULL;
-
-    // Align size to 8 bytes
-    size = (size + 7) & ~7;
-
-    MemoryBlock *block = find_free_block(size);
-    if (!block)
-    {
-        fprintf(stderr, "Memory allocation failed: No free blocks available\n");
-        return NULL;
-    }
-
-    // Split block if it's too large
-    split_block(block, size);
-
-    // Update block status
-    block->is_free = false;
-
-    // Update statistics
-    memory_stats.total_allocated += size;
-    memory_stats.current_usage += size;
-    memory_stats.allocation_count++;
-    if (memory_stats.current_usage > memory_stats.peak_usage)
-    {
-        memory_stats.peak_usage = memory_stats.current_usage;
-    }
-
-    return block->address;
-}
-
-static MemoryBlock *find_block(void *ptr)
-{
-    MemoryBlock *current = memory_pool.blocks;
-    while (current)
-    {
-        if (current->address == ptr)
-        {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
-}
-
-static void merge_free_blocks(void)
-{
-    MemoryBlock *current = memory_pool.blocks;
-    while (current && current->next)
-    {
-        if (current->is_free && current->next->is_free)
-        {
-            // Merge blocks
-            current->size += current->next->size;
-            MemoryBlock *to_delete = current->next;
-            current->next = current->next->next;
-            free(to_delete);
-        }
-        else
-        {
-            current = current->next;
-        }
-    }
-}
-
-void shell_free(void *ptr)
-{
-    if (!ptr)
-        return;
-
-    MemoryBlock *block = find_block(ptr);
-    if (!block)
-    {
-        fprintf(stderr, "Invalid pointer passed to shell_free\n");
-        return;
-    }
-
-    // Update statistics
-    memory_stats.total_freed += block->size;
-    memory_stats.current_usage -= block->size;
-    memory_stats.free_count++;
-
-    // Mark block as free
-    block->is_free = true;
-
-    // Merge adjacent free blocks
-    merge_free_blocks();
-}
-
-void *shell_realloc(void *ptr, size_t new_size)
-{
-    if (!ptr)
-        return shell_malloc(new_size);
-    if (new_size == 0)
-    {
-        shell_free(ptr);
-        return NULL;
-    }
-
-    MemoryBlock *block = find_block(ptr);
-    if (!block)
-    {
-        fprintf(stderr, "Invalid pointer passed to shell_realloc\n");
-        return NULL;
-    }
-
-    // Align new size to 8 bytes
-    new_size = (new_size + 7) & ~7;
-
-    // If current block is big enough, split it
-    if (block->size >= new_size)
-    {
-        split_block(block, new_size);
-        return ptr;
-    }
-
-    // Allocate new block
-    void *new_ptr = shell_malloc(new_size);
-    if (!new_ptr)
-        return NULL;
-
-    // Copy data and free old block
-    memcpy(new_ptr, ptr, block->size);
-    shell_free(ptr);
-
-    return new_ptr;
-}
-
-void print_memory_stats(void)
-{
-    printf("\nMemory Manager Statistics:\n");
-    printf("-------------------------\n");
-    printf("Total Allocated: %zu bytes\n", memory_stats.total_allocated);
-    printf("Total Freed: %zu bytes\n", memory_stats.total_freed);
-    printf("Current Usage: %zu bytes\n", memory_stats.current_usage);
-    printf("Peak Usage: %zu bytes\n", memory_stats.peak_usage);
-    printf("Allocation Count: %zu\n", memory_stats.allocation_count);
-    printf("Free Count: %zu\n", memory_stats.free_count);
-    printf("-------------------------\n");
-}
-
-void print_memory_blocks(void)
-{
-    printf("\nMemory Blocks:\n");
-    printf("-------------\n");
-    MemoryBlock *current = memory_pool.blocks;
-    int block_count = 0;
-    while (current)
-    {
-        printf("Block %d: Address=%p, Size=%zu, Status=%s\n",
-               ++block_count, current->address, current->size,
-               current->is_free ? "Free" : "Used");
-        current = current->next;
-    }
-    printf("-------------\n");
-}
-
-MemoryStats get_memory_stats(void)
-{
-    return memory_stats;
-}
-
-bool check_memory_leaks(void)
-{
-    size_t leaked_bytes = memory_stats.total_allocated - memory_stats.total_freed;
-    if (leaked_bytes > 0)
-    {
-        printf("\nMemory Leak Detected!\n");
-        printf("Leaked bytes: %zu\n", leaked_bytes);
-        return true;
-    }
-    printf("\nNo memory leaks detected.\n");
-    return false;
-}
-
-void cleanup_memory_manager(void)
-{
-    // Free all memory blocks
-    MemoryBlock *current = memory_pool.blocks;
-    while (current)
-    {
-        MemoryBlock *next = current->next;
-        free(current);
-        current = next;
-    }
-
-    // Free the memory pool
-    free(memory_pool.start);
-
-    // Reset statistics
-    memset(&memory_stats, 0, sizeof(MemoryStats));
-    memset(&memory_pool, 0, sizeof(MemoryPool));
-}
\ No newline at end of file
+#define _GNU_SOURCE // mremap
+#include "memory_manager.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// Global memory pool. The pool, its chunk and large-mapping lists and
+// the central statistics are guarded by pool_lock; each thread's cache
+// and counters belong to that thread.
+static MemoryPool memory_pool = {0};
+static MemoryStats memory_stats = {0};
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Thread caches and the counters of threads that have exited
+static __thread ThreadCache thread_cache;
+static ThreadCache *thread_caches = NULL;
+static ThreadStats retired_stats;
+static SiteCounts retired_sites[MAX_ALLOC_SITES];
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+// Per-thread counters are written only by their owner but read by any
+// thread merging statistics, so both sides use relaxed atomics
+#define STAT_SET(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define STAT_ADD(field, n) STAT_SET(field, (field) + (n))
+#define STAT_SUB(field, n) STAT_SET(field, (field) - (n))
+#define STAT_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+// A block sitting in a thread cache stays marked in use, so the pool
+// never coalesces it; its first payload word holds this mark instead,
+// which is how a second free of it is caught
+static MemoryBlock cached_mark;
+#define CACHED_MARK (&cached_mark)
+
+// Call sites, filled in under the pool lock and looked up without it.
+// A slot's line is written before its file is published.
+static AllocSite alloc_sites[MAX_ALLOC_SITES];
+#define LEAK_REPORT_SITES 10
+
+#define BLOCK_IN_USE ((size_t)1)
+#define BLOCK_MAPPED ((size_t)2) // a large block in a mapping of its own
+#define BLOCK_ARENA ((size_t)4)  // an allocated block holding an arena's chunk
+#define BLOCK_FLAGS ((size_t)7)
+#define BLOCK_SITE_SHIFT 48 // an allocated block's site index sits above its size
+#define BLOCK_SIZE_MASK ((((size_t)1 << BLOCK_SITE_SHIFT) - 1) & ~BLOCK_FLAGS)
+#define BLOCK_OVERHEAD (2 * sizeof(size_t)) // header + footer
+#define MIN_BLOCK_SIZE (BLOCK_OVERHEAD + 2 * sizeof(MemoryBlock *))
+
+static size_t block_size(const MemoryBlock *block)
+{
+    return block->size & BLOCK_SIZE_MASK;
+}
+
+static unsigned int block_site(const MemoryBlock *block)
+{
+    return (unsigned int)(block->size >> BLOCK_SITE_SHIFT);
+}
+
+static bool block_is_free(const MemoryBlock *block)
+{
+    return !(block->size & BLOCK_IN_USE);
+}
+
+static size_t *block_footer(MemoryBlock *block)
+{
+    return (size_t *)((char *)block + block_size(block) - sizeof(size_t));
+}
+
+// Write both boundary tags of a block
+static void set_block(MemoryBlock *block, size_t size, bool in_use)
+{
+    block->size = size | (in_use ? BLOCK_IN_USE : 0);
+    *block_footer(block) = block->size;
+}
+
+static MemoryBlock *next_block(MemoryBlock *block)
+{
+    return (MemoryBlock *)((char *)block + block_size(block));
+}
+
+// Footer of the physically preceding block (the prologue for the first one)
+static size_t prev_footer(MemoryBlock *block)
+{
+    return *((size_t *)block - 1);
+}
+
+static void *block_payload(MemoryBlock *block)
+{
+    return (char *)block + sizeof(size_t);
+}
+
+static size_t payload_size(const MemoryBlock *block)
+{
+    return block_size(block) - BLOCK_OVERHEAD;
+}
+
+// Map an aligned size to its free-list index
+static int size_class(size_t size)
+{
+    if (size <= SMALL_CLASS_MAX)
+    {
+        return (int)(size / SIZE_CLASS_STEP) - 1;
+    }
+
+    // Bin k holds sizes in [2^(k+9), 2^(k+10))
+    int bin = (63 - __builtin_clzll((unsigned long long)size)) - 9;
+    if (bin >= LARGE_CLASS_COUNT)
+    {
+        bin = LARGE_CLASS_COUNT - 1;
+    }
+    return SMALL_CLASS_COUNT + bin;
+}
+
+// First class >= cls with a non-empty free list, or -1. Each bitmap word
+// looked at counts as a search step.
+static int next_nonempty_class(int cls, size_t *steps)
+{
+    if (cls >= NUM_SIZE_CLASSES)
+    {
+        return -1;
+    }
+
+    int word = cls / 64;
+    uint64_t bits = memory_pool.free_map[word] & (~0ULL << (cls % 64));
+    (*steps)++;
+    while (!bits)
+    {
+        if (++word >= FREE_MAP_WORDS)
+        {
+            return -1;
+        }
+        bits = memory_pool.free_map[word];
+        (*steps)++;
+    }
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+static void free_list_insert(MemoryBlock *block)
+{
+    int cls = size_class(block_size(block));
+    block->prev_free = NULL;
+    block->next_free = memory_pool.free_lists[cls];
+    if (block->next_free)
+    {
+        block->next_free->prev_free = block;
+    }
+    memory_pool.free_lists[cls] = block;
+    memory_pool.free_map[cls / 64] |= 1ULL << (cls % 64);
+}
+
+static void free_list_remove(MemoryBlock *block)
+{
+    int cls = size_class(block_size(block));
+    if (block->prev_free)
+    {
+        block->prev_free->next_free = block->next_free;
+    }
+    else
+    {
+        memory_pool.free_lists[cls] = block->next_free;
+    }
+    if (block->next_free)
+    {
+        block->next_free->prev_free = block->prev_free;
+    }
+    if (!memory_pool.free_lists[cls])
+    {
+        memory_pool.free_map[cls / 64] &= ~(1ULL << (cls % 64));
+    }
+    block->prev_free = NULL;
+    block->next_free = NULL;
+}
+
+
+static size_t round_to_pages(size_t size)
+{
+    return (size + memory_pool.page_size - 1) & ~(memory_pool.page_size - 1);
+}
+
+static void *map_pages(size_t length)
+{
+    void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// Map `length` bytes starting at a multiple of `align`, a power of two
+// no smaller than a page, by trimming a larger mapping at both ends
+static void *map_aligned(size_t length, size_t align)
+{
+    size_t span = length + align - memory_pool.page_size;
+    char *raw = map_pages(span);
+    if (!raw)
+    {
+        return NULL;
+    }
+
+    char *start = (char *)(((uintptr_t)raw + align - 1) & ~(align - 1));
+    if (start > raw)
+    {
+        munmap(raw, start - raw);
+    }
+    if (raw + span > start + length)
+    {
+        munmap(start + length, raw + span - (start + length));
+    }
+    return start;
+}
+
+// Find the chunk holding ptr without taking the pool lock. Chunks start
+// on a chunk_align boundary and are no longer than it, so masking the
+// pointer finds the header.
+static PoolChunk *chunk_of(const void *ptr)
+{
+    return (PoolChunk *)((uintptr_t)ptr & ~(memory_pool.chunk_align - 1));
+}
+
+// Bases of the live chunks, so a masked pointer is only read once it is
+// known to be a chunk. Open addressing on the chunk's aligned index;
+// slots are written under the pool lock and read with acquire loads. A
+// released chunk leaves a tombstone, which a later chunk can take.
+#define MAX_POOL_CHUNKS 4096
+#define CHUNK_TABLE_SIZE (2 * MAX_POOL_CHUNKS)
+#define CHUNK_TOMBSTONE ((uintptr_t)1)
+
+static uintptr_t chunk_table[CHUNK_TABLE_SIZE];
+
+static size_t chunk_slot(uintptr_t base)
+{
+    return (size_t)(base / memory_pool.chunk_align) & (CHUNK_TABLE_SIZE - 1);
+}
+
+static bool chunk_is_live(const PoolChunk *chunk)
+{
+    size_t slot = chunk_slot((uintptr_t)chunk);
+    for (size_t probes = 0; probes < CHUNK_TABLE_SIZE; probes++)
+    {
+        uintptr_t base = __atomic_load_n(&chunk_table[slot], __ATOMIC_ACQUIRE);
+        if (base == (uintptr_t)chunk)
+        {
+            return true;
+        }
+        if (!base)
+        {
+            return false;
+        }
+        slot = (slot + 1) & (CHUNK_TABLE_SIZE - 1);
+    }
+    return false;
+}
+
+static bool register_chunk(PoolChunk *chunk)
+{
+    if (memory_pool.chunk_count >= MAX_POOL_CHUNKS)
+    {
+        return false;
+    }
+    size_t slot = chunk_slot((uintptr_t)chunk);
+    while (chunk_table[slot] > CHUNK_TOMBSTONE)
+    {
+        slot = (slot + 1) & (CHUNK_TABLE_SIZE - 1);
+    }
+    __atomic_store_n(&chunk_table[slot], (uintptr_t)chunk, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void unregister_chunk(PoolChunk *chunk)
+{
+    size_t slot = chunk_slot((uintptr_t)chunk);
+    while (chunk_table[slot] != (uintptr_t)chunk)
+    {
+        slot = (slot + 1) & (CHUNK_TABLE_SIZE - 1);
+    }
+    __atomic_store_n(&chunk_table[slot], CHUNK_TOMBSTONE, __ATOMIC_RELEASE);
+}
+
+// Size of the single free block a new chunk starts with
+static size_t chunk_capacity(void)
+{
+    return (round_to_pages(memory_pool.chunk_size) - sizeof(PoolChunk) - 2 * sizeof(size_t)) & ~BLOCK_FLAGS;
+}
+
+// Blocks past the threshold, or too big for any chunk, get a mapping of
+// their own
+static bool needs_own_mapping(size_t size)
+{
+    return size >= LARGE_MAPPING_THRESHOLD || size > chunk_capacity();
+}
+
+// Map a new chunk and put its single free block on the free lists
+static PoolChunk *add_chunk(size_t size)
+{
+    size = round_to_pages(size);
+    PoolChunk *chunk = map_aligned(size, memory_pool.chunk_align);
+    if (!chunk)
+    {
+        return NULL;
+    }
+    if (!register_chunk(chunk))
+    {
+        munmap(chunk, size);
+        return NULL;
+    }
+
+    // Chunk layout: header, prologue footer, one big free block, epilogue
+    // header. The sentinels are marked in use so coalescing never runs off
+    // the ends.
+    chunk->size = size;
+    size_t *prologue = (size_t *)(chunk + 1);
+    *prologue = BLOCK_IN_USE;
+    chunk->blocks = (MemoryBlock *)(prologue + 1);
+    set_block(chunk->blocks, (size - sizeof(PoolChunk) - 2 * sizeof(size_t)) & ~BLOCK_FLAGS, false);
+    next_block(chunk->blocks)->size = BLOCK_IN_USE;
+    free_list_insert(chunk->blocks);
+
+    // The first chunk stays at the head of the list
+    chunk->prev = memory_pool.chunks;
+    chunk->next = memory_pool.chunks ? memory_pool.chunks->next : NULL;
+    if (chunk->next)
+    {
+        chunk->next->prev = chunk;
+    }
+    if (memory_pool.chunks)
+    {
+        memory_pool.chunks->next = chunk;
+    }
+    else
+    {
+        memory_pool.chunks = chunk;
+    }
+
+    memory_pool.total_size += size;
+    memory_pool.chunk_count++;
+    return chunk;
+}
+
+static bool chunk_is_empty(PoolChunk *chunk)
+{
+    return block_is_free(chunk->blocks) && block_size(next_block(chunk->blocks)) == 0;
+}
+
+static void release_chunk(PoolChunk *chunk)
+{
+    free_list_remove(chunk->blocks);
+    chunk->prev->next = chunk->next;
+    if (chunk->next)
+    {
+        chunk->next->prev = chunk->prev;
+    }
+    if (memory_pool.spare == chunk)
+    {
+        memory_pool.spare = NULL;
+    }
+
+    unregister_chunk(chunk);
+    memory_pool.total_size -= chunk->size;
+    memory_pool.chunk_count--;
+    memory_stats.chunks_released++;
+    munmap(chunk, chunk->size);
+}
+
+// Give the whole pages inside a free block back to the OS. The free-list
+// links at the start and the footer at the end stay resident.
+static void trim_block(MemoryBlock *block)
+{
+    size_t page_mask = memory_pool.page_size - 1;
+    uintptr_t start = ((uintptr_t)(block + 1) + page_mask) & ~page_mask;
+    uintptr_t end = ((uintptr_t)block + block_size(block) - sizeof(size_t)) & ~page_mask;
+    if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0)
+    {
+        memory_stats.trims++;
+        memory_stats.trimmed_bytes += end - start;
+    }
+}
+
+// Trim every large free block. Runs once per TRIM_THRESHOLD bytes freed,
+// so a free-heavy loop does not pay a system call per free.
+static void trim_free_blocks(void)
+{
+    memory_pool.freed_since_trim = 0;
+    for (int cls = size_class(TRIM_MIN_BLOCK); cls < NUM_SIZE_CLASSES; cls++)
+    {
+        for (MemoryBlock *block = memory_pool.free_lists[cls]; block; block = block->next_free)
+        {
+            if (block_size(block) >= TRIM_MIN_BLOCK)
+            {
+                trim_block(block);
+            }
+        }
+    }
+}
+
+// A chunk other than the first has just become empty. One empty chunk is
+// kept, trimmed, so a workload hovering at a chunk boundary does not map
+// and unmap on every allocation; any further empty chunk is unmapped.
+static void retire_chunk(PoolChunk *chunk)
+{
+    if (memory_pool.spare && memory_pool.spare != chunk && chunk_is_empty(memory_pool.spare))
+    {
+        release_chunk(chunk);
+        return;
+    }
+    memory_pool.spare = chunk;
+    trim_block(chunk->blocks);
+}
+
+// Fold a thread's counters into a running total. High-water marks
+// merge by maximum; last_use is taken from the calling thread instead.
+static void add_thread_stats(ThreadStats *into, const ThreadStats *from)
+{
+    into->total_allocated += STAT_READ(from->total_allocated);
+    into->total_freed += STAT_READ(from->total_freed);
+    into->allocation_count += STAT_READ(from->allocation_count);
+    into->free_count += STAT_READ(from->free_count);
+    into->arena_resets += STAT_READ(from->arena_resets);
+    into->arena_held += STAT_READ(from->arena_held);
+    size_t high_water = STAT_READ(from->arena_high_water);
+    if (high_water > into->arena_high_water)
+    {
+        into->arena_high_water = high_water;
+    }
+    for (int i = 0; i < SIZE_HISTOGRAM_BUCKETS; i++)
+    {
+        into->size_histogram[i] += STAT_READ(from->size_histogram[i]);
+    }
+}
+
+static void add_site_counts(SiteCounts *into, const SiteCounts *from)
+{
+    for (int i = 0; i < MAX_ALLOC_SITES; i++)
+    {
+        into[i].bytes += STAT_READ(from[i].bytes);
+        into[i].blocks += STAT_READ(from[i].blocks);
+        into[i].arena_bytes += STAT_READ(from[i].arena_bytes);
+        into[i].arena_blocks += STAT_READ(from[i].arena_blocks);
+    }
+}
+
+// Take a cache off the registry, keeping its counters. Called with the
+// pool lock held.
+static void unregister_cache(ThreadCache *cache)
+{
+    add_thread_stats(&retired_stats, &cache->stats);
+    add_site_counts(retired_sites, cache->sites);
+    memset(&cache->stats, 0, sizeof(ThreadStats));
+    memset(cache->sites, 0, sizeof(cache->sites));
+    if (cache->prev)
+    {
+        cache->prev->next = cache->next;
+    }
+    else
+    {
+        thread_caches = cache->next;
+    }
+    if (cache->next)
+    {
+        cache->next->prev = cache->prev;
+    }
+    cache->next = cache->prev = NULL;
+    cache->registered = false;
+}
+
+// Keep other threads out of the pool while one forks, so the child never
+// inherits the lock held or a list half updated
+static void lock_for_fork(void)
+{
+    pthread_mutex_lock(&pool_lock);
+}
+
+static void unlock_after_fork(void)
+{
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Only the forking thread exists in the child. The blocks other threads
+// had cached stay allocated there; their counters are kept.
+static void reset_after_fork(void)
+{
+    ThreadCache *cache = thread_caches;
+    while (cache)
+    {
+        ThreadCache *next = cache->next;
+        if (cache != &thread_cache)
+        {
+            unregister_cache(cache);
+        }
+        cache = next;
+    }
+    pthread_mutex_init(&pool_lock, NULL);
+}
+
+static void release_thread_cache(void *arg);
+
+static void create_cache_key(void)
+{
+    pthread_key_create(&cache_key, release_thread_cache);
+    pthread_atfork(lock_for_fork, unlock_after_fork, reset_after_fork);
+}
+
+// The calling thread's cache, registered on first use so its counters
+// are merged into the statistics and its blocks returned when it exits
+static ThreadCache *get_thread_cache(void)
+{
+    ThreadCache *cache = &thread_cache;
+    if (!cache->registered)
+    {
+        pthread_once(&cache_once, create_cache_key);
+        pthread_setspecific(cache_key, cache);
+
+        pthread_mutex_lock(&pool_lock);
+        cache->prev = NULL;
+        cache->next = thread_caches;
+        if (cache->next)
+        {
+            cache->next->prev = cache;
+        }
+        thread_caches = cache;
+        cache->registered = true;
+        pthread_mutex_unlock(&pool_lock);
+    }
+    return cache;
+}
+
+// Payload bytes handed out and not yet freed, across every thread.
+// Called with the pool lock held.
+static size_t merged_usage(void)
+{
+    size_t allocated = retired_stats.total_allocated;
+    size_t freed = retired_stats.total_freed;
+    for (ThreadCache *cache = thread_caches; cache; cache = cache->next)
+    {
+        allocated += STAT_READ(cache->stats.total_allocated);
+        freed += STAT_READ(cache->stats.total_freed);
+    }
+    return allocated - freed;
+}
+
+// Threads count their usage privately, so the peak is sampled whenever
+// one of them comes to the pool and whenever statistics are read. It
+// can miss a short-lived spike made entirely of cached blocks.
+static void sample_peak(void)
+{
+    size_t usage = merged_usage();
+    if (usage > memory_stats.peak_usage)
+    {
+        memory_stats.peak_usage = usage;
+    }
+}
+
+void init_memory_manager(size_t pool_size)
+{
+    pthread_mutex_lock(&pool_lock);
+    memset(&memory_pool, 0, sizeof(MemoryPool));
+    memory_pool.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    memory_pool.chunk_size = pool_size;
+
+    // Every chunk has the pool's size, so one power of two covers them all
+    memory_pool.chunk_align = memory_pool.page_size;
+    while (memory_pool.chunk_align < round_to_pages(pool_size))
+    {
+        memory_pool.chunk_align *= 2;
+    }
+
+    // Map the first chunk; more are added as the pool fills up
+    if (!add_chunk(pool_size))
+    {
+        fprintf(stderr, "Failed to initialize memory pool\n");
+        exit(1);
+    }
+
+    // Initialize statistics
+    memset(&memory_stats, 0, sizeof(MemoryStats));
+    memset(&retired_stats, 0, sizeof(ThreadStats));
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void record_search(size_t steps, bool found)
+{
+    memory_stats.searches++;
+    memory_stats.search_steps += steps;
+    if (steps > memory_stats.max_search_steps)
+    {
+        memory_stats.max_search_steps = steps;
+    }
+    if (!found)
+    {
+        memory_stats.failed_searches++;
+    }
+}
+
+static MemoryBlock *find_free_block(size_t size)
+{
+    int cls = size_class(size);
+    size_t steps = 0;
+
+    // Large bins hold a range of sizes, so the request's own bin needs a fit check
+    if (cls >= SMALL_CLASS_COUNT)
+    {
+        for (MemoryBlock *current = memory_pool.free_lists[cls]; current; current = current->next_free)
+        {
+            steps++;
+            if (block_size(current) >= size)
+            {
+                record_search(steps, true);
+                return current;
+            }
+        }
+        cls++;
+    }
+
+    // Any block in a higher non-empty class is big enough
+    cls = next_nonempty_class(cls, &steps);
+    record_search(steps, cls >= 0);
+    if (cls < 0)
+    {
+        return NULL;
+    }
+    return memory_pool.free_lists[cls];
+}
+
+static int size_histogram_bucket(size_t size)
+{
+    int bucket = 63 - __builtin_clzll((unsigned long long)size);
+    return bucket < SIZE_HISTOGRAM_BUCKETS ? bucket : SIZE_HISTOGRAM_BUCKETS - 1;
+}
+
+// Merge a free block with its free physical neighbours and file the
+// result on its free list; returns the merged block
+static MemoryBlock *coalesce(MemoryBlock *block)
+{
+    size_t size = block_size(block);
+
+    MemoryBlock *next = next_block(block);
+    if (block_is_free(next))
+    {
+        free_list_remove(next);
+        size += block_size(next);
+    }
+
+    size_t prev_tag = prev_footer(block);
+    if (!(prev_tag & BLOCK_IN_USE))
+    {
+        MemoryBlock *prev = (MemoryBlock *)((char *)block - (prev_tag & BLOCK_SIZE_MASK));
+        free_list_remove(prev);
+        size += block_size(prev);
+        block = prev;
+    }
+
+    set_block(block, size, false);
+    free_list_insert(block);
+    return block;
+}
+
+static void split_block(MemoryBlock *block, size_t size)
+{
+    if (block_size(block) >= size + MIN_BLOCK_SIZE)
+    {
+        size_t remaining_size = block_size(block) - size;
+
+        set_block(block, size, !block_is_free(block));
+
+        // The tail becomes a free block of its own, written in place
+        MemoryBlock *new_block = next_block(block);
+        set_block(new_block, remaining_size, false);
+        coalesce(new_block);
+    }
+}
+
+// Total block size needed for a payload of `size` bytes
+static size_t request_to_block_size(size_t size)
+{
+    // Align size to 8 bytes
+    size = ((size + 7) & ~(size_t)7) + BLOCK_OVERHEAD;
+    return size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : size;
+}
+
+// Take a block of at least `size` bytes from the central pool, growing
+// it by one chunk when nothing fits. Called with the pool lock held.
+static MemoryBlock *central_alloc(size_t size)
+{
+    MemoryBlock *block = find_free_block(size);
+    if (!block && add_chunk(memory_pool.chunk_size))
+    {
+        memory_stats.chunks_mapped++;
+        block = find_free_block(size);
+    }
+    if (!block)
+    {
+        return NULL;
+    }
+
+    // Take the block off its free list, then split off any excess
+    free_list_remove(block);
+    set_block(block, block_size(block), true);
+    split_block(block, size);
+    memory_pool.used_size += block_size(block);
+    return block;
+}
+
+// Return a block to the central pool, retiring its chunk if that leaves
+// it empty. Called with the pool lock held.
+static bool return_block(MemoryBlock *block, PoolChunk *chunk)
+{
+    // Mark block as free and merge it with its immediate neighbours
+    memory_pool.used_size -= block_size(block);
+    memory_pool.freed_since_trim += block_size(block);
+    set_block(block, block_size(block), false);
+    coalesce(block);
+
+    if (chunk != memory_pool.chunks && chunk_is_empty(chunk))
+    {
+        retire_chunk(chunk);
+        return true;
+    }
+    return false;
+}
+
+// Return every block in the calling thread's cache. Scattered over the
+// chunks, cached blocks would keep them from ever emptying.
+static void drain_thread_cache(void)
+{
+    ThreadCache *cache = &thread_cache;
+    for (int cls = 0; cls < SMALL_CLASS_COUNT; cls++)
+    {
+        MemoryBlock *block = cache->bins[cls];
+        while (block)
+        {
+            MemoryBlock *next = block->next_free;
+            return_block(block, chunk_of(block));
+            block = next;
+        }
+        cache->bins[cls] = NULL;
+        cache->counts[cls] = 0;
+    }
+    STAT_SET(cache->cached, 0);
+}
+
+// Resident memory follows the working set: empty chunks are retired and
+// large free runs are trimmed every so often
+static void central_free(MemoryBlock *block, PoolChunk *chunk)
+{
+    if (!return_block(block, chunk) && memory_pool.freed_since_trim >= TRIM_THRESHOLD)
+    {
+        drain_thread_cache();
+        trim_free_blocks();
+    }
+}
+
+static void cache_push(ThreadCache *cache, int cls, MemoryBlock *block)
+{
+    block->prev_free = CACHED_MARK;
+    block->next_free = cache->bins[cls];
+    cache->bins[cls] = block;
+    cache->counts[cls]++;
+    STAT_ADD(cache->cached, 1);
+}
+
+// Give all but the `keep` most recently freed blocks of a bin back to
+// the pool
+static void cache_flush(ThreadCache *cache, int cls, uint32_t keep)
+{
+    MemoryBlock **link = &cache->bins[cls];
+    for (uint32_t i = 0; i < keep && *link; i++)
+    {
+        link = &(*link)->next_free;
+    }
+    MemoryBlock *block = *link;
+    *link = NULL;
+    STAT_SUB(cache->cached, cache->counts[cls] - keep);
+    cache->counts[cls] = keep;
+
+    pthread_mutex_lock(&pool_lock);
+    while (block)
+    {
+        MemoryBlock *next = block->next_free;
+        central_free(block, chunk_of(block));
+        block = next;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Take a block of class cls from the cache, refilling the bin with a
+// batch from the pool when it is empty
+static MemoryBlock *cache_pop(ThreadCache *cache, int cls)
+{
+    if (!cache->bins[cls])
+    {
+        size_t size = (size_t)(cls + 1) * SIZE_CLASS_STEP;
+        pthread_mutex_lock(&pool_lock);
+        sample_peak();
+        for (int i = 0; i < CACHE_BATCH; i++)
+        {
+            MemoryBlock *block = central_alloc(size);
+            if (!block)
+            {
+                break;
+            }
+            cache_push(cache, cls, block);
+        }
+        pthread_mutex_unlock(&pool_lock);
+        if (!cache->bins[cls])
+        {
+            return NULL;
+        }
+    }
+
+    MemoryBlock *block = cache->bins[cls];
+    cache->bins[cls] = block->next_free;
+    cache->counts[cls]--;
+    STAT_SUB(cache->cached, 1);
+    block->prev_free = NULL;
+    block->next_free = NULL;
+    return block;
+}
+
+// Runs as a thread exits: its cached blocks go back to the pool and its
+// counters are kept
+static void release_thread_cache(void *arg)
+{
+    ThreadCache *cache = arg;
+    for (int cls = 0; cls < SMALL_CLASS_COUNT; cls++)
+    {
+        if (cache->bins[cls])
+        {
+            cache_flush(cache, cls, 0);
+        }
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (cache->registered)
+    {
+        unregister_cache(cache);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// A large block gets a mapping of its own, returned whole on free.
+// Called with the pool lock held.
+static MemoryBlock *map_large_block(size_t size)
+{
+    size_t length = round_to_pages(sizeof(LargeMapping) + size);
+    LargeMapping *mapping = map_pages(length);
+    if (!mapping)
+    {
+        return NULL;
+    }
+
+    mapping->size = length;
+    mapping->prev = NULL;
+    mapping->next = memory_pool.large;
+    if (mapping->next)
+    {
+        mapping->next->prev = mapping;
+    }
+    memory_pool.large = mapping;
+    memory_pool.total_size += length;
+    memory_pool.large_count++;
+    memory_stats.large_mapped++;
+
+    // The block takes the rest of the mapping
+    MemoryBlock *block = (MemoryBlock *)(mapping + 1);
+    block->size = ((length - sizeof(LargeMapping)) & ~BLOCK_FLAGS) | BLOCK_IN_USE | BLOCK_MAPPED;
+    *block_footer(block) = block->size;
+    return block;
+}
+
+static void unmap_large_block(MemoryBlock *block)
+{
+    LargeMapping *mapping = (LargeMapping *)block - 1;
+    if (mapping->prev)
+    {
+        mapping->prev->next = mapping->next;
+    }
+    else
+    {
+        memory_pool.large = mapping->next;
+    }
+    if (mapping->next)
+    {
+        mapping->next->prev = mapping->prev;
+    }
+    memory_pool.total_size -= mapping->size;
+    memory_pool.large_count--;
+    munmap(mapping, mapping->size);
+}
+
+// Find or add the table slot of a call site. Sites are told apart by the
+// address of their __FILE__ string and their line, so a lookup is a hash
+// and usually one comparison.
+static unsigned int site_slot(const char *file, int line)
+{
+    return (unsigned int)(((uintptr_t)file >> 3) * 31 + (unsigned int)line) % (MAX_ALLOC_SITES - 1) + 1;
+}
+
+static unsigned int add_site(const char *file, int line)
+{
+    unsigned int slot = site_slot(file, line);
+    unsigned int site = 0;
+    pthread_mutex_lock(&pool_lock);
+    for (int probes = 1; probes < MAX_ALLOC_SITES; probes++)
+    {
+        if (!alloc_sites[slot].file)
+        {
+            alloc_sites[slot].line = line;
+            __atomic_store_n(&alloc_sites[slot].file, file, __ATOMIC_RELEASE);
+        }
+        if (alloc_sites[slot].file == file && alloc_sites[slot].line == line)
+        {
+            site = slot;
+            break;
+        }
+        slot = slot % (MAX_ALLOC_SITES - 1) + 1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return site;
+}
+
+static unsigned int find_site(const char *file, int line)
+{
+    unsigned int slot = site_slot(file, line);
+    for (int probes = 1; probes < MAX_ALLOC_SITES; probes++)
+    {
+        const char *known = __atomic_load_n(&alloc_sites[slot].file, __ATOMIC_ACQUIRE);
+        if (!known)
+        {
+            return add_site(file, line);
+        }
+        if (known == file && alloc_sites[slot].line == line)
+        {
+            return slot;
+        }
+        slot = slot % (MAX_ALLOC_SITES - 1) + 1;
+    }
+    return 0;
+}
+
+// Tag a block with its site and count it as allocated there. Only the
+// owning thread writes an allocated block's tags. A reused block starts
+// out as no arena's chunk.
+static void track_block(ThreadCache *cache, MemoryBlock *block, unsigned int site)
+{
+    block->size = (block->size & (BLOCK_SIZE_MASK | BLOCK_IN_USE | BLOCK_MAPPED)) | (size_t)site << BLOCK_SITE_SHIFT;
+    *block_footer(block) = block->size;
+    STAT_ADD(cache->sites[site].bytes, payload_size(block));
+    STAT_ADD(cache->sites[site].blocks, 1);
+}
+
+static void untrack_block(ThreadCache *cache, MemoryBlock *block)
+{
+    unsigned int site = block_site(block);
+    STAT_SUB(cache->sites[site].bytes, payload_size(block));
+    STAT_SUB(cache->sites[site].blocks, 1);
+    if (block->size & BLOCK_ARENA)
+    {
+        STAT_SUB(cache->sites[site].arena_bytes, payload_size(block));
+        STAT_SUB(cache->sites[site].arena_blocks, 1);
+        STAT_SUB(cache->stats.arena_held, payload_size(block));
+    }
+}
+
+// Mark a freshly allocated block as an arena's chunk, which is in use
+// rather than leaked until the arena frees it
+static void track_arena_chunk(void *ptr)
+{
+    ThreadCache *cache = get_thread_cache();
+    MemoryBlock *block = (MemoryBlock *)((char *)ptr - sizeof(size_t));
+    unsigned int site = block_site(block);
+    block->size |= BLOCK_ARENA;
+    *block_footer(block) = block->size;
+    STAT_ADD(cache->sites[site].arena_bytes, payload_size(block));
+    STAT_ADD(cache->sites[site].arena_blocks, 1);
+    STAT_ADD(cache->stats.arena_held, payload_size(block));
+}
+
+static void count_allocation(ThreadCache *cache, MemoryBlock *block, unsigned int site)
+{
+    STAT_ADD(cache->stats.total_allocated, payload_size(block));
+    STAT_ADD(cache->stats.allocation_count, 1);
+    track_block(cache, block, site);
+}
+
+void *shell_malloc_at(size_t size, const char *file, int line)
+{
+    if (size == 0 || size > SIZE_MAX / 2)
+        return NULL;
+
+    ThreadCache *cache = get_thread_cache();
+    unsigned int site = find_site(file, line);
+    STAT_ADD(cache->stats.size_histogram[size_histogram_bucket(size)], 1);
+    size = request_to_block_size(size);
+
+    // Small blocks come from the thread's cache without locking
+    MemoryBlock *block;
+    if (size <= SMALL_CLASS_MAX)
+    {
+        block = cache_pop(cache, size_class(size));
+        if (block)
+        {
+            count_allocation(cache, block, site);
+        }
+    }
+    else
+    {
+        pthread_mutex_lock(&pool_lock);
+        block = needs_own_mapping(size) ? map_large_block(size) : central_alloc(size);
+        if (block)
+        {
+            // Update statistics (the block may be slightly larger than requested)
+            count_allocation(cache, block, site);
+            sample_peak();
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    if (!block)
+    {
+        fprintf(stderr, "Memory allocation failed: out of memory\n");
+        return NULL;
+    }
+
+    return block_payload(block);
+}
+
+// Map a payload pointer in a pool chunk back to its header, or NULL if it
+// is not a live block. Needs no lock: only the block's owner writes its
+// tags while it is in use. *chunk is set to the chunk the pointer falls
+// in, or NULL when no live chunk does.
+static MemoryBlock *find_pool_block(void *ptr, PoolChunk **chunk)
+{
+    *chunk = NULL;
+    if (((size_t)ptr & 7) != 0)
+    {
+        return NULL;
+    }
+
+    *chunk = chunk_of(ptr);
+    if (!chunk_is_live(*chunk))
+    {
+        *chunk = NULL;
+        return NULL;
+    }
+    if ((char *)ptr < (char *)block_payload((*chunk)->blocks))
+    {
+        return NULL;
+    }
+
+    MemoryBlock *block = (MemoryBlock *)((char *)ptr - sizeof(size_t));
+    if (block_is_free(block) || (char *)block + block_size(block) > (char *)*chunk + (*chunk)->size ||
+        *block_footer(block) != block->size)
+    {
+        return NULL;
+    }
+    if (block_size(block) <= SMALL_CLASS_MAX && block->prev_free == CACHED_MARK)
+    {
+        return NULL;
+    }
+    return block;
+}
+
+// The block of a large mapping, or NULL. Its mapping header starts a
+// page, so any other pointer is ruled out before a tag is read, and a
+// pool block never carries BLOCK_MAPPED. Needs no lock, like
+// find_pool_block.
+static MemoryBlock *find_large_block(void *ptr)
+{
+    MemoryBlock *block = (MemoryBlock *)((char *)ptr - sizeof(size_t));
+    LargeMapping *mapping = (LargeMapping *)block - 1;
+    if (((uintptr_t)mapping & (memory_pool.page_size - 1)) != 0 || !(block->size & BLOCK_MAPPED) ||
+        block_is_free(block) || sizeof(LargeMapping) + block_size(block) > mapping->size ||
+        *block_footer(block) != block->size)
+    {
+        return NULL;
+    }
+    return block;
+}
+
+void shell_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    // Large blocks are told apart by their tag, before any chunk lookup
+    PoolChunk *chunk = NULL;
+    MemoryBlock *block = find_large_block(ptr);
+    if (!block)
+    {
+        block = find_pool_block(ptr, &chunk);
+    }
+    ThreadCache *cache = get_thread_cache();
+
+    // Small blocks go to the thread's cache; an overfull bin gives half
+    // of its blocks back to the pool
+    if (block && block_size(block) <= SMALL_CLASS_MAX)
+    {
+        STAT_ADD(cache->stats.total_freed, payload_size(block));
+        STAT_ADD(cache->stats.free_count, 1);
+        untrack_block(cache, block);
+        int cls = size_class(block_size(block));
+        cache_push(cache, cls, block);
+        if (cache->counts[cls] > CACHE_LIMIT)
+        {
+            cache_flush(cache, cls, CACHE_LIMIT / 2);
+        }
+        return;
+    }
+
+    if (!block)
+    {
+        fprintf(stderr, "Invalid pointer passed to shell_free\n");
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+
+    // Update statistics
+    STAT_ADD(cache->stats.total_freed, payload_size(block));
+    STAT_ADD(cache->stats.free_count, 1);
+    untrack_block(cache, block);
+    if (chunk)
+    {
+        central_free(block, chunk);
+    }
+    else
+    {
+        unmap_large_block(block);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Grow an allocated block by merging its free successor into it. When a
+// buffer is grown repeatedly, the successor is usually the free block at
+// the end of the chunk. Called with the pool lock held.
+static bool absorb_next(MemoryBlock *block, size_t size)
+{
+    MemoryBlock *next = next_block(block);
+    if (!block_is_free(next) || block_size(block) + block_size(next) < size)
+    {
+        return false;
+    }
+    free_list_remove(next);
+    set_block(block, block_size(block) + block_size(next), true);
+    return true;
+}
+
+// Move a large block to a mapping of the new size. mremap grows it in
+// place when the address space after it is free, and otherwise moves
+// its pages without copying them. Called with the pool lock held.
+static MemoryBlock *remap_large_block(MemoryBlock *block, size_t size)
+{
+    LargeMapping *mapping = (LargeMapping *)block - 1;
+    size_t length = round_to_pages(sizeof(LargeMapping) + size);
+    if (length == mapping->size)
+    {
+        return block;
+    }
+
+    LargeMapping *moved = mremap(mapping, mapping->size, length, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED)
+    {
+        return NULL;
+    }
+    memory_pool.total_size = memory_pool.total_size - moved->size + length;
+    moved->size = length;
+    if (moved->prev)
+    {
+        moved->prev->next = moved;
+    }
+    else
+    {
+        memory_pool.large = moved;
+    }
+    if (moved->next)
+    {
+        moved->next->prev = moved;
+    }
+
+    block = (MemoryBlock *)(moved + 1);
+    block->size = ((length - sizeof(LargeMapping)) & ~BLOCK_FLAGS) | BLOCK_IN_USE | BLOCK_MAPPED;
+    *block_footer(block) = block->size;
+    return block;
+}
+
+// Resize a block without copying its contents, or return NULL. Pool
+// blocks shrink by splitting off their tail and grow into a free
+// successor; large blocks are remapped, so they may move.
+static MemoryBlock *resize_in_place(MemoryBlock *block, PoolChunk *chunk, size_t size)
+{
+    // A small block that still fits is not worth splitting
+    if (chunk && block_size(block) <= SMALL_CLASS_MAX && block_size(block) >= size)
+    {
+        return block;
+    }
+
+    MemoryBlock *resized = NULL;
+    pthread_mutex_lock(&pool_lock);
+    if (!chunk)
+    {
+        resized = remap_large_block(block, size);
+    }
+    else if (!needs_own_mapping(size) || block_size(block) >= size)
+    {
+        size_t old_size = block_size(block);
+        if (old_size >= size || absorb_next(block, size))
+        {
+            // Anything beyond the new size goes back to the pool
+            split_block(block, size);
+            memory_pool.used_size = memory_pool.used_size - old_size + block_size(block);
+            resized = block;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return resized;
+}
+
+void *shell_realloc_at(void *ptr, size_t new_size, const char *file, int line)
+{
+    if (!ptr)
+        return shell_malloc_at(new_size, file, line);
+    if (new_size == 0)
+    {
+        shell_free(ptr);
+        return NULL;
+    }
+    if (new_size > SIZE_MAX / 2)
+        return NULL;
+
+    PoolChunk *chunk = NULL;
+    MemoryBlock *block = find_large_block(ptr);
+    if (!block)
+    {
+        block = find_pool_block(ptr, &chunk);
+    }
+    if (!block)
+    {
+        fprintf(stderr, "Invalid pointer passed to shell_realloc\n");
+        return NULL;
+    }
+
+    size_t block_needed = request_to_block_size(new_size);
+    ThreadCache *cache = get_thread_cache();
+    size_t old_payload = payload_size(block);
+
+    // A block resized in place is counted at the resizing call site
+    untrack_block(cache, block);
+    MemoryBlock *resized = resize_in_place(block, chunk, block_needed);
+    if (resized)
+    {
+        if (payload_size(resized) >= old_payload)
+        {
+            STAT_ADD(cache->stats.total_allocated, payload_size(resized) - old_payload);
+        }
+        else
+        {
+            STAT_ADD(cache->stats.total_freed, old_payload - payload_size(resized));
+        }
+        track_block(cache, resized, find_site(file, line));
+        return block_payload(resized);
+    }
+    track_block(cache, block, block_site(block));
+
+    // Allocate new block
+    void *new_ptr = shell_malloc_at(new_size, file, line);
+    if (!new_ptr)
+        return NULL;
+
+    // Copy data and free old block; a shrinking move keeps only the head
+    memcpy(new_ptr, ptr, old_payload < new_size ? old_payload : new_size);
+    shell_free(ptr);
+
+    return new_ptr;
+}
+
+void arena_init(Arena *arena, size_t chunk_size)
+{
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size;
+    arena->used = 0;
+    arena->high_water = 0;
+}
+
+void *arena_alloc_at(Arena *arena, size_t size, const char *file, int line)
+{
+    // Align size to 8 bytes
+    size = (size + 7) & ~(size_t)7;
+
+    ArenaChunk *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        // Current chunk is full: start a new one (chunks are created lazily)
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+        chunk = shell_malloc_at(sizeof(ArenaChunk) + chunk_size, file, line);
+        if (!chunk)
+        {
+            return NULL;
+        }
+        track_arena_chunk(chunk);
+        chunk->next = arena->chunks;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        arena->chunks = chunk;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->used += size;
+    return ptr;
+}
+
+char *arena_strdup_at(Arena *arena, const char *str, const char *file, int line)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc_at(arena, len, file, line);
+    if (copy)
+    {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+void arena_reset(Arena *arena)
+{
+    // Record high-water marks
+    if (arena->used > arena->high_water)
+    {
+        arena->high_water = arena->used;
+    }
+    ThreadStats *stats = &get_thread_cache()->stats;
+    if (arena->high_water > stats->arena_high_water)
+    {
+        STAT_SET(stats->arena_high_water, arena->high_water);
+    }
+    STAT_SET(stats->arena_last_use, arena->used);
+    STAT_ADD(stats->arena_resets, 1);
+
+    ArenaChunk *chunk = arena->chunks;
+    if (chunk && chunk->next)
+    {
+        // The arena spilled into extra chunks: release them all and size
+        // the next first chunk so this much fits without spilling again
+        while (chunk)
+        {
+            ArenaChunk *next = chunk->next;
+            shell_free(chunk);
+            chunk = next;
+        }
+        arena->chunks = NULL;
+        if (arena->used > arena->chunk_size)
+        {
+            arena->chunk_size = arena->used;
+        }
+    }
+    else if (chunk)
+    {
+        // Common case: a single chunk is simply rewound
+        chunk->used = 0;
+    }
+    arena->used = 0;
+}
+
+ArenaMark arena_mark(Arena *arena)
+{
+    ArenaMark mark = {arena->chunks, arena->chunks ? arena->chunks->used : 0, arena->used};
+    return mark;
+}
+
+void arena_release(Arena *arena, ArenaMark mark)
+{
+    if (arena->used > arena->high_water)
+    {
+        arena->high_water = arena->used;
+    }
+
+    // Chunks started after the mark go back to the pool
+    while (arena->chunks != mark.chunk)
+    {
+        ArenaChunk *next = arena->chunks->next;
+        shell_free(arena->chunks);
+        arena->chunks = next;
+    }
+    if (mark.chunk)
+    {
+        mark.chunk->used = mark.chunk_used;
+    }
+    arena->used = mark.used;
+}
+
+void arena_destroy(Arena *arena)
+{
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk)
+    {
+        ArenaChunk *next = chunk->next;
+        shell_free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->used = 0;
+}
+
+// Free-space figures are not maintained on the hot paths; they are
+// gathered from the free lists when asked for. Called with the pool lock
+// held; blocks in thread caches are counted separately.
+static void collect_free_stats(MemoryStats *stats)
+{
+    stats->free_bytes = 0;
+    stats->free_blocks = 0;
+    stats->largest_free_block = 0;
+    for (int cls = 0; cls < NUM_SIZE_CLASSES; cls++)
+    {
+        for (MemoryBlock *block = memory_pool.free_lists[cls]; block; block = block->next_free)
+        {
+            stats->free_bytes += payload_size(block);
+            stats->free_blocks++;
+            if (payload_size(block) > stats->largest_free_block)
+            {
+                stats->largest_free_block = payload_size(block);
+            }
+        }
+    }
+    stats->fragmentation =
+        stats->free_bytes ? 1.0 - (double)stats->largest_free_block / (double)stats->free_bytes : 0.0;
+}
+
+void print_memory_stats(void)
+{
+    MemoryStats stats = get_memory_stats();
+
+    printf("\nMemory Manager Statistics:\n");
+    printf("-------------------------\n");
+    printf("Total Allocated: %zu bytes\n", stats.total_allocated);
+    printf("Total Freed: %zu bytes\n", stats.total_freed);
+    printf("Current Usage: %zu bytes\n", stats.current_usage);
+    printf("Peak Usage: %zu bytes (sampled)\n", stats.peak_usage);
+    printf("Allocation Count: %zu\n", stats.allocation_count);
+    printf("Free Count: %zu\n", stats.free_count);
+    printf("Arena Last Use: %zu bytes\n", stats.arena_last_use);
+    printf("Arena High-Water: %zu bytes\n", stats.arena_high_water);
+    printf("Arena Resets: %zu\n", stats.arena_resets);
+    printf("Arena Chunks: %zu bytes held by live arenas\n", stats.arena_held);
+    printf("Pool: %zu bytes mapped in %zu chunks and %zu large mappings, %zu bytes of chunks in use\n",
+           stats.mapped_bytes, stats.chunk_count, stats.large_count, stats.pool_used_bytes);
+    printf("Chunks Mapped/Released: %zu/%zu, Large Mappings: %zu\n", stats.chunks_mapped,
+           stats.chunks_released, stats.large_mapped);
+    printf("Trimmed: %zu bytes in %zu calls\n", stats.trimmed_bytes, stats.trims);
+    printf("Thread Caches: %zu, holding %zu blocks\n", stats.threads, stats.cached_blocks);
+    printf("Free: %zu bytes in %zu blocks, largest %zu bytes\n", stats.free_bytes, stats.free_blocks,
+           stats.largest_free_block);
+    printf("Fragmentation: %.1f%%\n", stats.fragmentation * 100);
+    printf("Free-Block Searches: %zu (%.2f steps avg, %zu max, %zu failed)\n", stats.searches,
+           stats.searches ? (double)stats.search_steps / stats.searches : 0.0, stats.max_search_steps,
+           stats.failed_searches);
+    printf("Request Sizes:\n");
+    for (int i = 0; i < SIZE_HISTOGRAM_BUCKETS; i++)
+    {
+        if (stats.size_histogram[i])
+        {
+            printf("  %8zu - %-8zu %zu\n", (size_t)1 << i, ((size_t)2 << i) - 1, stats.size_histogram[i]);
+        }
+    }
+    printf("-------------------------\n");
+}
+
+void print_memory_stats_json(void)
+{
+    MemoryStats stats = get_memory_stats();
+    printf("{\"total_allocated\": %zu, \"total_freed\": %zu, \"current_usage\": %zu, \"peak_usage\": %zu, "
+           "\"allocation_count\": %zu, \"free_count\": %zu, ",
+           stats.total_allocated, stats.total_freed, stats.current_usage, stats.peak_usage, stats.allocation_count,
+           stats.free_count);
+    printf("\"pool\": {\"mapped_bytes\": %zu, \"used_bytes\": %zu, \"chunks\": %zu, \"large_mappings\": %zu, "
+           "\"chunks_mapped\": %zu, \"chunks_released\": %zu, \"large_mapped\": %zu, \"trims\": %zu, "
+           "\"trimmed_bytes\": %zu}, ",
+           stats.mapped_bytes, stats.pool_used_bytes, stats.chunk_count, stats.large_count, stats.chunks_mapped,
+           stats.chunks_released, stats.large_mapped, stats.trims, stats.trimmed_bytes);
+    printf("\"thread_caches\": {\"threads\": %zu, \"cached_blocks\": %zu}, ", stats.threads, stats.cached_blocks);
+    printf("\"arena\": {\"last_use\": %zu, \"high_water\": %zu, \"resets\": %zu, \"held\": %zu}, ",
+           stats.arena_last_use, stats.arena_high_water, stats.arena_resets, stats.arena_held);
+    printf("\"free\": {\"bytes\": %zu, \"blocks\": %zu, \"largest\": %zu, \"fragmentation\": %.4f}, ",
+           stats.free_bytes, stats.free_blocks, stats.largest_free_block, stats.fragmentation);
+    printf("\"search\": {\"count\": %zu, \"steps\": %zu, \"max_steps\": %zu, \"failed\": %zu}, ",
+           stats.searches, stats.search_steps, stats.max_search_steps, stats.failed_searches);
+
+    // Bucket i counts requests of 2^i to 2^(i+1) - 1 bytes
+    int used = SIZE_HISTOGRAM_BUCKETS;
+    while (used > 0 && stats.size_histogram[used - 1] == 0)
+    {
+        used--;
+    }
+    printf("\"size_histogram\": [");
+    for (int i = 0; i < used; i++)
+    {
+        printf("%s%zu", i ? ", " : "", stats.size_histogram[i]);
+    }
+    printf("]}\n");
+}
+
+void print_memory_blocks(void)
+{
+    printf("\nMemory Blocks:\n");
+    printf("-------------\n");
+    int block_count = 0;
+    int chunk_count = 0;
+    pthread_mutex_lock(&pool_lock);
+    for (PoolChunk *chunk = memory_pool.chunks; chunk; chunk = chunk->next)
+    {
+        printf("Chunk %d: Address=%p, Size=%zu%s\n", ++chunk_count, (void *)chunk, chunk->size,
+               chunk == memory_pool.spare ? " (spare)" : "");
+
+        // Walk the chunk by block size until the zero-sized epilogue
+        for (MemoryBlock *current = chunk->blocks; block_size(current) > 0; current = next_block(current))
+        {
+            const char *status = block_is_free(current) ? "Free" : "Used";
+            if (!block_is_free(current) && block_size(current) <= SMALL_CLASS_MAX &&
+                current->prev_free == CACHED_MARK)
+            {
+                status = "Cached";
+            }
+            printf("Block %d: Address=%p, Size=%zu, Status=%s\n",
+                   ++block_count, block_payload(current), payload_size(current), status);
+        }
+    }
+    for (LargeMapping *mapping = memory_pool.large; mapping; mapping = mapping->next)
+    {
+        MemoryBlock *block = (MemoryBlock *)(mapping + 1);
+        printf("Block %d: Address=%p, Size=%zu, Status=Used (own mapping)\n",
+               ++block_count, block_payload(block), payload_size(block));
+    }
+    pthread_mutex_unlock(&pool_lock);
+    printf("-------------\n");
+}
+
+MemoryStats get_memory_stats(void)
+{
+    ThreadCache *self = get_thread_cache();
+    pthread_mutex_lock(&pool_lock);
+    sample_peak();
+    MemoryStats stats = memory_stats;
+
+    // Merge the counters of every thread, live or gone
+    ThreadStats totals = retired_stats;
+    for (ThreadCache *cache = thread_caches; cache; cache = cache->next)
+    {
+        add_thread_stats(&totals, &cache->stats);
+        stats.threads++;
+        stats.cached_blocks += STAT_READ(cache->cached);
+    }
+    stats.total_allocated = totals.total_allocated;
+    stats.total_freed = totals.total_freed;
+    stats.current_usage = totals.total_allocated - totals.total_freed;
+    stats.allocation_count = totals.allocation_count;
+    stats.free_count = totals.free_count;
+    stats.arena_high_water = totals.arena_high_water;
+    stats.arena_last_use = self->stats.arena_last_use;
+    stats.arena_resets = totals.arena_resets;
+    stats.arena_held = totals.arena_held;
+    memcpy(stats.size_histogram, totals.size_histogram, sizeof(stats.size_histogram));
+
+    stats.mapped_bytes = memory_pool.total_size;
+    stats.pool_used_bytes = memory_pool.used_size;
+    stats.chunk_count = memory_pool.chunk_count;
+    stats.large_count = memory_pool.large_count;
+    collect_free_stats(&stats);
+    pthread_mutex_unlock(&pool_lock);
+    return stats;
+}
+
+// Outstanding bytes and blocks per call site, merged from every thread
+typedef struct
+{
+    unsigned int site;
+    SiteCounts counts;
+} SiteReport;
+
+static int compare_site_bytes(const void *a, const void *b)
+{
+    size_t x = ((const SiteReport *)a)->counts.bytes;
+    size_t y = ((const SiteReport *)b)->counts.bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_leaking_sites(void)
+{
+    SiteCounts totals[MAX_ALLOC_SITES];
+    SiteReport reports[MAX_ALLOC_SITES];
+    AllocSite sites[MAX_ALLOC_SITES];
+
+    pthread_mutex_lock(&pool_lock);
+    memcpy(totals, retired_sites, sizeof(totals));
+    for (ThreadCache *cache = thread_caches; cache; cache = cache->next)
+    {
+        add_site_counts(totals, cache->sites);
+    }
+    memcpy(sites, alloc_sites, sizeof(sites));
+    pthread_mutex_unlock(&pool_lock);
+
+    int count = 0;
+    // Chunks of live arenas are in use, not leaked
+    for (int i = 0; i < MAX_ALLOC_SITES; i++)
+    {
+        totals[i].bytes -= totals[i].arena_bytes;
+        totals[i].blocks -= totals[i].arena_blocks;
+        if (totals[i].blocks)
+        {
+            reports[count++] = (SiteReport){(unsigned int)i, totals[i]};
+        }
+    }
+    qsort(reports, count, sizeof(SiteReport), compare_site_bytes);
+
+    printf("Top leaking sites:\n");
+    printf("%10s %8s  %s\n", "bytes", "blocks", "site");
+    for (int i = 0; i < count && i < LEAK_REPORT_SITES; i++)
+    {
+        const AllocSite *site = &sites[reports[i].site];
+        if (site->file)
+        {
+            printf("%10zu %8zu  %s:%d\n", reports[i].counts.bytes, reports[i].counts.blocks, site->file, site->line);
+        }
+        else
+        {
+            printf("%10zu %8zu  (other sites)\n", reports[i].counts.bytes, reports[i].counts.blocks);
+        }
+    }
+    if (count > LEAK_REPORT_SITES)
+    {
+        printf("(%d more sites)\n", count - LEAK_REPORT_SITES);
+    }
+}
+
+bool check_memory_leaks(void)
+{
+    MemoryStats stats = get_memory_stats();
+    size_t leaked_bytes = stats.total_allocated - stats.total_freed - stats.arena_held;
+    if (leaked_bytes > 0)
+    {
+        printf("\nMemory Leak Detected!\n");
+        printf("Leaked bytes: %zu\n", leaked_bytes);
+        print_leaking_sites();
+        return true;
+    }
+    printf("\nNo memory leaks detected.\n");
+    return false;
+}
+
+void cleanup_memory_manager(void)
+{
+    pthread_mutex_lock(&pool_lock);
+
+    // Block headers live inside the mappings, so unmapping them releases
+    // everything, the blocks held in thread caches included
+    while (memory_pool.large)
+    {
+        LargeMapping *next = memory_pool.large->next;
+        munmap(memory_pool.large, memory_pool.large->size);
+        memory_pool.large = next;
+    }
+    while (memory_pool.chunks)
+    {
+        PoolChunk *next = memory_pool.chunks->next;
+        munmap(memory_pool.chunks, memory_pool.chunks->size);
+        memory_pool.chunks = next;
+    }
+    memset(chunk_table, 0, sizeof(chunk_table));
+
+    // Reset statistics. The calling thread's cache registers afresh on
+    // its next allocation.
+    while (thread_caches)
+    {
+        unregister_cache(thread_caches);
+    }
+    memset(thread_cache.bins, 0, sizeof(thread_cache.bins));
+    memset(thread_cache.counts, 0, sizeof(thread_cache.counts));
+    thread_cache.cached = 0;
+    memset(&retired_stats, 0, sizeof(ThreadStats));
+    memset(retired_sites, 0, sizeof(retired_sites));
+    memset(&memory_stats, 0, sizeof(MemoryStats));
+    memset(&memory_pool, 0, sizeof(MemoryPool));
+    pthread_mutex_unlock(&pool_lock);
+}
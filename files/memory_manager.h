@@ -1,49 +1,226 @@
-#ifndef MEMORY_MANAGER_H
-#define MEMORY_MANAGER_H
-
-#include <stddef.h>
-#include <stdbool.h>
-
-// Memory block structure
-typedef struct MemoryBlock
-{
-    void *address;
-    size_t size;
-    bool is_free;
-    struct MemoryBlock *next;
-} MemoryBlock;
-
-// Memory pool structure
-typedef struct MemoryPool
-{
-    void *start;
-    size_t total_size;
-    size_t used_size;
-    MemoryBlock *blocks;
-} MemoryPool;
-
-// Memory statistics structure
-typedef struct MemoryStats
-{
-    size_t total_allocated;
-    size_t total_freed;
-    size_t current_usage;
-    size_t peak_usage;
-    size_t allocation_count;
-    size_t free_count;
-} MemoryStats;
-
-// Memory manager functions
-void init_memory_manager(size_t pool_size);
-void *shell_malloc(size_t size);
-void shell_free(void *ptr);
-void *shell_realloc(void *ptr, size_t new_size);
-void print_memory_stats(void);
-void cleanup_memory_manager(void);
-
-// Memory tracking functions
-MemoryStats get_memory_stats(void);
-void print_memory_blocks(void);
-bool check_memory_leaks(void);
-
+#ifndef MEMORY_MANAGER_H
+#define MEMORY_MANAGER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Size classes: exact-fit classes every 8 bytes up to 512 bytes, then
+// power-of-two bins for larger requests
+#define SIZE_CLASS_STEP 8
+#define SMALL_CLASS_COUNT 64
+#define SMALL_CLASS_MAX (SIZE_CLASS_STEP * SMALL_CLASS_COUNT)
+#define LARGE_CLASS_COUNT 48
+#define NUM_SIZE_CLASSES (SMALL_CLASS_COUNT + LARGE_CLASS_COUNT)
+#define FREE_MAP_WORDS ((NUM_SIZE_CLASSES + 63) / 64)
+
+// Memory block header, stored in-band at the start of every block.
+// `size` is the whole block size (header, payload and footer) with the
+// low bit marking the block as in use; a copy of it sits in the block's
+// last word as a footer so neighbours can be found in constant time.
+// The free-list links overlay the payload and are valid only while free.
+typedef struct MemoryBlock
+{
+    size_t size;
+    struct MemoryBlock *prev_free;
+    struct MemoryBlock *next_free;
+} MemoryBlock;
+
+// Requests whose block would be at least this big get a mapping of
+// their own instead of a place in a pool chunk
+#define LARGE_MAPPING_THRESHOLD (128 * 1024)
+
+// Once this many bytes have been freed, the pages inside large free
+// blocks are handed back to the OS with MADV_DONTNEED
+#define TRIM_THRESHOLD (256 * 1024)
+#define TRIM_MIN_BLOCK (64 * 1024)
+
+// The pool is a list of mmap'd chunks. Each is laid out like a single
+// pool: a prologue footer, the blocks, and an epilogue header, so
+// coalescing never crosses from one chunk into another.
+typedef struct PoolChunk
+{
+    struct PoolChunk *next;
+    struct PoolChunk *prev;
+    size_t size;         // length of the mapping
+    MemoryBlock *blocks; // first block, after the prologue footer
+} PoolChunk;
+
+// Header of a dedicated mapping for one large block
+typedef struct LargeMapping
+{
+    struct LargeMapping *next;
+    struct LargeMapping *prev;
+    size_t size; // length of the mapping
+} LargeMapping;
+
+// Memory pool structure, shared by every thread behind one lock
+typedef struct MemoryPool
+{
+    PoolChunk *chunks;   // the first chunk is never unmapped
+    PoolChunk *spare;    // an empty chunk kept (trimmed) for reuse, or NULL
+    LargeMapping *large; // dedicated mappings
+    size_t chunk_size;   // size of each new chunk
+    size_t chunk_align;  // power of two every chunk starts on and fits in
+    size_t page_size;
+    size_t total_size;   // bytes mapped for chunks and large blocks
+    size_t used_size;    // bytes in allocated blocks, including overhead
+    size_t chunk_count;
+    size_t large_count;
+    size_t freed_since_trim;
+    MemoryBlock *free_lists[NUM_SIZE_CLASSES];
+    uint64_t free_map[FREE_MAP_WORDS]; // bit set = free list non-empty
+} MemoryPool;
+
+// Request sizes are counted in power-of-two buckets: bucket i holds
+// sizes in [2^i, 2^(i+1)), and the last bucket everything larger
+#define SIZE_HISTOGRAM_BUCKETS 24
+
+// Memory statistics structure
+typedef struct MemoryStats
+{
+    size_t total_allocated;
+    size_t total_freed;
+    size_t current_usage;
+    size_t peak_usage;
+    size_t allocation_count;
+    size_t free_count;
+    size_t arena_high_water; // most bytes any arena handed out between resets
+    size_t arena_last_use;   // bytes used by the most recently reset arena
+    size_t arena_resets;
+    size_t arena_held;       // payload bytes in chunks of live arenas
+    size_t size_histogram[SIZE_HISTOGRAM_BUCKETS]; // requested sizes
+    size_t searches;         // find_free_block calls
+    size_t search_steps;     // free blocks examined plus bitmap words scanned
+    size_t max_search_steps; // longest single search
+    size_t failed_searches;
+    size_t chunks_mapped;   // pool chunks mapped after the first
+    size_t chunks_released; // empty chunks unmapped
+    size_t large_mapped;    // dedicated mappings for large requests
+    size_t trims;           // MADV_DONTNEED calls
+    size_t trimmed_bytes;
+    // Filled in by get_memory_stats from the pool and its free lists
+    size_t mapped_bytes;
+    size_t pool_used_bytes;    // chunk bytes in blocks taken from the pool, cached ones included
+    size_t chunk_count;
+    size_t large_count;
+    size_t threads;            // threads with a block cache
+    size_t cached_blocks;      // free blocks held in thread caches
+    size_t free_bytes;         // payload bytes in free blocks
+    size_t free_blocks;
+    size_t largest_free_block; // largest free payload
+    double fragmentation;      // 1 - largest_free_block / free_bytes
+} MemoryStats;
+
+// Counters kept by each thread and merged when statistics are read.
+// Only the owning thread writes them.
+typedef struct ThreadStats
+{
+    size_t total_allocated;
+    size_t total_freed;
+    size_t allocation_count;
+    size_t free_count;
+    size_t arena_high_water;
+    size_t arena_last_use;
+    size_t arena_resets;
+    size_t arena_held; // payload bytes in chunks of live arenas
+    size_t size_histogram[SIZE_HISTOGRAM_BUCKETS];
+} ThreadStats;
+
+// Every allocated block records the call site that allocated it, as an
+// index into a table of sites, so leaks can be traced to their source.
+// Site 0 collects the sites that did not fit in the table.
+#define MAX_ALLOC_SITES 256
+
+typedef struct AllocSite
+{
+    const char *file; // NULL for an unused slot
+    int line;
+} AllocSite;
+
+// Blocks and payload bytes allocated at one site and not yet freed, and
+// how many of them are chunks of an arena that is still in use
+typedef struct SiteCounts
+{
+    size_t bytes;
+    size_t blocks;
+    size_t arena_bytes;
+    size_t arena_blocks;
+} SiteCounts;
+
+// Blocks of up to SMALL_CLASS_MAX bytes are allocated from and freed to
+// a cache private to each thread. It trades blocks with the pool in
+// batches, so the pool lock is taken once per CACHE_BATCH allocations.
+#define CACHE_BATCH 16
+#define CACHE_LIMIT 64 // a bin this full gives half its blocks back
+
+typedef struct ThreadCache
+{
+    struct ThreadCache *next; // caches of all live threads
+    struct ThreadCache *prev;
+    bool registered;
+    size_t cached; // blocks held in the bins
+    MemoryBlock *bins[SMALL_CLASS_COUNT]; // linked through next_free
+    uint32_t counts[SMALL_CLASS_COUNT];
+    ThreadStats stats;
+    SiteCounts sites[MAX_ALLOC_SITES]; // indexed like the site table
+} ThreadCache;
+
+// Arena (bump) allocator: chunks come from the pool, individual
+// allocations are never freed, and arena_reset releases them all at once
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+typedef struct Arena
+{
+    ArenaChunk *chunks; // current chunk first
+    size_t chunk_size;
+    size_t used; // bytes handed out since the last reset
+    size_t high_water;
+} Arena;
+
+// A position in an arena; releasing it frees everything allocated since
+typedef struct
+{
+    ArenaChunk *chunk;
+    size_t chunk_used;
+    size_t used;
+} ArenaMark;
+
+// Memory manager functions
+void init_memory_manager(size_t pool_size);
+void *shell_malloc_at(size_t size, const char *file, int line);
+void shell_free(void *ptr);
+void *shell_realloc_at(void *ptr, size_t new_size, const char *file, int line);
+void print_memory_stats(void);
+void print_memory_stats_json(void);
+void cleanup_memory_manager(void);
+
+// Allocations are tagged with the caller's file and line
+#define shell_malloc(size) shell_malloc_at((size), __FILE__, __LINE__)
+#define shell_realloc(ptr, new_size) shell_realloc_at((ptr), (new_size), __FILE__, __LINE__)
+
+// Arena functions. A chunk is tagged with the call site that made the
+// arena grow, and is not counted as a leak while the arena holds it.
+void arena_init(Arena *arena, size_t chunk_size);
+void *arena_alloc_at(Arena *arena, size_t size, const char *file, int line);
+char *arena_strdup_at(Arena *arena, const char *str, const char *file, int line);
+void arena_reset(Arena *arena);
+ArenaMark arena_mark(Arena *arena);
+void arena_release(Arena *arena, ArenaMark mark);
+void arena_destroy(Arena *arena);
+
+#define arena_alloc(arena, size) arena_alloc_at((arena), (size), __FILE__, __LINE__)
+#define arena_strdup(arena, str) arena_strdup_at((arena), (str), __FILE__, __LINE__)
+
+// Memory tracking functions
+MemoryStats get_memory_stats(void);
+void print_memory_blocks(void);
+bool check_memory_leaks(void);
+
 #endif // MEMORY_MANAGER_H
\ No newline at end of file
@@ -0,0 +1,473 @@
+#define _GNU_SOURCE // memfd_create
+#include "shell.h"
+#include <sys/mman.h>
+#include <time.h>
+
+// parallel: run one task per input line with at most N of them alive at
+// once. Tasks are ordinary jobs in the job table, so the usual SIGCHLD
+// reaping marks them done; the runner sleeps on the signal fd and starts
+// the next task as soon as one is reaped.
+//
+//   parallel [-j n] [-g] [-v] [-a file] [cmd [arg ...]]
+//
+// With a command, each line becomes one argument, replacing every `{}`
+// argument or appended when there is none. Without one, each line is
+// parsed as a pipeline.
+
+typedef struct
+{
+    Job *job;             // NULL while the slot is free
+    unsigned long number; // task number, counting from 1
+    int out_fd;           // -g: memfd collecting the task's stdout, else -1
+    int err_fd;           // -g: memfd collecting the task's stderr, else -1
+} TaskSlot;
+
+typedef struct
+{
+    int jobs;
+    int group;
+    int verbose;
+    const char *file;
+    char **command; // NULL: every line is a command line
+} ParallelOptions;
+
+// Argument lines are read in blocks and split in place; a returned line
+// stays valid until the next call
+typedef struct
+{
+    int fd;
+    char *buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    int eof;
+} TaskInput;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_options(char **args, ParallelOptions *options)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    options->jobs = cores > 0 ? (int)cores : 1;
+    options->group = 0;
+    options->verbose = 0;
+    options->file = NULL;
+    options->command = NULL;
+
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++)
+    {
+        if (strcmp(args[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+
+        for (const char *flag = args[i] + 1; *flag; flag++)
+        {
+            if (*flag == 'g')
+                options->group = 1;
+            else if (*flag == 'v')
+                options->verbose = 1;
+            else if (*flag == 'j' || *flag == 'a')
+            {
+                // The value is the rest of this word or the next one
+                const char *value = flag[1] ? flag + 1 : args[++i];
+                if (!value)
+                {
+                    fprintf(stderr, "parallel: -%c: option requires an argument\n", *flag);
+                    return -1;
+                }
+                if (*flag == 'a')
+                    options->file = value;
+                else if ((options->jobs = atoi(value)) < 1)
+                {
+                    fprintf(stderr, "parallel: %s: invalid job count\n", value);
+                    return -1;
+                }
+                break;
+            }
+            else
+            {
+                fprintf(stderr, "parallel: -%c: invalid option\n", *flag);
+                return -1;
+            }
+        }
+    }
+
+    if (args[i])
+        options->command = args + i;
+    return 0;
+}
+
+// Returns 1 with the next line, 0 at end of input, or -1 when a signal
+// was handled before a whole line arrived, so finished tasks can be
+// collected first
+static int next_line(TaskInput *input, char **line)
+{
+    for (;;)
+    {
+        char *start = input->buffer + input->start;
+        char *newline = memchr(start, '\n', input->end - input->start);
+        if (newline)
+        {
+            *newline = '\0';
+            *line = start;
+            input->start = newline + 1 - input->buffer;
+            return 1;
+        }
+
+        if (input->eof)
+        {
+            if (input->start == input->end)
+                return 0;
+
+            // Last line without a newline
+            input->buffer[input->end] = '\0';
+            *line = start;
+            input->start = input->end;
+            return 1;
+        }
+
+        // Keep the partial line, growing the buffer when it fills it
+        memmove(input->buffer, start, input->end - input->start);
+        input->end -= input->start;
+        input->start = 0;
+        if (input->end + 1 >= input->capacity)
+        {
+            char *buffer = shell_realloc(input->buffer, input->capacity * 2);
+            if (!buffer)
+            {
+                fprintf(stderr, "parallel: out of memory\n");
+                input->start = input->end = 0;
+                input->eof = 1;
+                continue;
+            }
+            input->buffer = buffer;
+            input->capacity *= 2;
+        }
+
+        if (!wait_for_fd(input->fd))
+            return -1;
+
+        ssize_t count = read(input->fd, input->buffer + input->end, input->capacity - input->end - 1);
+        if (count > 0)
+            input->end += count;
+        else if (count == 0 || (errno != EINTR && errno != EAGAIN))
+        {
+            if (count < 0)
+                perror("parallel");
+            input->eof = 1;
+        }
+    }
+}
+
+// The task's pipeline: the command with the line as an argument, or the
+// line itself parsed
+static Command *task_command(const ParallelOptions *options, char *line, Arena *arena)
+{
+    if (!options->command)
+    {
+        Command *cmd = parse_command(line, arena);
+        if (!cmd || !cmd->args[0])
+            return NULL;
+        if (cmd->list_next || cmd->background)
+        {
+            fprintf(stderr, "parallel: %s: only one foreground pipeline per line\n", cmd->args[0]);
+            return NULL;
+        }
+        return expand_pipeline(cmd, arena);
+    }
+
+    Command *cmd = new_command(arena);
+    if (!cmd)
+        return NULL;
+
+    int argc = 0;
+    int replaced = 0;
+    for (char **arg = options->command; *arg; arg++)
+    {
+        if (argc >= MAX_ARGS - 2)
+        {
+            fprintf(stderr, "parallel: %s: too many arguments\n", options->command[0]);
+            return NULL;
+        }
+        if (strcmp(*arg, "{}") == 0)
+        {
+            cmd->args[argc++] = line;
+            replaced = 1;
+        }
+        else
+            cmd->args[argc++] = *arg;
+    }
+    if (!replaced)
+        cmd->args[argc++] = line;
+    cmd->args[argc] = NULL;
+    return cmd;
+}
+
+static int start_task(const ParallelOptions *options, TaskSlot *slot, char *line, Arena *arena, int devnull)
+{
+    ArenaMark mark = arena_mark(arena);
+    Command *cmd = task_command(options, line, arena);
+    if (!cmd)
+    {
+        arena_release(arena, mark);
+        return -1;
+    }
+
+    PipelineIO io = {devnull, slot->out_fd, slot->err_fd};
+    pid_t pids[cmd->pipe_count + 1];
+    pid_t last_pid;
+    int last_status;
+    int started;
+    char command[MAX_INPUT_SIZE];
+
+    format_pipeline(cmd, command, sizeof(command));
+    pid_t pgid = start_pipeline(cmd, &io, pids, &started, &last_pid, &last_status);
+    arena_release(arena, mark);
+    if (pgid == 0)
+        return -1;
+
+    Job *job = add_job(pgid, pids, started, command, 0);
+    if (!job)
+    {
+        // Nothing would ever collect it
+        kill(-pgid, SIGTERM);
+        return -1;
+    }
+    job->status_pid = last_pid > 0 ? last_pid : 0;
+    if (!job->status_pid)
+        job->wait_status = W_EXITCODE(last_status, 0);
+    slot->job = job;
+    return 0;
+}
+
+// Copy what a grouped task wrote to its memfd out to `to`, then empty it
+// for the slot's next task
+static void flush_group(int fd, int to)
+{
+    char buffer[16 * 1024];
+    ssize_t count;
+
+    lseek(fd, 0, SEEK_SET);
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t done = 0; done < count;)
+        {
+            ssize_t written = write(to, buffer + done, count - done);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                count = 0;
+                break;
+            }
+            done += written;
+        }
+    }
+    if (ftruncate(fd, 0) == -1)
+        perror("parallel: ftruncate");
+    lseek(fd, 0, SEEK_SET);
+}
+
+// Report and free every slot whose task has been reaped; returns the
+// number of tasks that failed
+static unsigned long collect_tasks(const ParallelOptions *options, TaskSlot *slots, int *running)
+{
+    unsigned long failed = 0;
+
+    for (int i = 0; i < options->jobs; i++)
+    {
+        Job *job = slots[i].job;
+        if (!job)
+            continue;
+
+        // Nothing here can resume a stopped task later
+        if (job->status == STOPPED)
+        {
+            job->status = RUNNING;
+            kill(-job->pid, SIGCONT);
+            continue;
+        }
+        if (job->status != DONE)
+            continue;
+
+        int status = exit_status_from_wait(job->wait_status);
+        if (options->group)
+        {
+            flush_group(slots[i].out_fd, STDOUT_FILENO);
+            flush_group(slots[i].err_fd, STDERR_FILENO);
+        }
+        if (status != 0 || options->verbose)
+            fprintf(stderr, "parallel: task %lu exited %d: %s\n", slots[i].number, status, job->command);
+        if (status != 0)
+            failed++;
+
+        remove_job(job->job_id);
+        slots[i].job = NULL;
+        (*running)--;
+    }
+    return failed;
+}
+
+static TaskSlot *free_slot(const ParallelOptions *options, TaskSlot *slots)
+{
+    for (int i = 0; i < options->jobs; i++)
+    {
+        if (!slots[i].job)
+            return &slots[i];
+    }
+    return NULL;
+}
+
+static int open_groups(const ParallelOptions *options, TaskSlot *slots)
+{
+    for (int i = 0; i < options->jobs; i++)
+    {
+        slots[i].job = NULL;
+        slots[i].out_fd = -1;
+        slots[i].err_fd = -1;
+        if (options->group &&
+            ((slots[i].out_fd = memfd_create("parallel-out", MFD_CLOEXEC)) == -1 ||
+             (slots[i].err_fd = memfd_create("parallel-err", MFD_CLOEXEC)) == -1))
+        {
+            perror("parallel: memfd_create");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void close_groups(const ParallelOptions *options, TaskSlot *slots)
+{
+    for (int i = 0; i < options->jobs; i++)
+    {
+        if (slots[i].out_fd != -1)
+            close(slots[i].out_fd);
+        if (slots[i].err_fd != -1)
+            close(slots[i].err_fd);
+    }
+}
+
+static int interrupted(void)
+{
+    return command_interrupted || !shell_running;
+}
+
+int shell_parallel(char **args)
+{
+    ParallelOptions options;
+    if (parse_options(args, &options) != 0)
+        return 2;
+
+    TaskInput input = {STDIN_FILENO, NULL, INPUT_BLOCK_SIZE, 0, 0, 0};
+    if (options.file && (input.fd = open(options.file, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        perror(options.file);
+        return 1;
+    }
+
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    TaskSlot *slots = shell_malloc(options.jobs * sizeof(TaskSlot));
+    input.buffer = shell_malloc(input.capacity);
+    if (!slots || !input.buffer || devnull == -1 || open_groups(&options, slots) != 0)
+    {
+        if (!slots || !input.buffer)
+            fprintf(stderr, "parallel: out of memory\n");
+        else if (devnull == -1)
+            perror("/dev/null");
+        else
+            close_groups(&options, slots);
+        shell_free(slots);
+        shell_free(input.buffer);
+        if (devnull != -1)
+            close(devnull);
+        if (options.file)
+            close(input.fd);
+        return 1;
+    }
+
+    sigset_t saved_mask;
+    block_shell_signals(&saved_mask);
+
+    // Ctrl+C sets command_interrupted, as it does for a loop
+    loop_depth++;
+
+    Arena arena;
+    arena_init(&arena, COMMAND_ARENA_SIZE);
+
+    unsigned long tasks = 0;
+    unsigned long failed = 0;
+    int running = 0;
+    int input_done = 0;
+    int stopping = 0;
+    double start = now_seconds();
+
+    for (;;)
+    {
+        failed += collect_tasks(&options, slots, &running);
+
+        if (interrupted() && !stopping)
+        {
+            stopping = 1;
+            input_done = 1;
+            for (int i = 0; i < options.jobs; i++)
+            {
+                if (slots[i].job)
+                    kill(-slots[i].job->pid, SIGINT);
+            }
+        }
+
+        // Refill free slots until the input runs dry or a signal needs handling
+        while (!input_done && running < options.jobs)
+        {
+            char *line;
+            int result = next_line(&input, &line);
+            if (result == 0)
+                input_done = 1;
+            if (result <= 0)
+                break;
+            if (line[strspn(line, " \t\r")] == '\0')
+                continue;
+
+            TaskSlot *slot = free_slot(&options, slots);
+            slot->number = ++tasks;
+            if (start_task(&options, slot, line, &arena, devnull) == 0)
+                running++;
+            else
+            {
+                fprintf(stderr, "parallel: task %lu could not be started: %s\n", slot->number, line);
+                failed++;
+            }
+        }
+
+        if (running == 0 && input_done)
+            break;
+        if (running == options.jobs || input_done)
+            wait_for_signal();
+    }
+
+    double elapsed = now_seconds() - start;
+    fprintf(stderr, "parallel: %lu tasks, %lu failed, %.3fs wall\n", tasks, failed, elapsed);
+
+    arena_destroy(&arena);
+    loop_depth--;
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+
+    close_groups(&options, slots);
+    shell_free(slots);
+    shell_free(input.buffer);
+    close(devnull);
+    if (options.file)
+        close(input.fd);
+
+    if (stopping)
+        return 128 + SIGINT;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,439 @@
+#include "shell.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int parse_errors_quiet = 0; // set while compiling a script ahead of running it
+
+static void parse_error(const char *format, ...)
+{
+    if (parse_errors_quiet)
+        return;
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+// Bytes that end or change the meaning of an unquoted word
+static const char word_specials[] = " \t\r\n|<>&;$'\"\\*?[{";
+static unsigned char special_table[256];
+
+static void init_special_table(void)
+{
+    if (special_table[' '])
+        return;
+    for (const char *c = word_specials; *c; c++)
+        special_table[(unsigned char)*c] = 1;
+}
+
+// Length of the run of ordinary bytes at the start of text
+static size_t scan_word(const char *text, size_t len)
+{
+    size_t pos = 0;
+
+#ifdef __SSE2__
+    // Sixteen bytes per step, one compare per special byte
+    while (pos + 16 <= len)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + pos));
+        __m128i hits = _mm_setzero_si128();
+        for (const char *c = word_specials; *c; c++)
+        {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(*c)));
+        }
+        int mask = _mm_movemask_epi8(hits);
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+#endif
+
+    while (pos < len && !special_table[(unsigned char)text[pos]])
+        pos++;
+    return pos;
+}
+
+// Append a token, doubling the arena-backed array when it fills up
+static int push_token(TokenList *list, Arena *arena, TokenType type, size_t offset, size_t length, int expand)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 32;
+        Token *tokens = arena_alloc(arena, capacity * sizeof(Token));
+        if (!tokens)
+        {
+            fprintf(stderr, "parse: out of memory\n");
+            return -1;
+        }
+        if (list->count)
+            memcpy(tokens, list->tokens, list->count * sizeof(Token));
+        list->tokens = tokens;
+        list->capacity = capacity;
+    }
+
+    Token *token = &list->tokens[list->count++];
+    token->type = type;
+    token->offset = offset;
+    token->length = length;
+    token->expand = expand;
+    return 0;
+}
+
+// A '$' expands only before a name, '?' or '{'; any other one is literal
+static int starts_expansion(const char *line, size_t in, size_t len)
+{
+    char c = in + 1 < len ? line[in + 1] : '\0';
+    return isalpha((unsigned char)c) || c == '_' || c == '?' || c == '{';
+}
+
+// Inside an unquoted brace, commas and closing braces are markers too.
+// Returns the brace depth at the end of the text.
+static int mark_braces(char *text, size_t length, int depth)
+{
+    for (size_t i = 0; i < length && depth > 0; i++)
+    {
+        if (text[i] == ',')
+            text[i] = BRACE_COMMA;
+        else if (text[i] == '}')
+        {
+            text[i] = BRACE_CLOSE;
+            depth--;
+        }
+    }
+    return depth;
+}
+
+// Lex one word starting at *pos, removing quotes and escapes in place.
+// The unquoted text never grows, so it is compacted towards the start.
+// A '$' that should expand is replaced by EXPAND_MARKER, and unquoted
+// glob and brace characters by their markers, so quoted and escaped ones
+// stay literal.
+static int lex_word(char *line, size_t len, size_t *pos, size_t *length, int *expand)
+{
+    size_t start = *pos;
+    size_t in = start;
+    size_t out = start;
+    int braces = 0;
+
+    for (;;)
+    {
+        size_t run = scan_word(line + in, len - in);
+        if (out != in)
+            memmove(line + out, line + in, run);
+        if (braces)
+            braces = mark_braces(line + out, run, braces);
+        in += run;
+        out += run;
+        if (in >= len)
+            break;
+
+        char c = line[in];
+        if (c == '$' && !starts_expansion(line, in, len))
+        {
+            line[out++] = line[in++];
+        }
+        else if (c == '$')
+        {
+            line[out++] = EXPAND_MARKER;
+            *expand = 1;
+            in++;
+
+            // Neither $? nor the braces of ${name} are glob characters
+            if (in < len && line[in] == '?')
+                line[out++] = line[in++];
+            else if (in < len && line[in] == '{')
+            {
+                line[out++] = line[in++];
+                while (in < len && (isalnum((unsigned char)line[in]) || line[in] == '_'))
+                    line[out++] = line[in++];
+                if (in < len && line[in] == '}')
+                    line[out++] = line[in++];
+            }
+        }
+        else if (c == '*' || c == '?' || c == '[' || c == '{')
+        {
+            line[out++] = c == '*' ? GLOB_STAR : c == '?' ? GLOB_ANY : c == '[' ? GLOB_CLASS : BRACE_OPEN;
+            braces += c == '{';
+            *expand = 1;
+            in++;
+        }
+        else if (c == '\\')
+        {
+            // A backslash quotes the next byte; a trailing one is dropped
+            if (in + 1 < len)
+                line[out++] = line[in + 1];
+            in += in + 1 < len ? 2 : 1;
+        }
+        else if (c == '\'')
+        {
+            // Everything up to the closing quote is literal
+            char *close = memchr(line + in + 1, '\'', len - in - 1);
+            if (!close)
+            {
+                parse_error("syntax error: unterminated quote\n");
+                return -1;
+            }
+            size_t n = close - (line + in + 1);
+            memmove(line + out, line + in + 1, n);
+            out += n;
+            in = close - line + 1;
+        }
+        else if (c == '"')
+        {
+            // Only \\, \", \$ and \` are escapes inside double quotes
+            in++;
+            while (in < len && line[in] != '"')
+            {
+                if (line[in] == '$' && starts_expansion(line, in, len))
+                {
+                    line[out++] = EXPAND_MARKER;
+                    *expand = 1;
+                    in++;
+                    continue;
+                }
+                if (line[in] == '\\' && in + 1 < len && strchr("\\\"$`", line[in + 1]))
+                    in++;
+                line[out++] = line[in++];
+            }
+            if (in >= len)
+            {
+                parse_error("syntax error: unterminated quote\n");
+                return -1;
+            }
+            in++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    *pos = in;
+    *length = out - start;
+    return 0;
+}
+
+int tokenize(char *line, size_t len, Arena *arena, TokenList *list)
+{
+    size_t pos = 0;
+
+    init_special_table();
+    memset(list, 0, sizeof(TokenList));
+
+    while (pos < len)
+    {
+        char c = line[pos];
+        TokenType type;
+        size_t length = 1;
+
+        switch (c)
+        {
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            pos++;
+            continue;
+        case '#':
+            // Comments run to the end of the line
+            return 0;
+        case '|':
+            type = TOKEN_PIPE;
+            break;
+        case '<':
+            type = TOKEN_INPUT;
+            break;
+        case '>':
+            type = TOKEN_OUTPUT;
+            if (pos + 1 < len && line[pos + 1] == '>')
+            {
+                type = TOKEN_APPEND;
+                length = 2;
+            }
+            break;
+        case '&':
+            type = TOKEN_BACKGROUND;
+            break;
+        case ';':
+            type = TOKEN_SEPARATOR;
+            break;
+        default:
+        {
+            size_t start = pos;
+            int expand = 0;
+            if (lex_word(line, len, &pos, &length, &expand) != 0)
+                return -1;
+            if (push_token(list, arena, TOKEN_WORD, start, length, expand) != 0)
+                return -1;
+            continue;
+        }
+        }
+
+        if (push_token(list, arena, type, pos, length, 0) != 0)
+            return -1;
+        pos += length;
+    }
+    return 0;
+}
+
+static const char *token_text(TokenType type)
+{
+    switch (type)
+    {
+    case TOKEN_PIPE:
+        return "|";
+    case TOKEN_INPUT:
+        return "<";
+    case TOKEN_OUTPUT:
+        return ">";
+    case TOKEN_APPEND:
+        return ">>";
+    case TOKEN_BACKGROUND:
+        return "&";
+    case TOKEN_SEPARATOR:
+        return ";";
+    default:
+        return "newline";
+    }
+}
+
+Command *new_command(Arena *arena)
+{
+    // The argument slots follow the command in the same allocation
+    Command *cmd = arena_alloc(arena, sizeof(Command) + MAX_ARGS * sizeof(char *));
+    if (!cmd)
+    {
+        fprintf(stderr, "parse: out of memory\n");
+        return NULL;
+    }
+
+    // args is terminated when the stage is closed, so skip clearing it
+    cmd->type = COMMAND_PIPELINE;
+    cmd->args = (char **)(cmd + 1);
+    cmd->args[0] = NULL;
+    cmd->input_file = NULL;
+    cmd->output_file = NULL;
+    cmd->append_output = 0;
+    cmd->background = 0;
+    cmd->pipe_count = 0;
+    cmd->expand = 0;
+    cmd->next = NULL;
+    cmd->condition = NULL;
+    cmd->body = NULL;
+    cmd->else_body = NULL;
+    cmd->list_next = NULL;
+    return cmd;
+}
+
+// Parses a line into pipelines separated by ';' or '&', linked through
+// list_next. A blank line yields a single pipeline with no arguments.
+Command *parse_command(char *line, Arena *arena)
+{
+    TokenList list;
+    if (tokenize(line, strlen(line), arena, &list) != 0)
+        return NULL;
+
+    // Words become strings in place once every operator has been seen
+    for (size_t i = 0; i < list.count; i++)
+    {
+        if (list.tokens[i].type == TOKEN_WORD)
+            line[list.tokens[i].offset + list.tokens[i].length] = '\0';
+    }
+
+    Command *first = new_command(arena);
+    if (!first)
+        return NULL;
+    Command *head = first;
+    Command *stage = first;
+    int argc = 0;
+
+    for (size_t i = 0; i < list.count; i++)
+    {
+        Token *token = &list.tokens[i];
+        switch (token->type)
+        {
+        case TOKEN_WORD:
+            if (argc >= MAX_ARGS - 1)
+            {
+                parse_error("%s: too many arguments\n", stage->args[0]);
+                return NULL;
+            }
+            stage->args[argc++] = line + token->offset;
+            stage->expand |= token->expand;
+            break;
+
+        case TOKEN_INPUT:
+        case TOKEN_OUTPUT:
+        case TOKEN_APPEND:
+        {
+            Token *target = i + 1 < list.count ? &list.tokens[i + 1] : NULL;
+            if (!target || target->type != TOKEN_WORD)
+            {
+                parse_error("syntax error near unexpected token '%s'\n",
+                            token_text(target ? target->type : TOKEN_WORD));
+                return NULL;
+            }
+            if (token->type == TOKEN_INPUT)
+                stage->input_file = line + target->offset;
+            else
+            {
+                stage->output_file = line + target->offset;
+                stage->append_output = token->type == TOKEN_APPEND;
+            }
+            stage->expand |= target->expand;
+            i++;
+            break;
+        }
+
+        case TOKEN_PIPE:
+            // Every stage of a real pipeline needs a command
+            if (argc == 0 || i + 1 == list.count)
+            {
+                parse_error("syntax error near unexpected token '|'\n");
+                return NULL;
+            }
+            stage->args[argc] = NULL;
+            stage->next = new_command(arena);
+            if (!stage->next)
+                return NULL;
+            stage = stage->next;
+            head->pipe_count++;
+            argc = 0;
+            break;
+
+        case TOKEN_BACKGROUND:
+        case TOKEN_SEPARATOR:
+            // Both end the pipeline; '&' also runs it in the background
+            if (argc == 0 && !stage->input_file && !stage->output_file)
+            {
+                parse_error("syntax error near unexpected token '%s'\n",
+                            token_text(head->pipe_count > 0 ? TOKEN_PIPE : token->type));
+                return NULL;
+            }
+            head->background = token->type == TOKEN_BACKGROUND;
+            stage->args[argc] = NULL;
+            if (i + 1 < list.count)
+            {
+                head->list_next = new_command(arena);
+                if (!head->list_next)
+                    return NULL;
+                head = stage = head->list_next;
+                argc = 0;
+            }
+            break;
+        }
+    }
+
+    if (argc == 0 && head->pipe_count > 0)
+    {
+        parse_error("syntax error near unexpected token '|'\n");
+        return NULL;
+    }
+    stage->args[argc] = NULL;
+    return first;
+}
@@ -0,0 +1,275 @@
+#include "shell.h"
+#include <sys/stat.h>
+
+// Hash table mapping command names to their resolved absolute paths, so
+// repeated commands skip the $PATH walk that execvp would do
+typedef struct PathCacheEntry
+{
+    struct PathCacheEntry *next;
+    unsigned int hash;
+    unsigned int hits;
+    char *path;  // points into the same allocation, after name
+    char name[];
+} PathCacheEntry;
+
+#define PATH_CACHE_INITIAL_BUCKETS 64
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+static PathCacheEntry **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+static char *cached_path_env = NULL; // $PATH the entries were resolved against
+
+// FNV-1a
+static unsigned int hash_name(const char *name)
+{
+    unsigned int hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int init_buckets(size_t count)
+{
+    buckets = shell_malloc(count * sizeof(PathCacheEntry *));
+    if (!buckets)
+    {
+        bucket_count = 0;
+        return -1;
+    }
+    memset(buckets, 0, count * sizeof(PathCacheEntry *));
+    bucket_count = count;
+    return 0;
+}
+
+static void grow_buckets(void)
+{
+    PathCacheEntry **old_buckets = buckets;
+    size_t old_count = bucket_count;
+
+    if (init_buckets(old_count * 2) != 0)
+    {
+        // Keep the old table; lookups still work, just with longer chains
+        buckets = old_buckets;
+        bucket_count = old_count;
+        return;
+    }
+
+    for (size_t i = 0; i < old_count; i++)
+    {
+        PathCacheEntry *entry = old_buckets[i];
+        while (entry)
+        {
+            PathCacheEntry *next = entry->next;
+            size_t slot = entry->hash & (bucket_count - 1);
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+    shell_free(old_buckets);
+}
+
+static PathCacheEntry *find_entry(const char *name, unsigned int hash)
+{
+    if (!buckets)
+        return NULL;
+
+    for (PathCacheEntry *entry = buckets[hash & (bucket_count - 1)]; entry; entry = entry->next)
+    {
+        if (entry->hash == hash && strcmp(entry->name, name) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static PathCacheEntry *insert_entry(const char *name, unsigned int hash, const char *path)
+{
+    if (!buckets && init_buckets(PATH_CACHE_INITIAL_BUCKETS) != 0)
+        return NULL;
+
+    size_t name_len = strlen(name) + 1;
+    size_t path_len = strlen(path) + 1;
+    PathCacheEntry *entry = shell_malloc(sizeof(PathCacheEntry) + name_len + path_len);
+    if (!entry)
+        return NULL;
+
+    entry->hash = hash;
+    entry->hits = 0;
+    memcpy(entry->name, name, name_len);
+    entry->path = entry->name + name_len;
+    memcpy(entry->path, path, path_len);
+
+    size_t slot = hash & (bucket_count - 1);
+    entry->next = buckets[slot];
+    buckets[slot] = entry;
+
+    if (++entry_count > bucket_count * 3 / 4)
+    {
+        grow_buckets();
+    }
+    return entry;
+}
+
+// Walk $PATH the way execvp does; writes the first executable match to `out`
+static int search_path(const char *name, const char *path_env, char *out, size_t out_size)
+{
+    const char *dir = path_env;
+    while (dir)
+    {
+        const char *colon = strchr(dir, ':');
+        size_t dir_len = colon ? (size_t)(colon - dir) : strlen(dir);
+        struct stat st;
+
+        // An empty entry means the current directory
+        if (dir_len == 0)
+            snprintf(out, out_size, "%s", name);
+        else
+            snprintf(out, out_size, "%.*s/%s", (int)dir_len, dir, name);
+
+        if (stat(out, &st) == 0 && S_ISREG(st.st_mode) && access(out, X_OK) == 0)
+        {
+            return 0;
+        }
+        dir = colon ? colon + 1 : NULL;
+    }
+    return -1;
+}
+
+// Drop the cache if $PATH no longer matches the one the entries came from
+static void check_path_env(const char *path_env)
+{
+    if (cached_path_env && strcmp(cached_path_env, path_env) == 0)
+        return;
+
+    path_cache_reset();
+
+    size_t len = strlen(path_env) + 1;
+    cached_path_env = shell_malloc(len);
+    if (cached_path_env)
+    {
+        memcpy(cached_path_env, path_env, len);
+    }
+}
+
+const char *path_cache_lookup(const char *name)
+{
+    // Names with a slash are never searched for in $PATH
+    if (!name || !*name || strchr(name, '/'))
+        return NULL;
+
+    const char *path_env = getenv("PATH");
+    if (!path_env)
+        path_env = DEFAULT_PATH;
+    check_path_env(path_env);
+
+    unsigned int hash = hash_name(name);
+    PathCacheEntry *entry = find_entry(name, hash);
+    if (entry)
+    {
+        entry->hits++;
+        return entry->path;
+    }
+
+    char path[MAX_INPUT_SIZE];
+    if (search_path(name, path_env, path, sizeof(path)) != 0)
+        return NULL;
+
+    entry = insert_entry(name, hash, path);
+    if (!entry)
+        return NULL;
+    entry->hits = 1;
+    return entry->path;
+}
+
+void path_cache_reset(void)
+{
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        PathCacheEntry *entry = buckets[i];
+        while (entry)
+        {
+            PathCacheEntry *next = entry->next;
+            shell_free(entry);
+            entry = next;
+        }
+    }
+    shell_free(buckets);
+    shell_free(cached_path_env);
+    buckets = NULL;
+    bucket_count = 0;
+    entry_count = 0;
+    cached_path_env = NULL;
+}
+
+void path_cache_chdir(void)
+{
+    // Entries found through a relative $PATH entry depend on the old cwd
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        PathCacheEntry **link = &buckets[i];
+        while (*link)
+        {
+            PathCacheEntry *entry = *link;
+            if (entry->path[0] != '/')
+            {
+                *link = entry->next;
+                shell_free(entry);
+                entry_count--;
+            }
+            else
+            {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+int shell_hash(char **args)
+{
+    if (!args[1])
+    {
+        if (entry_count == 0)
+        {
+            printf("hash: hash table empty\n");
+            return 0;
+        }
+        printf("hits\tcommand\n");
+        for (size_t i = 0; i < bucket_count; i++)
+        {
+            for (PathCacheEntry *entry = buckets[i]; entry; entry = entry->next)
+            {
+                printf("%4u\t%s\n", entry->hits, entry->path);
+            }
+        }
+        return 0;
+    }
+
+    if (strcmp(args[1], "-r") == 0)
+    {
+        path_cache_reset();
+        return 0;
+    }
+
+    // Pre-seed the cache with each named command
+    int status = 0;
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        const char *path = path_cache_lookup(args[i]);
+        if (!path)
+        {
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+            status = 1;
+            continue;
+        }
+
+        // Seeding is not a use of the command
+        find_entry(args[i], hash_name(args[i]))->hits--;
+    }
+    return status;
+}
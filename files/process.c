@@ -1,263 +1,814 @@
-#include "shell.h"
-
-pid_t create_process(Command *cmd)
-{
-    // Explicitly mark parameter as unused
-    (void)cmd;
-    return fork();
-}
-
-void wait_for_process(pid_t pid)
-{
-    int status;
-    // Wait for either process termination or stop
-    while (waitpid(pid, &status, WUNTRACED) > 0)
-    {
-        if (WIFSTOPPED(status))
-        {
-            // Process was stopped, break the wait
-            break;
-        }
-        else if (WIFEXITED(status) || WIFSIGNALED(status))
-        {
-            // Process terminated
-            break;
-        }
-    }
-}
-
-void handle_background_process(pid_t pid, const char *command)
-{
-    add_job(pid, command);
-}
-
-int setup_io_redirection(Command *cmd)
-{
-    int fd;
-
-    // Handle input redirection
-    if (strlen(cmd->input_file) > 0)
-    {
-        fd = open(cmd->input_file, O_RDONLY);
-        if (fd == -1)
-        {
-            perror("open");
-            return -1;
-        }
-        if (dup2(fd, STDIN_FILENO) == -1)
-        {
-            perror("dup2");
-            close(fd);
-            return -1;
-        }
-        close(fd);
-    }
-
-    // Handle output redirection
-    if (strlen(cmd->output_file) > 0)
-    {
-        int flags = O_WRONLY | O_CREAT;
-        if (cmd->append_output)
-        {
-            flags |= O_APPEND;
-        }
-        else
-        {
-            flags |= O_TRUNC;
-        }
-
-        fd = open(cmd->output_file, flags, 0644);
-        if (fd == -1)
-        {
-            perror("open");
-            return -1;
-        }
-        if (dup2(fd, STDOUT_FILENO) == -1)
-        {
-            perror("dup2");
-            close(fd);
-            return -1;
-        }
-        close(fd);
-    }
-
-    return 0;
-}
-
-void reset_io_redirection(int stdin_copy, int stdout_copy)
-{
-    if (dup2(stdin_copy, STDIN_FILENO) == -1)
-    {
-        perror("dup2");
-    }
-    if (dup2(stdout_copy, STDOUT_FILENO) == -1)
-    {
-        perror("dup2");
-    }
-    close(stdin_copy);
-    close(stdout_copy);
-}
-
-int shell_jobs(void)
-{
-    print_jobs();
-    return 1;
-}
-
-void add_job(pid_t pid, const char *command)
-{
-    int i;
-    // First check if the process is already in jobs list
-    for (i = 0; i < MAX_JOBS; i++)
-    {
-        if (jobs[i].pid == pid)
-        {
-            // Update existing job
-            jobs[i].status = STOPPED;
-            return;
-        }
-    }
-
-    // If not found, find an empty slot
-    for (i = 0; i < MAX_JOBS; i++)
-    {
-        if (jobs[i].status == DONE)
-        {
-            jobs[i].pid = pid;
-            jobs[i].job_id = i + 1;
-            strncpy(jobs[i].command, command, MAX_INPUT_SIZE - 1);
-            jobs[i].command[MAX_INPUT_SIZE - 1] = '\0';
-            jobs[i].status = RUNNING;
-            job_count++;
-            if (jobs[i].status == RUNNING)
-            {
-                printf("[%d] %d %s &\n", jobs[i].job_id, pid, command);
-            }
-            return;
-        }
-    }
-    fprintf(stderr, "Maximum number of jobs reached\n");
-}
-
-void remove_job(int job_id)
-{
-    for (int i = 0; i < MAX_JOBS; i++)
-    {
-        if (jobs[i].job_id == job_id)
-        {
-            jobs[i].pid = 0;
-            jobs[i].job_id = 0;
-            jobs[i].status = DONE;
-            jobs[i].command[0] = '\0';
-            job_count--;
-            return;
-        }
-    }
-}
-
-void print_jobs(void)
-{
-    int found = 0;
-    for (int i = 0; i < MAX_JOBS; i++)
-    {
-        if (jobs[i].status == RUNNING || jobs[i].status == STOPPED)
-        {
-            printf("[%d] %s %s\n",
-                   jobs[i].job_id,
-                   jobs[i].status == RUNNING ? "Running" : "Stopped",
-                   jobs[i].command);
-            found = 1;
-        }
-    }
-    if (!found)
-    {
-        printf("No active jobs\n");
-    }
-}
-
-int shell_fg(char **args)
-{
-    if (!args[1])
-    {
-        fprintf(stderr, "fg: job id required\n");
-        return 1;
-    }
-
-    int job_id = atoi(args[1]);
-    for (int i = 0; i < MAX_JOBS; i++)
-    {
-        if (jobs[i].job_id == job_id && jobs[i].status != DONE)
-        {
-            pid_t pid = jobs[i].pid;
-
-            // Continue the process if it was stopped
-            if (jobs[i].status == STOPPED)
-            {
-                kill(pid, SIGCONT);
-                printf("%s\n", jobs[i].command);
-            }
-
-            // Wait for the process
-            wait_for_process(pid);
-            remove_job(job_id);
-            return 1;
-        }
-    }
-
-    fprintf(stderr, "fg: job %d not found\n", job_id);
-    return 1;
-}
-
-int shell_bg(char **args)
-{
-    if (!args[1])
-    {
-        fprintf(stderr, "bg: job id required\n");
-        return 1;
-    }
-
-    int job_id = atoi(args[1]);
-    for (int i = 0; i < MAX_JOBS; i++)
-    {
-        if (jobs[i].job_id == job_id && jobs[i].status == STOPPED)
-        {
-            kill(jobs[i].pid, SIGCONT);
-            jobs[i].status = RUNNING;
-            printf("[%d] %s &\n", job_id, jobs[i].command);
-            return 1;
-        }
-    }
-
-    fprintf(stderr, "bg: job %d not found\n", job_id);
-    return 1;
-}
-
-void update_job_status(void)
-{
-    int status;
-    pid_t pid;
-
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0)
-    {
-        for (int i = 0; i < MAX_JOBS; i++)
-        {
-            if (jobs[i].pid == pid)
-            {
-                if (WIFSTOPPED(status))
-                {
-                    jobs[i].status = STOPPED;
-                    printf("[%d] Stopped %s\n", jobs[i].job_id, jobs[i].command);
-                }
-                else if (WIFEXITED(status) || WIFSIGNALED(status))
-                {
-                    if (jobs[i].status != DONE)
-                    {
-                        printf("[%d] Done %s\n", jobs[i].job_id, jobs[i].command);
-                        remove_job(jobs[i].job_id);
-                    }
-                }
-                break;
-            }
-        }
-    }
-}
\ No newline at end of file
+#include "shell.h"
+#include <spawn.h>
+#include <sys/resource.h>
+
+extern char **environ;
+
+// Cleared by MYSHELL_NO_SPAWN to force the fork path
+int spawn_enabled = 1;
+
+// Set in forked pipeline stages, where a builtin may exec outright
+int in_pipeline_stage = 0;
+
+void give_terminal_to(pid_t pgid)
+{
+    if (shell_is_interactive && tcsetpgrp(STDIN_FILENO, pgid) == -1)
+    {
+        perror("tcsetpgrp");
+    }
+}
+
+// Runs inside the forked child for one pipeline stage; never returns.
+// `path` is the stage's cached location, or NULL to let execvp search.
+static void run_stage(Command *stage, const char *path)
+{
+    // Reset signal handlers in child
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    in_pipeline_stage = 1;
+
+    // Explicit redirections override the pipe ends
+    if (setup_io_redirection(stage) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    int builtin_status = execute_builtin(stage);
+    if (builtin_status != -1)
+    {
+        exit(builtin_status);
+    }
+
+    if (path)
+    {
+        execv(path, stage->args);
+
+        // The cached file went away; fall back to a full search
+        if (errno != ENOENT)
+        {
+            perror("execv");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    execvp(stage->args[0], stage->args);
+    perror("execvp");
+    exit(errno == ENOENT ? 127 : 126);
+}
+
+// Build posix_spawn file actions and attributes equivalent to what the
+// fork path does by hand, so the child never duplicates our address space
+static pid_t spawn_process(Command *stage, const ProcessSetup *setup)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    pid_t pid = -1;
+    int err;
+
+    posix_spawn_file_actions_init(&actions);
+    if (setup->in_fd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, setup->in_fd, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, setup->in_fd);
+    }
+    if (setup->out_fd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, setup->out_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, setup->out_fd);
+    }
+    if (setup->err_fd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, setup->err_fd, STDERR_FILENO);
+    }
+    if (setup->close_fd != -1)
+    {
+        posix_spawn_file_actions_addclose(&actions, setup->close_fd);
+    }
+
+    // Explicit redirections override the pipe ends. They are opened here,
+    // so a missing file is reported as such rather than as a failed exec.
+    int in_file = -1;
+    int out_file = -1;
+    if (stage->input_file && (in_file = open_redirection(stage->input_file, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        posix_spawn_file_actions_destroy(&actions);
+        *setup->start_status = 1;
+        return -1;
+    }
+    if (stage->output_file)
+    {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (stage->append_output ? O_APPEND : O_TRUNC);
+        if ((out_file = open_redirection(stage->output_file, flags)) == -1)
+        {
+            if (in_file != -1)
+                close(in_file);
+            posix_spawn_file_actions_destroy(&actions);
+            *setup->start_status = 1;
+            return -1;
+        }
+    }
+    if (in_file != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, in_file, STDIN_FILENO);
+    }
+    if (out_file != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, out_file, STDOUT_FILENO);
+    }
+
+    // Default dispositions for the signals the shell handles or ignores
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGTTOU);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, setup->pgid);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, setup->sigmask);
+
+    err = setup->path ? posix_spawn(&pid, setup->path, &actions, &attr, stage->args, environ) : ENOENT;
+
+    // No cached location, or the cached file went away; fall back to a full
+    // search. Nothing else in the file actions can fail with ENOENT.
+    if (err == ENOENT)
+    {
+        err = posix_spawnp(&pid, stage->args[0], &actions, &attr, stage->args, environ);
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (in_file != -1)
+        close(in_file);
+    if (out_file != -1)
+        close(out_file);
+
+    if (err != 0)
+    {
+        fprintf(stderr, "%s: %s\n", stage->args[0], strerror(err));
+        *setup->start_status = err == ENOENT ? 127 : 126;
+        return -1;
+    }
+    return pid;
+}
+
+pid_t create_process(Command *stage, const ProcessSetup *setup)
+{
+    // Builtins have to run shell code in the child, which spawn cannot do
+    if (spawn_enabled && !is_builtin(stage->args[0]))
+    {
+        return spawn_process(stage, setup);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Child process: join the pipeline's process group
+        setpgid(0, setup->pgid);
+        sigprocmask(SIG_SETMASK, setup->sigmask, NULL);
+
+        if (setup->in_fd != -1)
+        {
+            dup2(setup->in_fd, STDIN_FILENO);
+            close(setup->in_fd);
+        }
+        if (setup->out_fd != -1)
+        {
+            dup2(setup->out_fd, STDOUT_FILENO);
+            close(setup->out_fd);
+        }
+        if (setup->err_fd != -1)
+        {
+            dup2(setup->err_fd, STDERR_FILENO);
+        }
+        if (setup->close_fd != -1)
+        {
+            close(setup->close_fd);
+        }
+        run_stage(stage, setup->path);
+    }
+    else if (pid < 0)
+    {
+        perror("fork");
+    }
+    return pid;
+}
+
+// The command line shown by jobs and in job notifications
+void format_pipeline(const Command *cmd, char *buffer, size_t size)
+{
+    buffer[0] = '\0';
+    for (const Command *stage = cmd; stage; stage = stage->next)
+    {
+        for (int i = 0; stage->args[i] != NULL; i++)
+        {
+            if (buffer[0] != '\0')
+                strncat(buffer, " ", size - strlen(buffer) - 1);
+            strncat(buffer, stage->args[i], size - strlen(buffer) - 1);
+        }
+        if (stage->next)
+            strncat(buffer, " |", size - strlen(buffer) - 1);
+    }
+}
+
+// Start every stage of a pipeline in a new process group and record their
+// pids. Returns the group id, or 0 if nothing could be started.
+pid_t start_pipeline(Command *cmd, const PipelineIO *io, pid_t *pids, int *started, pid_t *last_pid,
+                     int *last_status)
+{
+    pid_t pgid = 0;
+    int prev_read = -1;
+    int fds[2];
+
+    *started = 0;
+    *last_pid = 0;
+    *last_status = 127;
+
+    // Children inherit unflushed stdio buffers
+    fflush(stdout);
+
+    for (Command *stage = cmd; stage; stage = stage->next)
+    {
+        if (stage->next && pipe(fds) == -1)
+        {
+            perror("pipe");
+            break;
+        }
+
+        int start_status = 127;
+        ProcessSetup setup = {
+            // Resolve in the parent so the cache outlives the child
+            .path = path_cache_lookup(stage->args[0]),
+            .pgid = pgid,
+            .in_fd = stage == cmd ? io->in_fd : prev_read,
+            .out_fd = stage->next ? fds[1] : io->out_fd,
+            .err_fd = io->err_fd,
+            .close_fd = stage->next ? fds[0] : -1,
+            .sigmask = &child_sigmask,
+            .start_status = &start_status,
+        };
+
+        // A stage that fails to start leaves its neighbours reading EOF,
+        // just as if its exec had failed
+        uint64_t spawn_start = monotonic_ns();
+        pid_t pid = create_process(stage, &setup);
+        if (!stage->next)
+        {
+            *last_pid = pid;
+            *last_status = start_status;
+        }
+        if (pid > 0)
+        {
+            stats_process_started(stage->args[0], pid, monotonic_ns() - spawn_start);
+
+            // Set the group here too to avoid racing a forked child
+            if (pgid == 0)
+                pgid = pid;
+            setpgid(pid, pgid);
+            pids[(*started)++] = pid;
+        }
+
+        if (prev_read != -1)
+            close(prev_read);
+        prev_read = stage->next ? fds[0] : -1;
+        if (stage->next)
+            close(fds[1]);
+    }
+
+    if (prev_read != -1)
+        close(prev_read);
+    return pgid;
+}
+
+int execute_pipeline(Command *cmd)
+{
+    static const PipelineIO inherit = {-1, -1, -1};
+    pid_t pids[cmd->pipe_count + 1];
+    pid_t last_pid;
+    int last_status;
+    int started;
+    char cmd_str[MAX_INPUT_SIZE];
+
+    format_pipeline(cmd, cmd_str, sizeof(cmd_str));
+
+    pid_t pgid = start_pipeline(cmd, &inherit, pids, &started, &last_pid, &last_status);
+    if (pgid == 0)
+    {
+        // Nothing could be started
+        last_exit_status = last_status;
+        return last_exit_status;
+    }
+
+    if (cmd->background)
+    {
+        handle_background_process(pgid, pids, started, cmd_str);
+        last_exit_status = 0;
+        return last_exit_status;
+    }
+
+    // Foreground jobs go through the job table too, so one reaping path
+    // serves every child
+    Job *job = add_job(pgid, pids, started, cmd_str, 0);
+    if (!job)
+    {
+        last_exit_status = 1;
+        return last_exit_status;
+    }
+    job->status_pid = last_pid > 0 ? last_pid : 0;
+
+    current_foreground_pgid = pgid;
+    strncpy(current_command, cmd_str, MAX_INPUT_SIZE - 1);
+    current_command[MAX_INPUT_SIZE - 1] = '\0';
+
+    give_terminal_to(pgid);
+    int status = wait_for_job(job);
+    give_terminal_to(getpgrp());
+
+    // Ctrl+Z terminates the foreground job rather than stopping it
+    if (job->status == STOPPED)
+    {
+        kill(-pgid, SIGTERM);
+        kill(-pgid, SIGCONT);
+        printf("\nTerminated: %s\n", cmd_str);
+        job->status = RUNNING;
+        status = wait_for_job(job);
+    }
+
+    // The status of a pipeline is that of its last stage
+    last_exit_status = job->status_pid > 0 ? exit_status_from_wait(status) : last_status;
+    last_job_usage = job->usage;
+    remove_job(job->job_id);
+
+    current_foreground_pgid = 0;
+    current_command[0] = '\0';
+    return last_exit_status;
+}
+
+// Sleep until every process of the job has exited or one has stopped;
+// returns the stop status, or the last stage's exit status
+int wait_for_job(Job *job)
+{
+    // Children may have changed state before we got here
+    update_job_status();
+    for (;;)
+    {
+        while (job->status == RUNNING)
+        {
+            wait_for_signal();
+        }
+
+        // A stage that touched the terminal before we handed it over was
+        // stopped by SIGTTIN/SIGTTOU; it owns the terminal now, so resume it
+        if (job->status == STOPPED &&
+            (WSTOPSIG(job->stop_status) == SIGTTIN || WSTOPSIG(job->stop_status) == SIGTTOU))
+        {
+            job->status = RUNNING;
+            kill(-job->pid, SIGCONT);
+            continue;
+        }
+        break;
+    }
+    return job->status == STOPPED ? job->stop_status : job->wait_status;
+}
+
+int exit_status_from_wait(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 1;
+}
+
+void handle_background_process(pid_t pgid, const pid_t *pids, int count, const char *command)
+{
+    add_job(pgid, pids, count, command, 1);
+}
+
+int open_redirection(const char *file, int flags)
+{
+    int fd = open(file, flags, 0644);
+    if (fd == -1)
+    {
+        fprintf(stderr, "open: %s: %s\n", file, strerror(errno));
+    }
+    return fd;
+}
+
+int setup_io_redirection(Command *cmd)
+{
+    int fd;
+
+    // Handle input redirection
+    if (cmd->input_file)
+    {
+        fd = open_redirection(cmd->input_file, O_RDONLY);
+        if (fd == -1)
+        {
+            return -1;
+        }
+        if (dup2(fd, STDIN_FILENO) == -1)
+        {
+            perror("dup2");
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+
+    // Handle output redirection
+    if (cmd->output_file)
+    {
+        int flags = O_WRONLY | O_CREAT;
+        if (cmd->append_output)
+        {
+            flags |= O_APPEND;
+        }
+        else
+        {
+            flags |= O_TRUNC;
+        }
+
+        fd = open_redirection(cmd->output_file, flags);
+        if (fd == -1)
+        {
+            return -1;
+        }
+        if (dup2(fd, STDOUT_FILENO) == -1)
+        {
+            perror("dup2");
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+
+    return 0;
+}
+
+void reset_io_redirection(int stdin_copy, int stdout_copy)
+{
+    if (dup2(stdin_copy, STDIN_FILENO) == -1)
+    {
+        perror("dup2");
+    }
+    if (dup2(stdout_copy, STDOUT_FILENO) == -1)
+    {
+        perror("dup2");
+    }
+    close(stdin_copy);
+    close(stdout_copy);
+}
+
+int shell_jobs(char **args)
+{
+    (void)args;
+    print_jobs();
+    return 0;
+}
+
+// pid -> job map: open addressing with linear probing. Removed entries
+// become tombstones so probe chains stay intact.
+#define PID_MAP_TOMBSTONE ((Job *)-1)
+#define PID_MAP_INITIAL_CAPACITY 64
+
+static size_t pid_map_slot(pid_t pid, size_t capacity)
+{
+    // Fibonacci hashing spreads sequential pids across the table
+    return (size_t)(((uint64_t)(uint32_t)pid * 11400714819323198485ull) >> 32) & (capacity - 1);
+}
+
+static void pid_map_put(PidMapEntry *map, size_t capacity, pid_t pid, Job *job)
+{
+    size_t slot = pid_map_slot(pid, capacity);
+    while (map[slot].job && map[slot].job != PID_MAP_TOMBSTONE)
+    {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    map[slot].pid = pid;
+    map[slot].job = job;
+}
+
+static PidMapEntry *pid_map_find(pid_t pid)
+{
+    if (!job_table.pid_map)
+        return NULL;
+
+    size_t capacity = job_table.pid_map_capacity;
+    size_t slot = pid_map_slot(pid, capacity);
+    while (job_table.pid_map[slot].job)
+    {
+        if (job_table.pid_map[slot].job != PID_MAP_TOMBSTONE && job_table.pid_map[slot].pid == pid)
+        {
+            return &job_table.pid_map[slot];
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return NULL;
+}
+
+// Make room for `extra` more pids, rehashing (and dropping tombstones)
+// once live entries plus tombstones pass half the capacity
+static int pid_map_reserve(size_t extra)
+{
+    size_t capacity = job_table.pid_map_capacity;
+    if (job_table.pid_map && (job_table.pid_map_used + extra) * 2 <= capacity)
+        return 0;
+
+    size_t live = 0;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        if (job_table.pid_map[i].job && job_table.pid_map[i].job != PID_MAP_TOMBSTONE)
+            live++;
+    }
+
+    size_t new_capacity = PID_MAP_INITIAL_CAPACITY;
+    while ((live + extra) * 2 > new_capacity)
+        new_capacity *= 2;
+
+    PidMapEntry *new_map = shell_malloc(new_capacity * sizeof(PidMapEntry));
+    if (!new_map)
+        return -1;
+    memset(new_map, 0, new_capacity * sizeof(PidMapEntry));
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        Job *job = job_table.pid_map[i].job;
+        if (job && job != PID_MAP_TOMBSTONE)
+            pid_map_put(new_map, new_capacity, job_table.pid_map[i].pid, job);
+    }
+
+    shell_free(job_table.pid_map);
+    job_table.pid_map = new_map;
+    job_table.pid_map_capacity = new_capacity;
+    job_table.pid_map_used = live;
+    return 0;
+}
+
+static void pid_map_remove(pid_t pid)
+{
+    PidMapEntry *entry = pid_map_find(pid);
+    if (entry)
+    {
+        // used still counts the tombstone until the next rehash
+        entry->job = PID_MAP_TOMBSTONE;
+    }
+}
+
+Job *find_job(int job_id)
+{
+    if (job_id < 1 || job_id > job_table.highest_id)
+        return NULL;
+    return job_table.slots[job_id - 1];
+}
+
+Job *find_job_by_pid(pid_t pid)
+{
+    PidMapEntry *entry = pid_map_find(pid);
+    return entry ? entry->job : NULL;
+}
+
+Job *add_job(pid_t pgid, const pid_t *pids, int count, const char *command, int background)
+{
+    Job *job = find_job_by_pid(pgid);
+
+    // First check if the process is already in jobs list
+    if (job)
+    {
+        // Update existing job
+        job->status = STOPPED;
+        return job;
+    }
+
+    // New jobs get the next id after the highest one in use
+    if (job_table.highest_id == job_table.slot_count)
+    {
+        int new_count = job_table.slot_count ? job_table.slot_count * 2 : 16;
+        Job **slots = shell_realloc(job_table.slots, new_count * sizeof(Job *));
+        if (!slots)
+        {
+            fprintf(stderr, "add_job: out of memory\n");
+            return NULL;
+        }
+        memset(slots + job_table.slot_count, 0, (new_count - job_table.slot_count) * sizeof(Job *));
+        job_table.slots = slots;
+        job_table.slot_count = new_count;
+    }
+
+    // One allocation holds the job, its pids and its command string
+    size_t command_len = strlen(command) + 1;
+    job = shell_malloc(sizeof(Job) + count * sizeof(pid_t) + command_len);
+    if (!job || pid_map_reserve(count) != 0)
+    {
+        shell_free(job);
+        fprintf(stderr, "add_job: out of memory\n");
+        return NULL;
+    }
+
+    job->pid = pgid;
+    job->job_id = ++job_table.highest_id;
+    job->status = RUNNING;
+    job->foreground = !background;
+    job->wait_status = 0;
+    job->stop_status = 0;
+    job->status_pid = pids[count - 1];
+    job->process_count = count;
+    job->live_processes = count;
+    memset(&job->usage, 0, sizeof(job->usage));
+    job->pids = (pid_t *)(job + 1);
+    memcpy(job->pids, pids, count * sizeof(pid_t));
+    job->command = (char *)(job->pids + count);
+    memcpy(job->command, command, command_len);
+
+    for (int i = 0; i < count; i++)
+    {
+        pid_map_put(job_table.pid_map, job_table.pid_map_capacity, pids[i], job);
+        job_table.pid_map_used++;
+    }
+    job_table.slots[job->job_id - 1] = job;
+    job_table.job_count++;
+
+    if (background)
+    {
+        printf("[%d] %d %s &\n", job->job_id, pgid, command);
+    }
+    return job;
+}
+
+void remove_job(int job_id)
+{
+    Job *job = find_job(job_id);
+    if (job)
+    {
+        for (int i = 0; i < job->process_count; i++)
+        {
+            pid_map_remove(job->pids[i]);
+        }
+        job_table.slots[job_id - 1] = NULL;
+        job_table.job_count--;
+        shell_free(job);
+
+        // Let ids be reused once the jobs above them are gone
+        while (job_table.highest_id > 0 && !job_table.slots[job_table.highest_id - 1])
+        {
+            job_table.highest_id--;
+        }
+    }
+}
+
+void free_job_table(void)
+{
+    for (int id = job_table.highest_id; id > 0; id--)
+    {
+        remove_job(id);
+    }
+    shell_free(job_table.slots);
+    shell_free(job_table.pid_map);
+    memset(&job_table, 0, sizeof(job_table));
+}
+
+void print_jobs(void)
+{
+    int found = 0;
+    for (int id = 1; id <= job_table.highest_id; id++)
+    {
+        Job *job = job_table.slots[id - 1];
+        if (job && (job->status == RUNNING || job->status == STOPPED))
+        {
+            printf("[%d] %s %s\n",
+                   job->job_id,
+                   job->status == RUNNING ? "Running" : "Stopped",
+                   job->command);
+            found = 1;
+        }
+    }
+    if (!found)
+    {
+        printf("No active jobs\n");
+    }
+}
+
+int shell_fg(char **args)
+{
+    if (!args[1])
+    {
+        fprintf(stderr, "fg: job id required\n");
+        return 1;
+    }
+
+    int job_id = atoi(args[1]);
+    Job *job = find_job(job_id);
+    if (job && job->status != DONE)
+    {
+        pid_t pid = job->pid;
+
+        // Continue the process group if it was stopped
+        if (job->status == STOPPED)
+        {
+            kill(-pid, SIGCONT);
+            printf("%s\n", job->command);
+        }
+
+        // Wait for the job in the foreground
+        job->foreground = 1;
+        job->status = RUNNING;
+        give_terminal_to(pid);
+        int status = wait_for_job(job);
+        give_terminal_to(getpgrp());
+
+        // Stopped again: it goes back to being a background job
+        if (job->status == STOPPED)
+        {
+            job->foreground = 0;
+            printf("\n[%d] Stopped %s\n", job->job_id, job->command);
+            return exit_status_from_wait(status);
+        }
+
+        remove_job(job_id);
+        return exit_status_from_wait(status);
+    }
+
+    fprintf(stderr, "fg: job %d not found\n", job_id);
+    return 1;
+}
+
+int shell_bg(char **args)
+{
+    if (!args[1])
+    {
+        fprintf(stderr, "bg: job id required\n");
+        return 1;
+    }
+
+    int job_id = atoi(args[1]);
+    Job *job = find_job(job_id);
+    if (job && job->status == STOPPED)
+    {
+        kill(-job->pid, SIGCONT);
+        job->status = RUNNING;
+        printf("[%d] %s &\n", job_id, job->command);
+        return 0;
+    }
+
+    fprintf(stderr, "bg: job %d not found\n", job_id);
+    return 1;
+}
+
+// Reap every child that changed state. Runs from the event loop when
+// SIGCHLD arrives, so it is free to print and to update the job table.
+void update_job_status(void)
+{
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED, &usage)) > 0)
+    {
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+            stats_process_exited(pid);
+
+        Job *job = find_job_by_pid(pid);
+        if (!job)
+            continue;
+
+        if (WIFSTOPPED(status))
+        {
+            job->status = STOPPED;
+            job->stop_status = status;
+            if (!job->foreground)
+            {
+                printf("[%d] Stopped %s\n", job->job_id, job->command);
+            }
+        }
+        else if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            if (pid == job->status_pid)
+            {
+                job->wait_status = status;
+            }
+            job->usage.user_time += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+            job->usage.sys_time += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+            if (usage.ru_maxrss > job->usage.max_rss)
+                job->usage.max_rss = usage.ru_maxrss;
+
+            // The job is done once every process in it has been reaped
+            pid_map_remove(pid);
+            if (--job->live_processes == 0 && job->status != DONE)
+            {
+                job->status = DONE;
+
+                // The shell is waiting for a foreground job and removes it itself
+                if (!job->foreground)
+                {
+                    printf("[%d] Done %s\n", job->job_id, job->command);
+                    remove_job(job->job_id);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,502 @@
+#include "shell.h"
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Scripts are parsed once into a flat, offset-addressed image: a header,
+// then the line, stage and argument tables and a string table. The image
+// is written to a cache file keyed by the script's path, and later runs
+// map it and execute straight from it as long as the script's mtime,
+// size and content hash still match.
+
+#define SCRIPT_CACHE_MAGIC "MYSHSC\0"
+#define SCRIPT_CACHE_VERSION 4
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t line_count;
+    uint32_t stage_count;
+    uint32_t arg_count;
+    uint32_t strings_size;
+    uint32_t path_offset; // the script's absolute path, in the string table
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t script_size;
+    uint64_t script_hash;
+} ScriptCacheHeader;
+
+// Growable libc buffer; scripts can be far larger than the shell's pool
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+typedef struct
+{
+    ByteBuffer lines;
+    ByteBuffer stages;
+    ByteBuffer args;
+    ByteBuffer strings;
+} ScriptBuilder;
+
+static int buffer_append(ByteBuffer *buffer, const void *data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->size + size)
+            capacity *= 2;
+        char *grown = realloc(buffer->data, capacity);
+        if (!grown)
+        {
+            perror("realloc");
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return 0;
+}
+
+// Returns the string's offset in the table, or CACHED_NO_STRING on failure
+static uint32_t add_string(ByteBuffer *strings, const char *str)
+{
+    uint32_t offset = strings->size;
+    if (!str)
+        return CACHED_NO_STRING;
+    if (buffer_append(strings, str, strlen(str) + 1) != 0)
+        return CACHED_NO_STRING;
+    return offset;
+}
+
+static int add_pipeline(ScriptBuilder *builder, Command *cmd)
+{
+    CachedLine line = {
+        .first = builder->stages.size / sizeof(CachedStage),
+        .count = cmd->pipe_count + 1,
+        .flags = cmd->background ? CACHED_BACKGROUND : 0,
+    };
+
+    for (Command *stage = cmd; stage; stage = stage->next)
+    {
+        CachedStage cached = {
+            .first_arg = builder->args.size / sizeof(uint32_t),
+            .argc = 0,
+            .input_file = add_string(&builder->strings, stage->input_file),
+            .output_file = add_string(&builder->strings, stage->output_file),
+            .flags = (stage->append_output ? CACHED_APPEND_OUTPUT : 0) | (stage->expand ? CACHED_EXPAND : 0),
+        };
+        if ((stage->input_file && cached.input_file == CACHED_NO_STRING) ||
+            (stage->output_file && cached.output_file == CACHED_NO_STRING))
+            return -1;
+        for (; stage->args[cached.argc]; cached.argc++)
+        {
+            uint32_t offset = add_string(&builder->strings, stage->args[cached.argc]);
+            if (offset == CACHED_NO_STRING || buffer_append(&builder->args, &offset, sizeof(offset)) != 0)
+                return -1;
+        }
+        if (buffer_append(&builder->stages, &cached, sizeof(cached)) != 0)
+            return -1;
+    }
+    return buffer_append(&builder->lines, &line, sizeof(line));
+}
+
+// Parse every line of the script into pipelines; lines that fail to parse
+// are recorded by position so running them reports the error in order.
+// The pipelines of one source line are chained with CACHED_CONTINUED, so
+// the line is read back, and checked, as a whole.
+// Keywords stay ordinary words here: blocks are assembled when the
+// pipelines are read back, which costs no lexing.
+static int compile_script(const char *source, size_t size, ScriptBuilder *builder)
+{
+    Arena arena;
+    size_t pos = 0;
+    int result = 0;
+
+    arena_init(&arena, COMMAND_ARENA_SIZE);
+    parse_errors_quiet = 1;
+
+    while (pos < size && result == 0)
+    {
+        const char *newline = memchr(source + pos, '\n', size - pos);
+        size_t length = newline ? (size_t)(newline - (source + pos)) : size - pos;
+
+        // The parser works in place, and the source stays pristine
+        char *text = arena_alloc(&arena, length + 1);
+        if (!text)
+        {
+            result = -1;
+            break;
+        }
+        memcpy(text, source + pos, length);
+        text[length] = '\0';
+
+        Command *cmd = parse_command(text, &arena);
+        if (!cmd)
+        {
+            CachedLine line = {.first = pos, .count = length, .flags = CACHED_PARSE_ERROR};
+            result = buffer_append(&builder->lines, &line, sizeof(line));
+        }
+        size_t first = builder->lines.size / sizeof(CachedLine);
+        for (; cmd && result == 0; cmd = cmd->list_next)
+        {
+            if (cmd->args[0])
+                result = add_pipeline(builder, cmd);
+        }
+        CachedLine *lines = (CachedLine *)builder->lines.data;
+        for (size_t i = first; result == 0 && i + 1 < builder->lines.size / sizeof(CachedLine); i++)
+            lines[i].flags |= CACHED_CONTINUED;
+
+        arena_reset(&arena);
+        pos += length + 1;
+    }
+
+    parse_errors_quiet = 0;
+    arena_destroy(&arena);
+    return result;
+}
+
+// FNV-1a over 8-byte words, so validating a cache costs far less than lexing
+static uint64_t hash_script(const char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+    for (; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Cache files live in $MYSHELL_CACHE_DIR, else $XDG_CACHE_HOME/myshell,
+// else ~/.cache/myshell, named after a hash of the script's absolute path
+static int cache_file_path(const char *script_path, char *out, size_t size)
+{
+    char dir[PATH_MAX];
+    const char *env;
+
+    if ((env = getenv("MYSHELL_CACHE_DIR")) && *env)
+        snprintf(dir, sizeof(dir), "%s", env);
+    else if ((env = getenv("XDG_CACHE_HOME")) && *env)
+        snprintf(dir, sizeof(dir), "%s/myshell", env);
+    else if ((env = getenv("HOME")) && *env)
+    {
+        snprintf(dir, sizeof(dir), "%s/.cache", env);
+        mkdir(dir, 0700);
+        snprintf(dir, sizeof(dir), "%s/.cache/myshell", env);
+    }
+    else
+        return -1;
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+        return -1;
+
+    int written = snprintf(out, size, "%s/%016llx.cache", dir,
+                           (unsigned long long)hash_script(script_path, strlen(script_path)));
+    return written > 0 && (size_t)written < size ? 0 : -1;
+}
+
+// Point the script's tables into an image, checking every offset so a
+// corrupt or stale cache file is rejected rather than trusted
+static int load_image(CompiledScript *script, const char *real_path, const struct stat *st, uint64_t hash)
+{
+    const ScriptCacheHeader *header = script->image;
+    if (script->image_size < sizeof(ScriptCacheHeader) ||
+        memcmp(header->magic, SCRIPT_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SCRIPT_CACHE_VERSION ||
+        header->mtime_sec != (int64_t)st->st_mtim.tv_sec ||
+        header->mtime_nsec != (int64_t)st->st_mtim.tv_nsec ||
+        header->script_size != (uint64_t)st->st_size ||
+        header->script_hash != hash)
+        return -1;
+
+    uint64_t expected = sizeof(ScriptCacheHeader) +
+                        (uint64_t)header->line_count * sizeof(CachedLine) +
+                        (uint64_t)header->stage_count * sizeof(CachedStage) +
+                        (uint64_t)header->arg_count * sizeof(uint32_t) +
+                        header->strings_size;
+    if (expected != script->image_size || header->strings_size == 0)
+        return -1;
+
+    char *base = (char *)script->image + sizeof(ScriptCacheHeader);
+    script->lines = (const CachedLine *)base;
+    script->line_count = header->line_count;
+    script->stages = (const CachedStage *)(script->lines + header->line_count);
+    script->args = (const uint32_t *)(script->stages + header->stage_count);
+    script->strings = (char *)(script->args + header->arg_count);
+
+    uint32_t strings_size = header->strings_size;
+    if (script->strings[strings_size - 1] != '\0' || header->path_offset >= strings_size ||
+        strcmp(script->strings + header->path_offset, real_path) != 0)
+        return -1;
+
+    for (uint32_t i = 0; i < header->line_count; i++)
+    {
+        const CachedLine *line = &script->lines[i];
+        uint64_t end = (uint64_t)line->first + line->count;
+        if (line->flags & CACHED_PARSE_ERROR ? end > script->source_size
+                                             : line->count == 0 || end > header->stage_count)
+            return -1;
+        if ((line->flags & CACHED_CONTINUED) && i + 1 == header->line_count)
+            return -1;
+    }
+    for (uint32_t i = 0; i < header->stage_count; i++)
+    {
+        const CachedStage *stage = &script->stages[i];
+        if (stage->argc >= MAX_ARGS || (uint64_t)stage->first_arg + stage->argc > header->arg_count ||
+            (stage->input_file != CACHED_NO_STRING && stage->input_file >= strings_size) ||
+            (stage->output_file != CACHED_NO_STRING && stage->output_file >= strings_size))
+            return -1;
+    }
+    for (uint32_t i = 0; i < header->arg_count; i++)
+    {
+        if (script->args[i] >= strings_size)
+            return -1;
+    }
+    return 0;
+}
+
+static int map_cache(CompiledScript *script, const char *cache_path, const char *real_path,
+                     const struct stat *st, uint64_t hash)
+{
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    struct stat cache_st;
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &cache_st) == -1 || cache_st.st_size < (off_t)sizeof(ScriptCacheHeader))
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Private and writable: builtins receive argv strings they may modify
+    void *image = mmap(NULL, cache_st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+        return -1;
+
+    script->image = image;
+    script->image_size = cache_st.st_size;
+    script->image_mapped = 1;
+    if (load_image(script, real_path, st, hash) != 0)
+    {
+        munmap(image, cache_st.st_size);
+        script->image = NULL;
+        script->image_mapped = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Lay out the header and tables in one buffer, the same bytes as the file
+static int build_image(CompiledScript *script, ScriptBuilder *builder, const char *real_path,
+                       const struct stat *st, uint64_t hash)
+{
+    ScriptCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCRIPT_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCRIPT_CACHE_VERSION;
+    header.line_count = builder->lines.size / sizeof(CachedLine);
+    header.stage_count = builder->stages.size / sizeof(CachedStage);
+    header.arg_count = builder->args.size / sizeof(uint32_t);
+    header.path_offset = add_string(&builder->strings, real_path);
+    header.strings_size = builder->strings.size;
+    header.mtime_sec = st->st_mtim.tv_sec;
+    header.mtime_nsec = st->st_mtim.tv_nsec;
+    header.script_size = st->st_size;
+    header.script_hash = hash;
+    if (header.path_offset == CACHED_NO_STRING)
+        return -1;
+
+    ByteBuffer image = {0};
+    if (buffer_append(&image, &header, sizeof(header)) != 0 ||
+        buffer_append(&image, builder->lines.data, builder->lines.size) != 0 ||
+        buffer_append(&image, builder->stages.data, builder->stages.size) != 0 ||
+        buffer_append(&image, builder->args.data, builder->args.size) != 0 ||
+        buffer_append(&image, builder->strings.data, builder->strings.size) != 0)
+    {
+        free(image.data);
+        return -1;
+    }
+
+    script->image = image.data;
+    script->image_size = image.size;
+    script->image_mapped = 0;
+    return load_image(script, real_path, st, hash);
+}
+
+// Best effort: write to a private temporary and rename it into place so a
+// concurrent run never maps a half-written cache
+static void write_cache(const CompiledScript *script, const char *cache_path)
+{
+    char temp_path[PATH_MAX + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", cache_path, (int)getpid());
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return;
+
+    const char *data = script->image;
+    size_t remaining = script->image_size;
+    while (remaining > 0)
+    {
+        ssize_t written = write(fd, data, remaining);
+        if (written <= 0)
+        {
+            if (written == -1 && errno == EINTR)
+                continue;
+            close(fd);
+            unlink(temp_path);
+            return;
+        }
+        data += written;
+        remaining -= written;
+    }
+
+    if (close(fd) != 0 || rename(temp_path, cache_path) != 0)
+        unlink(temp_path);
+}
+
+static void free_builder(ScriptBuilder *builder)
+{
+    free(builder->lines.data);
+    free(builder->stages.data);
+    free(builder->args.data);
+    free(builder->strings.data);
+}
+
+// Returns 0 with the script ready to run, 1 if the file is not a regular
+// file (the caller should stream it instead), or -1 if it cannot be read
+int script_cache_open(const char *path, CompiledScript *script)
+{
+    struct stat st;
+    char real_path[PATH_MAX];
+    char cache_path[PATH_MAX];
+
+    memset(script, 0, sizeof(CompiledScript));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) || !realpath(path, real_path))
+    {
+        close(fd);
+        return 1;
+    }
+
+    if (st.st_size > 0)
+    {
+        void *source = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (source == MAP_FAILED)
+        {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        script->source = source;
+        script->source_size = st.st_size;
+    }
+    close(fd);
+
+    uint64_t hash = hash_script(script->source, script->source_size);
+    int have_cache_path = cache_file_path(real_path, cache_path, sizeof(cache_path)) == 0;
+    if (have_cache_path && map_cache(script, cache_path, real_path, &st, hash) == 0)
+        return 0;
+
+    // Missing or stale: compile now, run from the fresh image, and save it
+    ScriptBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    int result = compile_script(script->source, script->source_size, &builder);
+    if (result == 0)
+        result = build_image(script, &builder, real_path, &st, hash);
+    free_builder(&builder);
+
+    if (result != 0)
+    {
+        fprintf(stderr, "%s: failed to compile script\n", path);
+        script_cache_close(script);
+        return -1;
+    }
+    if (have_cache_path)
+        write_cache(script, cache_path);
+    return 0;
+}
+
+// Materialise one line as a Command pipeline in the arena, without lexing
+Command *script_command(const CompiledScript *script, uint32_t index, Arena *arena)
+{
+    const CachedLine *line = &script->lines[index];
+
+    if (line->flags & CACHED_PARSE_ERROR)
+    {
+        // Parse it again so the error is reported now, in script order;
+        // the NULL this returns ends the script with status 2
+        char *text = arena_alloc(arena, line->count + 1);
+        if (!text)
+        {
+            fprintf(stderr, "parse: out of memory\n");
+            return NULL;
+        }
+        memcpy(text, script->source + line->first, line->count);
+        text[line->count] = '\0';
+        return parse_command(text, arena);
+    }
+
+    Command *head = NULL;
+    Command *tail = NULL;
+    for (uint32_t i = 0; i < line->count; i++)
+    {
+        const CachedStage *cached = &script->stages[line->first + i];
+        Command *stage = new_command(arena);
+        if (!stage)
+            return NULL;
+
+        for (uint32_t a = 0; a < cached->argc; a++)
+            stage->args[a] = script->strings + script->args[cached->first_arg + a];
+        stage->args[cached->argc] = NULL;
+        stage->input_file = cached->input_file == CACHED_NO_STRING ? NULL : script->strings + cached->input_file;
+        stage->output_file = cached->output_file == CACHED_NO_STRING ? NULL : script->strings + cached->output_file;
+        stage->append_output = (cached->flags & CACHED_APPEND_OUTPUT) != 0;
+        stage->expand = (cached->flags & CACHED_EXPAND) != 0;
+
+        if (!head)
+            head = stage;
+        else
+            tail->next = stage;
+        tail = stage;
+    }
+
+    head->pipe_count = line->count - 1;
+    head->background = (line->flags & CACHED_BACKGROUND) != 0;
+    return head;
+}
+
+void script_cache_close(CompiledScript *script)
+{
+    if (script->image_mapped)
+        munmap(script->image, script->image_size);
+    else
+        free(script->image);
+    if (script->source)
+        munmap((void *)script->source, script->source_size);
+    memset(script, 0, sizeof(CompiledScript));
+}
@@ -1,382 +1,534 @@
-#include "shell.h"
-#include "memory_manager.h"
-
-// Global variables - actual definition
-Job jobs[MAX_JOBS];
-int job_count = 0;
-int shell_running = 1;
-pid_t current_foreground_pid = 0;
-char current_command[MAX_INPUT_SIZE] = ""; // Add this to track current command
-
-void initialize_shell(void)
-{
-    // Initialize memory manager with 1MB pool
-    init_memory_manager(1024 * 1024);
-
-    // Set up signal handlers
-    setup_signal_handlers();
-
-    // Initialize jobs array
-    for (int i = 0; i < MAX_JOBS; i++)
-    {
-        jobs[i].pid = 0;
-        jobs[i].job_id = 0;
-        jobs[i].status = DONE;
-        jobs[i].command[0] = '\0';
-    }
-    job_count = 0;
-
-    // Print welcome message
-    printf("Welcome to MyShell!\n");
-    printf("Type 'help' for a list of commands.\n");
-}
-
-void setup_signal_handlers(void)
-{
-    signal(SIGINT, handle_signal);
-    signal(SIGTSTP, handle_signal);
-    signal(SIGCHLD, handle_signal);
-}
-
-void handle_signal(int signo)
-{
-    switch (signo)
-    {
-    case SIGINT: // Ctrl+C
-        if (current_foreground_pid > 0)
-        {
-            kill(current_foreground_pid, SIGINT);
-            current_foreground_pid = 0;
-            current_command[0] = '\0';
-        }
-        printf("\nchandan's shell> ");
-        fflush(stdout);
-        break;
-
-    case SIGTSTP: // Ctrl+Z
-        if (current_foreground_pid > 0)
-        {
-            // Terminate the foreground process
-            kill(current_foreground_pid, SIGTERM);
-            printf("\nTerminated: %s\n", current_command);
-            current_foreground_pid = 0;
-            current_command[0] = '\0';
-        }
-        printf("chandan's shell> ");
-        fflush(stdout);
-        break;
-
-    case SIGCHLD:
-        update_job_status();
-        break;
-    }
-}
-
-char *read_line(void)
-{
-    char *line = NULL;
-    size_t bufsize = 0;
-    ssize_t characters;
-
-    characters = getline(&line, &bufsize, stdin);
-
-    if (characters == -1)
-    {
-        if (feof(stdin))
-        {
-            printf("\n");
-            exit(EXIT_SUCCESS);
-        }
-        else
-        {
-            perror("getline");
-            return NULL;
-        }
-    }
-
-    // Remove trailing newline
-    if (line[characters - 1] == '\n')
-    {
-        line[characters - 1] = '\0';
-    }
-
-    return line;
-}
-
-Command *parse_command(char *line)
-{
-    Command *cmd = malloc(sizeof(Command));
-    if (!cmd)
-    {
-        perror("malloc");
-        return NULL;
-    }
-
-    // Initialize command structure
-    memset(cmd, 0, sizeof(Command));
-
-    char *token;
-    int i = 0;
-
-    // Check for background execution
-    if (line[strlen(line) - 1] == '&')
-    {
-        cmd->background = 1;
-        line[strlen(line) - 1] = '\0';
-    }
-
-    // Parse input redirection
-    char *input_redir = strchr(line, '<');
-    if (input_redir)
-    {
-        *input_redir = '\0';
-        sscanf(input_redir + 1, "%s", cmd->input_file);
-    }
-
-    // Parse output redirection
-    char *output_redir = strchr(line, '>');
-    if (output_redir)
-    {
-        if (*(output_redir + 1) == '>')
-        {
-            cmd->append_output = 1;
-            *output_redir = '\0';
-            sscanf(output_redir + 2, "%s", cmd->output_file);
-        }
-        else
-        {
-            *output_redir = '\0';
-            sscanf(output_redir + 1, "%s", cmd->output_file);
-        }
-    }
-
-    // Parse command and arguments
-    token = strtok(line, " \t");
-    while (token != NULL && i < MAX_ARGS - 1)
-    {
-        cmd->args[i] = strdup(token);
-        token = strtok(NULL, " \t");
-        i++;
-    }
-    cmd->args[i] = NULL;
-
-    return cmd;
-}
-
-int execute_command(Command *cmd)
-{
-    if (!cmd->args[0])
-        return 1;
-
-    // Check for built-in commands
-    if (strcmp(cmd->args[0], "cd") == 0)
-        return shell_cd(cmd->args);
-    if (strcmp(cmd->args[0], "pwd") == 0)
-        return shell_pwd();
-    if (strcmp(cmd->args[0], "exit") == 0)
-        return shell_exit();
-    if (strcmp(cmd->args[0], "help") == 0)
-        return shell_help();
-    if (strcmp(cmd->args[0], "jobs") == 0)
-        return shell_jobs();
-    if (strcmp(cmd->args[0], "fg") == 0)
-        return shell_fg(cmd->args);
-    if (strcmp(cmd->args[0], "bg") == 0)
-        return shell_bg(cmd->args);
-    if (strcmp(cmd->args[0], "memstat") == 0)
-        return shell_memstat();
-    if (strcmp(cmd->args[0], "memcheck") == 0)
-        return shell_memcheck();
-
-    // Execute external command
-    pid_t pid = create_process(cmd);
-
-    if (pid == 0)
-    {
-        // Child process
-        if (setup_io_redirection(cmd) != 0)
-        {
-            exit(EXIT_FAILURE);
-        }
-
-        // Reset signal handlers in child
-        signal(SIGINT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGCHLD, SIG_DFL);
-
-        execvp(cmd->args[0], cmd->args);
-        perror("execvp");
-        exit(EXIT_FAILURE);
-    }
-    else if (pid < 0)
-    {
-        perror("fork");
-        return 1;
-    }
-    else
-    {
-        // Parent process
-        // Build complete command string
-        char cmd_str[MAX_INPUT_SIZE] = "";
-        for (int i = 0; cmd->args[i] != NULL; i++)
-        {
-            if (i > 0)
-                strcat(cmd_str, " ");
-            strcat(cmd_str, cmd->args[i]);
-        }
-
-        if (cmd->background)
-        {
-            handle_background_process(pid, cmd_str);
-        }
-        else
-        {
-            current_foreground_pid = pid;
-            strncpy(current_command, cmd_str, MAX_INPUT_SIZE - 1);
-            current_command[MAX_INPUT_SIZE - 1] = '\0';
-            wait_for_process(pid);
-            current_foreground_pid = 0;
-            current_command[0] = '\0';
-        }
-    }
-
-    return 1;
-}
-
-int shell_cd(char **args)
-{
-    if (args[1] == NULL)
-    {
-        // Change to HOME directory
-        char *home = getenv("HOME");
-        if (home == NULL)
-        {
-            fprintf(stderr, "cd: HOME not set\n");
-            return 1;
-        }
-        if (chdir(home) != 0)
-        {
-            perror("cd");
-            return 1;
-        }
-    }
-    else
-    {
-        if (chdir(args[1]) != 0)
-        {
-            perror("cd");
-            return 1;
-        }
-    }
-    return 1;
-}
-
-int shell_pwd(void)
-{
-    char cwd[1024];
-    if (getcwd(cwd, sizeof(cwd)) != NULL)
-    {
-        printf("%s\n", cwd);
-    }
-    else
-    {
-        perror("pwd");
-        return 1;
-    }
-    return 1;
-}
-
-int shell_exit(void)
-{
-    // Clean up any remaining jobs
-    for (int i = 0; i < MAX_JOBS; i++)
-    {
-        if (jobs[i].status == RUNNING || jobs[i].status == STOPPED)
-        {
-            kill(jobs[i].pid, SIGTERM);
-        }
-    }
-
-    // Check for memory leaks before exit
-    check_memory_leaks();
-
-    // Cleanup memory manager
-    cleanup_memory_manager();
-
-    printf("Goodbye!\n");
-    shell_running = 0;
-    return 0;
-}
-
-int shell_help(void)
-{
-    printf("MyShell - A simple shell implementation\n");
-    printf("Built-in commands:\n");
-    printf("  cd [dir]     Change directory\n");
-    printf("  pwd          Print working directory\n");
-    printf("  jobs         List background jobs\n");
-    printf("  fg [job_id]  Bring job to foreground\n");
-    printf("  bg [job_id]  Continue job in background\n");
-    printf("  memstat      Display memory statistics\n");
-    printf("  memcheck     Check for memory leaks\n");
-    printf("  help         Display this help message\n");
-    printf("  exit         Exit the shell\n");
-    return 1;
-}
-
-// Add new built-in commands for memory management
-int shell_memstat(void)
-{
-    print_memory_stats();
-    print_memory_blocks();
-    return 1;
-}
-
-int shell_memcheck(void)
-{
-    check_memory_leaks();
-    return 1;
-}
-
-void shell_loop(void)
-{
-    char *line;
-    Command *cmd;
-
-    while (shell_running)
-    {
-        printf("chandan's shell> ");
-        fflush(stdout);
-
-        line = read_line();
-        if (!line)
-            continue;
-
-        // Check for "exit" command directly
-        if (strcmp(line, "exit") == 0)
-        {
-            free(line);
-            shell_exit();
-            break;
-        }
-
-        cmd = parse_command(line);
-        if (!cmd)
-        {
-            free(line);
-            continue;
-        }
-
-        execute_command(cmd);
-
-        free(line);
-        free(cmd);
-    }
-}
-
-int main(void)
-{
-    initialize_shell();
-    shell_loop();
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+#include "shell.h"
+#include "memory_manager.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Global variables - actual definition
+JobTable job_table = {0};
+int shell_running = 1;
+pid_t current_foreground_pgid = 0;
+char current_command[MAX_INPUT_SIZE] = ""; // Add this to track current command
+int shell_is_interactive = 0;
+int last_exit_status = 0;
+int shell_script_mode = 0; // running a script file or -c string: no prompt or banner
+
+// Backs every parse-time allocation; reset after each command runs
+static Arena command_arena;
+
+void initialize_shell(void)
+{
+    // Initialize memory manager with 1MB pool
+    init_memory_manager(1024 * 1024);
+    arena_init(&command_arena, COMMAND_ARENA_SIZE);
+
+    // Only hand the terminal to foreground jobs when we actually own one
+    shell_is_interactive = !shell_script_mode && isatty(STDIN_FILENO);
+
+    // Escape hatch to the plain fork/exec path, used for benchmarking
+    if (getenv("MYSHELL_NO_SPAWN"))
+        spawn_enabled = 0;
+
+    // Set up signal handlers
+    setup_signal_handlers();
+
+    if (shell_script_mode)
+        return;
+
+    // Print welcome message
+    printf("Welcome to MyShell!\n");
+    printf("Type 'help' for a list of commands.\n");
+}
+
+// Called from the event loop, never from signal context
+void handle_signal(int signo)
+{
+    switch (signo)
+    {
+    case SIGINT: // Ctrl+C
+        if (current_foreground_pgid > 0)
+        {
+            // The rest of the command list is abandoned too
+            kill(-current_foreground_pgid, SIGINT);
+            command_interrupted = 1;
+            break;
+        }
+        if (shell_script_mode)
+        {
+            // An interrupted script stops at the next command
+            last_exit_status = 128 + SIGINT;
+            shell_running = 0;
+            break;
+        }
+        if (loop_depth > 0)
+        {
+            // Break out of a loop running only builtins
+            command_interrupted = 1;
+            printf("\n");
+            break;
+        }
+        printf("\nchandan's shell> ");
+        fflush(stdout);
+        break;
+
+    case SIGTSTP: // Ctrl+Z
+        if (current_foreground_pgid > 0)
+        {
+            // Terminate the foreground process group
+            kill(-current_foreground_pgid, SIGTERM);
+            printf("\nTerminated: %s\n", current_command);
+            break;
+        }
+        if (shell_script_mode)
+            break;
+        printf("\nchandan's shell> ");
+        fflush(stdout);
+        break;
+
+    case SIGCHLD:
+        update_job_status();
+        break;
+    }
+}
+
+// Input is read in blocks into one buffer and split into lines in place;
+// a returned line stays valid until the next read_line call. Scripts are
+// mapped (or, for -c, used) whole, so they are split without any reads.
+static char *input_buffer = NULL;
+static size_t input_capacity = 0;
+static size_t input_start = 0;
+static size_t input_end = 0;
+static int input_eof = 0;
+static int input_fd = STDIN_FILENO;
+
+int input_from_file(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    // A private writable mapping lets lines be terminated in place. The
+    // last line needs one byte past the end unless it ends in a newline,
+    // which only the unused tail of the final page can provide.
+    size_t size = st.st_size;
+    char last = '\n';
+    if (S_ISREG(st.st_mode) && size > 0 && pread(fd, &last, 1, size - 1) == 1 &&
+        (last == '\n' || size % sysconf(_SC_PAGESIZE) != 0))
+    {
+        char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            close(fd);
+            input_buffer = map;
+            input_capacity = size;
+            input_end = size;
+            input_eof = 1;
+            return 0;
+        }
+    }
+
+    // Pipes, empty files and unlucky sizes go through the block reader
+    input_fd = fd;
+    return 0;
+}
+
+void input_from_string(char *text)
+{
+    input_buffer = text;
+    input_capacity = strlen(text);
+    input_end = input_capacity;
+    input_eof = 1;
+}
+
+char *read_line(void)
+{
+    for (;;)
+    {
+        char *start = input_buffer + input_start;
+        char *newline = input_end > input_start ? memchr(start, '\n', input_end - input_start) : NULL;
+        if (newline)
+        {
+            *newline = '\0';
+            input_start = newline - input_buffer + 1;
+            return start;
+        }
+
+        if (input_eof)
+        {
+            if (input_start == input_end)
+                return NULL;
+
+            // Last line without a trailing newline
+            input_buffer[input_end] = '\0';
+            input_start = input_end;
+            return start;
+        }
+
+        // Move the partial line to the front, growing the buffer if it is full
+        memmove(input_buffer, start, input_end - input_start);
+        input_end -= input_start;
+        input_start = 0;
+        if (input_capacity - input_end < 2)
+        {
+            size_t new_capacity = input_capacity ? input_capacity * 2 : INPUT_BLOCK_SIZE;
+            char *new_buffer = realloc(input_buffer, new_capacity);
+            if (!new_buffer)
+            {
+                perror("realloc");
+                return NULL;
+            }
+            input_buffer = new_buffer;
+            input_capacity = new_capacity;
+        }
+
+        // Sleep until input arrives, handling signals meanwhile
+        if (input_fd == STDIN_FILENO)
+            wait_for_input();
+
+        // Leave room for the terminator of an unterminated last line
+        ssize_t count = read(input_fd, input_buffer + input_end, input_capacity - input_end - 1);
+        if (count > 0)
+            input_end += count;
+        else if (count == 0)
+            input_eof = 1;
+        else if (errno != EINTR && errno != EAGAIN)
+        {
+            perror("read");
+            input_eof = 1;
+        }
+    }
+}
+
+int execute_command(Command *cmd)
+{
+    if (!cmd->args[0])
+        return last_exit_status;
+
+    // Built-ins run inside the shell unless they are part of a pipeline
+    if (cmd->pipe_count == 0 && is_builtin(cmd->args[0]))
+    {
+        int stdin_copy = dup(STDIN_FILENO);
+        int stdout_copy = dup(STDOUT_FILENO);
+
+        if (setup_io_redirection(cmd) == 0)
+        {
+            last_exit_status = execute_builtin(cmd);
+        }
+        else
+        {
+            last_exit_status = 1;
+        }
+
+        // Flush while stdout still points at the redirection target
+        fflush(stdout);
+        reset_io_redirection(stdin_copy, stdout_copy);
+        return last_exit_status;
+    }
+
+    // Execute external command or pipeline
+    return execute_pipeline(cmd);
+}
+
+int shell_cd(char **args)
+{
+    if (args[1] == NULL)
+    {
+        // Change to HOME directory
+        char *home = getenv("HOME");
+        if (home == NULL)
+        {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        }
+        if (chdir(home) != 0)
+        {
+            perror("cd");
+            return 1;
+        }
+    }
+    else
+    {
+        if (chdir(args[1]) != 0)
+        {
+            perror("cd");
+            return 1;
+        }
+    }
+    path_cache_chdir();
+    return 0;
+}
+
+int shell_pwd(char **args)
+{
+    (void)args;
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+    {
+        printf("%s\n", cwd);
+    }
+    else
+    {
+        perror("pwd");
+        return 1;
+    }
+    return 0;
+}
+
+int shell_exit(char **args)
+{
+    // An explicit status replaces the last command's
+    if (args && args[1])
+    {
+        last_exit_status = atoi(args[1]) & 0xff;
+    }
+
+    // The main loop stops and shell_cleanup runs once nothing is executing
+    shell_running = 0;
+    return last_exit_status;
+}
+
+void shell_cleanup(void)
+{
+    // Clean up any remaining jobs; a script leaves its background jobs running
+    for (int id = 1; id <= job_table.highest_id && !shell_script_mode; id++)
+    {
+        Job *job = find_job(id);
+        if (job && (job->status == RUNNING || job->status == STOPPED))
+        {
+            kill(-job->pid, SIGTERM);
+        }
+    }
+
+    // Release the command arena and caches, then check for memory leaks
+    arena_destroy(&command_arena);
+    path_cache_reset();
+    history_close();
+    completion_reset();
+    glob_cache_reset();
+    free_job_table();
+    free_variables();
+    stats_reset();
+    if (!shell_script_mode)
+        check_memory_leaks();
+
+    // Cleanup memory manager
+    cleanup_memory_manager();
+
+    if (!shell_script_mode)
+        printf("Goodbye!\n");
+}
+
+// Add new built-in commands for memory management
+int shell_memstat(char **args)
+{
+    if (args[1] && strcmp(args[1], "--json") == 0)
+    {
+        print_memory_stats_json();
+        return 0;
+    }
+    if (args[1] && strcmp(args[1], "-b") != 0)
+    {
+        fprintf(stderr, "memstat: %s: invalid option\n", args[1]);
+        return 2;
+    }
+
+    print_memory_stats();
+
+    // Listing every block is only useful on request
+    if (args[1])
+        print_memory_blocks();
+    return 0;
+}
+
+int shell_memcheck(char **args)
+{
+    (void)args;
+    check_memory_leaks();
+    return 0;
+}
+
+char *get_env_value(const char *name)
+{
+    return getenv(name);
+}
+
+int set_env_value(const char *name, const char *value)
+{
+    if (setenv(name, value, 1) != 0)
+    {
+        perror("setenv");
+        return -1;
+    }
+
+    // Cached command locations were resolved against the old PATH
+    if (strcmp(name, "PATH") == 0)
+    {
+        path_cache_reset();
+    }
+    return 0;
+}
+
+// Reads and parses the next line of input, prompting when interactive
+static int read_input_line(CommandReader *reader, int nested, Command **list)
+{
+    const char *prompt = nested ? "> " : "chandan's shell> ";
+    char *line;
+    if (shell_is_interactive)
+    {
+        line = edit_line(prompt);
+    }
+    else
+    {
+        if (!shell_script_mode)
+        {
+            printf("%s", prompt);
+            fflush(stdout);
+        }
+        line = read_line();
+    }
+    if (!line)
+        return 0;
+
+    // Recorded before parsing, which rewrites the line in place
+    if (shell_is_interactive)
+        history_add(line);
+
+    Command *cmd = parse_command(line, reader->arena);
+    if (!cmd)
+        return -1;
+
+    // The lines of a block must outlive the input buffer they were read into
+    if ((nested || list_opens_block(cmd)) && relocate_commands(cmd, reader->arena) != 0)
+    {
+        fprintf(stderr, "parse: out of memory\n");
+        return -1;
+    }
+    *list = cmd;
+    return 1;
+}
+
+// Reads pipelines from a compiled script; nothing is lexed here
+typedef struct
+{
+    CommandReader reader;
+    CompiledScript *script;
+    uint32_t index;
+} CompiledReader;
+
+// Returns every pipeline of the next source line, so the whole line is
+// checked before any of it runs, as with -c and stdin
+static int read_compiled_line(CommandReader *reader, int nested, Command **list)
+{
+    CompiledReader *compiled = (CompiledReader *)reader;
+    const CompiledScript *script = compiled->script;
+    Command *tail = NULL;
+    uint32_t flags;
+    (void)nested;
+
+    if (compiled->index >= script->line_count)
+        return 0;
+    do
+    {
+        Command *cmd = script_command(script, compiled->index, reader->arena);
+        if (!cmd)
+            return -1;
+        flags = script->lines[compiled->index++].flags;
+        if (tail)
+            tail->list_next = cmd;
+        else
+            *list = cmd;
+        tail = cmd;
+    } while (flags & CACHED_CONTINUED);
+    return 1;
+}
+
+void shell_loop(CommandReader *reader)
+{
+    Command *list;
+
+    while (shell_running)
+    {
+        command_interrupted = 0;
+
+        int status = read_command_list(reader, &list);
+        if (status == 0)
+        {
+            // End of input
+            if (!shell_script_mode)
+                printf("\n");
+            break;
+        }
+        if (status > 0)
+        {
+            execute_list(list, &command_arena);
+        }
+        else
+        {
+            // A syntax error fails with status 2, and ends a script or -c
+            // string at the line that has it
+            last_exit_status = 2;
+            if (!shell_is_interactive)
+            {
+                arena_reset(&command_arena);
+                break;
+            }
+        }
+
+        // Drop everything the command allocated in one step
+        arena_reset(&command_arena);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // myshell -c "commands" | myshell script [args...] | myshell
+    if (argc > 1)
+    {
+        shell_script_mode = 1;
+        if (strcmp(argv[1], "-c") == 0 && argc < 3)
+        {
+            fprintf(stderr, "myshell: -c: option requires an argument\n");
+            return 2;
+        }
+    }
+
+    initialize_shell();
+
+    CommandReader input = {.next = read_input_line, .pending = NULL, .arena = &command_arena};
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0)
+    {
+        input_from_string(argv[2]);
+    }
+    else if (argc > 1 && !getenv("MYSHELL_NO_SCRIPT_CACHE"))
+    {
+        // Regular files run from a parsed-script cache; others are streamed
+        CompiledScript script;
+        int result = script_cache_open(argv[1], &script);
+        if (result < 0)
+            return 127;
+        if (result == 0)
+        {
+            CompiledReader compiled = {{read_compiled_line, NULL, &command_arena}, &script, 0};
+            shell_loop(&compiled.reader);
+            shell_cleanup();
+            script_cache_close(&script);
+            return last_exit_status;
+        }
+        if (input_from_file(argv[1]) != 0)
+            return 127;
+    }
+    else if (argc > 1 && input_from_file(argv[1]) != 0)
+    {
+        return 127;
+    }
+
+    shell_loop(&input);
+    shell_cleanup();
+    return last_exit_status;
+}
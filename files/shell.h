@@ -1,91 +1,382 @@
-#ifndef SHELL_H
-#define SHELL_H
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <sys/types.h>
-#include <signal.h>
-#include <fcntl.h>
-#include <pwd.h>
-#include <errno.h>
-
-#define MAX_INPUT_SIZE 1024
-#define MAX_ARGS 64
-#define MAX_JOBS 20
-
-// Job status enumeration
-typedef enum
-{
-    RUNNING,
-    STOPPED,
-    DONE
-} JobStatus;
-
-// Structure to hold job information
-typedef struct
-{
-    pid_t pid;
-    int job_id;
-    char command[MAX_INPUT_SIZE];
-    JobStatus status;
-} Job;
-
-// Global variables declaration
-extern Job jobs[MAX_JOBS];
-extern int job_count;
-
-// Structure to hold command information
-typedef struct
-{
-    char *args[MAX_ARGS];
-    char input_file[MAX_INPUT_SIZE];
-    char output_file[MAX_INPUT_SIZE];
-    int append_output;
-    int background;
-    int pipe_count;
-} Command;
-
-// Function declarations
-void initialize_shell(void);
-void shell_loop(void);
-char *read_line(void);
-Command *parse_command(char *line);
-int execute_command(Command *cmd);
-int execute_builtin(Command *cmd);
-void handle_signal(int signo);
-void setup_signal_handlers(void);
-
-// Built-in commands
-int shell_cd(char **args);
-int shell_pwd(void);
-int shell_exit(void);
-int shell_help(void);
-int shell_jobs(void);
-int shell_fg(char **args);
-int shell_bg(char **args);
-int shell_memstat(void);
-int shell_memcheck(void);
-
-// Job control functions
-void add_job(pid_t pid, const char *command);
-void remove_job(int job_id);
-void update_job_status(void);
-void print_jobs(void);
-
-// Process management functions
-pid_t create_process(Command *cmd);
-void wait_for_process(pid_t pid);
-void handle_background_process(pid_t pid, const char *command);
-
-// I/O redirection functions
-int setup_io_redirection(Command *cmd);
-void reset_io_redirection(int stdin_copy, int stdout_copy);
-
-// Environment variable functions
-char *get_env_value(const char *name);
-int set_env_value(const char *name, const char *value);
-
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <errno.h>
+#include <limits.h>
+#include "memory_manager.h"
+
+#define MAX_INPUT_SIZE 1024
+#define MAX_ARGS 64
+#define COMMAND_ARENA_SIZE (16 * 1024)
+#define INPUT_BLOCK_SIZE (64 * 1024)
+#define EXPAND_MARKER '\001' // stands in for a '$' that expands
+
+// Stand-ins for unquoted glob and brace characters; quoted ones stay literal
+#define GLOB_STAR '\003'
+#define GLOB_ANY '\004'
+#define GLOB_CLASS '\005' // '['
+#define BRACE_OPEN '\006'
+#define BRACE_COMMA '\007'
+#define BRACE_CLOSE '\010'
+#define GLOB_MARKERS "\003\004\005\006\007\010"
+
+// Job status enumeration
+typedef enum
+{
+    RUNNING,
+    STOPPED,
+    DONE
+} JobStatus;
+
+// Resources used by a job's processes, summed as each one is reaped
+typedef struct
+{
+    double user_time;
+    double sys_time;
+    long max_rss; // KiB, the largest of any process
+} JobUsage;
+
+// Structure to hold job information. The pids and the command string
+// share the job's allocation.
+typedef struct
+{
+    pid_t pid; // process group id (the first stage's pid)
+    int job_id;
+    JobStatus status;
+    int foreground;     // the shell is waiting for this job
+    int wait_status;    // exit status of the last stage
+    int stop_status;    // status of the most recent stop
+    pid_t status_pid;   // the last stage, whose exit status is the job's
+    int process_count;
+    int live_processes; // processes not yet reaped
+    JobUsage usage;
+    pid_t *pids;
+    char *command;
+} Job;
+
+typedef struct
+{
+    pid_t pid;
+    Job *job;
+} PidMapEntry;
+
+// Growable job table: slots are indexed by job id - 1 and every process
+// of every job is indexed by pid, so both lookups are O(1)
+typedef struct
+{
+    Job **slots;
+    int slot_count;
+    int highest_id;
+    int job_count;
+    PidMapEntry *pid_map;
+    size_t pid_map_capacity;
+    size_t pid_map_used; // live entries plus tombstones
+} JobTable;
+
+// Global variables declaration
+extern JobTable job_table;
+
+// Lexer output: each token is a slice of the input line.
+// Word slices have their quotes and escapes already removed in place.
+typedef enum
+{
+    TOKEN_WORD,
+    TOKEN_PIPE,
+    TOKEN_INPUT,
+    TOKEN_OUTPUT,
+    TOKEN_APPEND,
+    TOKEN_BACKGROUND,
+    TOKEN_SEPARATOR
+} TokenType;
+
+typedef struct
+{
+    TokenType type;
+    uint32_t offset;
+    uint32_t length;
+    int expand; // word contains EXPAND_MARKER or glob markers
+} Token;
+
+typedef struct
+{
+    Token *tokens; // arena-allocated
+    size_t count;
+    size_t capacity;
+} TokenList;
+
+typedef enum
+{
+    COMMAND_PIPELINE,
+    COMMAND_IF,
+    COMMAND_WHILE,
+    COMMAND_FOR
+} CommandType;
+
+// Structure to hold command information.
+// A pipeline is a list of stages linked through `next`; the first stage
+// carries the pipe_count and background flag for the whole pipeline.
+// Control-flow nodes reuse the structure: their blocks are lists of
+// commands linked through `list_next`, and a for loop keeps its variable
+// and words in args.
+typedef struct Command
+{
+    CommandType type;
+    char **args;       // NULL-terminated; MAX_ARGS slots as parsed, any length once expanded
+    char *input_file;  // NULL when not redirected
+    char *output_file; // NULL when not redirected
+    int append_output;
+    int background;
+    int pipe_count;
+    int expand; // some word of this stage needs $, brace or glob expansion
+    struct Command *next;
+    struct Command *condition; // if/while
+    struct Command *body;      // then / do
+    struct Command *else_body; // else, or a nested if for elif
+    struct Command *list_next; // next command in the same list
+} Command;
+
+// Source of input lines for the interpreter, parsed into pipelines
+typedef struct CommandReader
+{
+    // Returns 1 with the next line's pipelines (linked through list_next),
+    // 0 at end of input, or -1 on a syntax error
+    int (*next)(struct CommandReader *reader, int nested, Command **list);
+    Command *pending; // pipelines read but not yet consumed
+    Arena *arena;     // where control-flow nodes are built
+} CommandReader;
+
+// Parsed-script cache records (script_cache.c). Everything is addressed by
+// index or offset, never by pointer, so a cache file can be mapped anywhere.
+#define CACHED_BACKGROUND 0x1
+#define CACHED_PARSE_ERROR 0x2 // first/count locate the line in the script
+#define CACHED_CONTINUED 0x4   // the next pipeline is on the same source line
+#define CACHED_NO_STRING UINT32_MAX
+#define CACHED_APPEND_OUTPUT 0x1
+#define CACHED_EXPAND 0x2
+
+typedef struct
+{
+    uint32_t first; // first stage
+    uint32_t count; // number of stages
+    uint32_t flags;
+} CachedLine;
+
+typedef struct
+{
+    uint32_t first_arg; // index into the argument table
+    uint32_t argc;
+    uint32_t input_file;  // string table offset, or CACHED_NO_STRING
+    uint32_t output_file; // string table offset, or CACHED_NO_STRING
+    uint32_t flags;       // CACHED_APPEND_OUTPUT, CACHED_EXPAND
+} CachedStage;
+
+// A compiled script: either a mapped cache file or one just built
+typedef struct
+{
+    const CachedLine *lines;
+    uint32_t line_count;
+    const CachedStage *stages;
+    const uint32_t *args;
+    char *strings;
+    const char *source; // the script text, for re-reporting parse errors
+    size_t source_size;
+    void *image;
+    size_t image_size;
+    int image_mapped;
+} CompiledScript;
+
+// Foreground job tracking (defined in shell.c)
+extern pid_t current_foreground_pgid;
+extern char current_command[MAX_INPUT_SIZE];
+extern int shell_is_interactive;
+extern int shell_script_mode;
+extern int parse_errors_quiet;
+extern int shell_running;
+extern int command_interrupted;
+extern int loop_depth;
+extern int last_exit_status;
+extern JobUsage last_job_usage; // usage of the last foreground job
+extern int spawn_enabled;
+extern int in_pipeline_stage;
+extern sigset_t child_sigmask;
+
+// How create_process should wire up one pipeline stage
+typedef struct
+{
+    const char *path;        // cached location from path_cache_lookup, or NULL
+    pid_t pgid;              // process group to join, 0 to start a new one
+    int in_fd;               // pipe end to use as stdin, or -1
+    int out_fd;              // pipe end to use as stdout, or -1
+    int err_fd;              // descriptor to use as stderr, or -1
+    int close_fd;            // other pipe end the child must not keep, or -1
+    const sigset_t *sigmask; // signal mask the child should run with
+    int *start_status;       // exit status if the stage cannot be started
+} ProcessSetup;
+
+// Where a whole pipeline reads and writes; -1 keeps the shell's own
+typedef struct
+{
+    int in_fd;  // stdin of the first stage
+    int out_fd; // stdout of the last stage
+    int err_fd; // stderr of every stage
+} PipelineIO;
+
+// Function declarations
+void initialize_shell(void);
+void shell_loop(CommandReader *reader);
+char *read_line(void);
+int input_from_file(const char *path);
+void input_from_string(char *text);
+Command *parse_command(char *line, Arena *arena);
+Command *new_command(Arena *arena);
+int tokenize(char *line, size_t len, Arena *arena, TokenList *list);
+int execute_command(Command *cmd);
+int execute_builtin(Command *cmd);
+int is_builtin(const char *name);
+void handle_signal(int signo);
+
+// Event loop (events.c)
+void setup_signal_handlers(void);
+void block_shell_signals(sigset_t *saved);
+void dispatch_signals(void);
+void wait_for_input(void);
+void wait_for_signal(void);
+int wait_for_fd(int fd);
+
+// Built-in commands: each returns the command's exit status
+int shell_cd(char **args);
+int shell_pwd(char **args);
+int shell_exit(char **args);
+void shell_cleanup(void);
+int shell_help(char **args);
+int shell_jobs(char **args);
+int shell_fg(char **args);
+int shell_bg(char **args);
+int shell_memstat(char **args);
+int shell_memcheck(char **args);
+int shell_hash(char **args);
+int shell_parallel(char **args);
+int shell_stats(char **args);
+int shell_time(char **args);
+
+// In-process utilities (builtins.c)
+int shell_echo(char **args);
+int shell_true(char **args);
+int shell_false(char **args);
+int shell_test(char **args);
+int shell_printf(char **args);
+
+// Job control functions
+Job *add_job(pid_t pgid, const pid_t *pids, int count, const char *command, int background);
+void remove_job(int job_id);
+Job *find_job(int job_id);
+Job *find_job_by_pid(pid_t pid);
+void free_job_table(void);
+void update_job_status(void);
+void print_jobs(void);
+
+// Process management functions
+pid_t create_process(Command *stage, const ProcessSetup *setup);
+int execute_pipeline(Command *cmd);
+pid_t start_pipeline(Command *cmd, const PipelineIO *io, pid_t *pids, int *started, pid_t *last_pid,
+                     int *last_status);
+void format_pipeline(const Command *cmd, char *buffer, size_t size);
+int wait_for_job(Job *job);
+int exit_status_from_wait(int status);
+void give_terminal_to(pid_t pgid);
+void handle_background_process(pid_t pgid, const pid_t *pids, int count, const char *command);
+
+// I/O redirection functions
+int open_redirection(const char *file, int flags);
+int setup_io_redirection(Command *cmd);
+void reset_io_redirection(int stdin_copy, int stdout_copy);
+
+// Command location cache (path_cache.c)
+const char *path_cache_lookup(const char *name);
+void path_cache_reset(void);
+void path_cache_chdir(void);
+
+// Control flow and expansion (interpreter.c)
+int read_command_list(CommandReader *reader, Command **list);
+int list_opens_block(const Command *list);
+int relocate_commands(Command *list, Arena *arena);
+int execute_list(Command *list, Arena *arena);
+Command *expand_pipeline(Command *cmd, Arena *arena);
+
+// Shell variables (variables.c); lookups fall back to the environment
+const char *get_variable(const char *name);
+int set_variable(const char *name, const char *value);
+void free_variables(void);
+
+// Timing and latency histograms (stats.c)
+uint64_t monotonic_ns(void);
+void stats_process_started(const char *name, pid_t pid, uint64_t spawn_ns);
+void stats_process_exited(pid_t pid);
+void stats_reset(void);
+int time_command(Command *cmd);
+
+// Parsed-script cache (script_cache.c)
+int script_cache_open(const char *path, CompiledScript *script);
+Command *script_command(const CompiledScript *script, uint32_t index, Arena *arena);
+void script_cache_close(CompiledScript *script);
+
+// Line editor and tab completion (line_editor.c, completion.c)
+#define COMPLETION_SHOW 100 // candidates listed at most
+
+typedef struct
+{
+    size_t replace_start; // the typed text from here to the cursor is replaced
+    char common[PATH_MAX]; // longest prefix of every candidate, unescaped
+    size_t common_length;
+    char suffix;           // follows a unique candidate: ' ' or '/'
+    size_t total;          // candidates, including those not shown
+    char *shown[COMPLETION_SHOW]; // sorted; directories end in '/'
+    size_t shown_count;
+} Completions;
+
+char *edit_line(const char *prompt);
+void completion_prepare(void);
+void completion_reset(void);
+size_t complete_line(const char *line, size_t cursor, Completions *result);
+void completions_free(Completions *result);
+const char *builtin_name(size_t index);
+
+// Brace and pathname expansion (glob.c)
+typedef struct
+{
+    char **words; // NULL-terminated, in the arena
+    size_t count;
+    size_t capacity;
+} WordList;
+
+int word_list_add(WordList *list, char *word, Arena *arena);
+int expand_glob(const char *word, WordList *list, Arena *arena);
+void glob_cache_reset(void);
+
+// Zero-copy file utilities (file_builtins.c)
+int shell_cat(char **args);
+int shell_cp(char **args);
+int shell_tee(char **args);
+
+// Persistent command history (history.c)
+void history_add(const char *line);
+uint32_t history_count(void);
+const char *history_entry(uint32_t index, size_t *length);
+long history_search(const char *text, int prefix, long before);
+void history_close(void);
+int shell_history(char **args);
+
+// Environment variable functions
+char *get_env_value(const char *name);
+int set_env_value(const char *name, const char *value);
+
 #endif /* SHELL_H */
\ No newline at end of file
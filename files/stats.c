@@ -0,0 +1,340 @@
+#include "shell.h"
+#include <sys/resource.h>
+#include <time.h>
+
+// Per-command latency histograms: how long starting each process took
+// (fork/posix_spawn until the call returned) and how long it then ran
+// until it was reaped. Buckets are powers of two in microseconds, so
+// recording a sample is a clz and an increment.
+
+#define STATS_BUCKETS 32
+#define STATS_TABLE_BUCKETS 64
+
+typedef struct CommandStats
+{
+    struct CommandStats *next;
+    unsigned long spawned;
+    unsigned long exited;
+    uint64_t spawn_total_ns;
+    uint64_t run_total_ns;
+    uint32_t spawn_hist[STATS_BUCKETS];
+    uint32_t run_hist[STATS_BUCKETS];
+    char name[];
+} CommandStats;
+
+// A started process that has not been reaped yet
+typedef struct
+{
+    pid_t pid;
+    uint64_t started_ns;
+    CommandStats *stats;
+} LiveProcess;
+
+static CommandStats *stats_table[STATS_TABLE_BUCKETS];
+static size_t stats_count = 0;
+static LiveProcess *live = NULL;
+static size_t live_count = 0;
+static size_t live_capacity = 0;
+
+JobUsage last_job_usage;
+
+uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// FNV-1a
+static unsigned int hash_stats_name(const char *name)
+{
+    unsigned int hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash % STATS_TABLE_BUCKETS;
+}
+
+static CommandStats *stats_for(const char *name)
+{
+    unsigned int bucket = hash_stats_name(name);
+    for (CommandStats *stats = stats_table[bucket]; stats; stats = stats->next)
+    {
+        if (strcmp(stats->name, name) == 0)
+            return stats;
+    }
+
+    CommandStats *stats = shell_malloc(sizeof(CommandStats) + strlen(name) + 1);
+    if (!stats)
+        return NULL;
+    memset(stats, 0, sizeof(CommandStats));
+    strcpy(stats->name, name);
+    stats->next = stats_table[bucket];
+    stats_table[bucket] = stats;
+    stats_count++;
+    return stats;
+}
+
+// Bucket 0 holds samples under 1us; bucket i holds [2^(i-1), 2^i) us
+static int bucket_of(uint64_t ns)
+{
+    uint64_t usec = ns / 1000;
+    if (usec == 0)
+        return 0;
+    int bucket = 64 - __builtin_clzll(usec);
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+void stats_process_started(const char *name, pid_t pid, uint64_t spawn_ns)
+{
+    CommandStats *stats = stats_for(name);
+    if (!stats)
+        return;
+    stats->spawned++;
+    stats->spawn_total_ns += spawn_ns;
+    stats->spawn_hist[bucket_of(spawn_ns)]++;
+
+    if (live_count == live_capacity)
+    {
+        size_t capacity = live_capacity ? live_capacity * 2 : 16;
+        LiveProcess *grown = shell_realloc(live, capacity * sizeof(LiveProcess));
+        if (!grown)
+            return;
+        live = grown;
+        live_capacity = capacity;
+    }
+    live[live_count++] = (LiveProcess){pid, monotonic_ns(), stats};
+}
+
+void stats_process_exited(pid_t pid)
+{
+    // Only a handful of processes are ever alive at once
+    for (size_t i = 0; i < live_count; i++)
+    {
+        if (live[i].pid != pid)
+            continue;
+
+        // Entries dropped by `stats -r` are no longer counted
+        CommandStats *stats = live[i].stats;
+        if (stats)
+        {
+            uint64_t run_ns = monotonic_ns() - live[i].started_ns;
+            stats->exited++;
+            stats->run_total_ns += run_ns;
+            stats->run_hist[bucket_of(run_ns)]++;
+        }
+        live[i] = live[--live_count];
+        return;
+    }
+}
+
+static void free_command_stats(void)
+{
+    for (int i = 0; i < STATS_TABLE_BUCKETS; i++)
+    {
+        CommandStats *stats = stats_table[i];
+        while (stats)
+        {
+            CommandStats *next = stats->next;
+            shell_free(stats);
+            stats = next;
+        }
+        stats_table[i] = NULL;
+    }
+    stats_count = 0;
+}
+
+void stats_reset(void)
+{
+    free_command_stats();
+    shell_free(live);
+    live = NULL;
+    live_count = live_capacity = 0;
+}
+
+// Upper bound, in microseconds, of the bucket holding the given quantile
+static uint64_t quantile_usec(const uint32_t *hist, unsigned long total, double quantile)
+{
+    unsigned long rank = (unsigned long)(total * quantile);
+    unsigned long seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += hist[i];
+        if (seen > rank)
+            return (uint64_t)1 << i;
+    }
+    return (uint64_t)1 << (STATS_BUCKETS - 1);
+}
+
+static int compare_stats_name(const void *a, const void *b)
+{
+    return strcmp((*(CommandStats *const *)a)->name, (*(CommandStats *const *)b)->name);
+}
+
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+static void print_json_histogram(const char *key, unsigned long count, uint64_t total_ns, const uint32_t *hist)
+{
+    int used = STATS_BUCKETS;
+    while (used > 0 && hist[used - 1] == 0)
+        used--;
+
+    printf("\"%s\": {\"count\": %lu, \"total_us\": %llu, \"buckets\": [", key, count,
+           (unsigned long long)(total_ns / 1000));
+    for (int i = 0; i < used; i++)
+        printf("%s%u", i ? ", " : "", hist[i]);
+    printf("]}");
+}
+
+static void print_stats_json(CommandStats **sorted)
+{
+    printf("{\"bucket_unit\": \"us\", \"bucket_bounds\": \"bucket 0 < 1, bucket i < 2^i\", \"commands\": [");
+    for (size_t i = 0; i < stats_count; i++)
+    {
+        CommandStats *stats = sorted[i];
+        printf("%s\n  {\"name\": ", i ? "," : "");
+        print_json_string(stats->name);
+        printf(", ");
+        print_json_histogram("spawn", stats->spawned, stats->spawn_total_ns, stats->spawn_hist);
+        printf(", ");
+        print_json_histogram("run", stats->exited, stats->run_total_ns, stats->run_hist);
+        printf("}");
+    }
+    printf("%s]}\n", stats_count ? "\n" : "");
+}
+
+static void print_stats_table(CommandStats **sorted)
+{
+    printf("%-20s %7s %10s %10s %10s %12s %12s %12s\n", "command", "count", "spawn avg", "spawn p50",
+           "spawn p99", "run avg", "run p50", "run p99");
+    for (size_t i = 0; i < stats_count; i++)
+    {
+        CommandStats *stats = sorted[i];
+        unsigned long spawned = stats->spawned ? stats->spawned : 1;
+        unsigned long exited = stats->exited ? stats->exited : 1;
+        printf("%-20s %7lu %10llu %10llu %10llu %12llu %12llu %12llu\n", stats->name, stats->spawned,
+               (unsigned long long)(stats->spawn_total_ns / 1000 / spawned),
+               (unsigned long long)quantile_usec(stats->spawn_hist, stats->spawned, 0.5),
+               (unsigned long long)quantile_usec(stats->spawn_hist, stats->spawned, 0.99),
+               (unsigned long long)(stats->run_total_ns / 1000 / exited),
+               (unsigned long long)quantile_usec(stats->run_hist, stats->exited, 0.5),
+               (unsigned long long)quantile_usec(stats->run_hist, stats->exited, 0.99));
+    }
+    printf("(microseconds; percentiles are power-of-two bucket bounds)\n");
+}
+
+int shell_stats(char **args)
+{
+    int json = 0;
+    for (int i = 1; args[i]; i++)
+    {
+        if (strcmp(args[i], "-r") == 0)
+        {
+            for (size_t j = 0; j < live_count; j++)
+                live[j].stats = NULL;
+            free_command_stats();
+            return 0;
+        }
+        if (strcmp(args[i], "--json") == 0)
+            json = 1;
+        else
+        {
+            fprintf(stderr, "stats: %s: invalid option\n", args[i]);
+            return 2;
+        }
+    }
+
+    CommandStats **sorted = shell_malloc((stats_count ? stats_count : 1) * sizeof(CommandStats *));
+    if (!sorted)
+    {
+        fprintf(stderr, "stats: out of memory\n");
+        return 1;
+    }
+    size_t n = 0;
+    for (int i = 0; i < STATS_TABLE_BUCKETS; i++)
+    {
+        for (CommandStats *stats = stats_table[i]; stats; stats = stats->next)
+            sorted[n++] = stats;
+    }
+    qsort(sorted, n, sizeof(CommandStats *), compare_stats_name);
+
+    if (json)
+        print_stats_json(sorted);
+    else
+        print_stats_table(sorted);
+    shell_free(sorted);
+    return 0;
+}
+
+static double timeval_seconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void print_time(const char *label, double seconds)
+{
+    int minutes = (int)(seconds / 60);
+    fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+// Run a command and report its real, user and sys time and peak RSS.
+// Child usage comes from wait4 as the job's processes are reaped; the
+// shell's own share covers builtins and the cost of starting the job.
+int time_command(Command *cmd)
+{
+    struct rusage before, after;
+    memset(&last_job_usage, 0, sizeof(last_job_usage));
+    getrusage(RUSAGE_SELF, &before);
+    uint64_t start = monotonic_ns();
+
+    int status = execute_command(cmd);
+
+    uint64_t elapsed = monotonic_ns() - start;
+    getrusage(RUSAGE_SELF, &after);
+
+    double user = timeval_seconds(after.ru_utime) - timeval_seconds(before.ru_utime) + last_job_usage.user_time;
+    double sys = timeval_seconds(after.ru_stime) - timeval_seconds(before.ru_stime) + last_job_usage.sys_time;
+    long max_rss = last_job_usage.max_rss ? last_job_usage.max_rss : after.ru_maxrss;
+
+    print_time("\nreal", elapsed / 1e9);
+    print_time("user", user);
+    print_time("sys", sys);
+    fprintf(stderr, "maxrss\t%ld KiB\n", max_rss);
+    return status;
+}
+
+// Only reached in a forked stage, for `time` inside a pipeline or as a
+// parallel task; a `time` prefix on a whole pipeline is handled by the
+// interpreter
+int shell_time(char **args)
+{
+    Command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = COMMAND_PIPELINE;
+    cmd.args = args + 1;
+
+    // The stage is not the shell: it cannot hand the terminal around
+    sigset_t saved_mask;
+    block_shell_signals(&saved_mask);
+    shell_is_interactive = 0;
+
+    int status = time_command(&cmd);
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+    return status;
+}
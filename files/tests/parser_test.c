@@ -0,0 +1,61 @@
+// Checks the words parse_command produces for lines that have tripped
+// up the lexer: trailing backslashes and dollars that start no name.
+//
+// Usage: parser_test
+#include "../shell.h"
+
+static int failures = 0;
+
+// Parse `text` and compare each stage's words with `expected`, where
+// stages are separated by a "|" entry and the list ends with NULL
+static void check(const char *text, const char **expected)
+{
+    // The line sits in a larger buffer, so reading past its end would
+    // pick up the bytes that follow instead of crashing
+    char line[256];
+    memset(line, 'X', sizeof(line));
+    memcpy(line, text, strlen(text) + 1);
+
+    Arena arena;
+    arena_init(&arena, COMMAND_ARENA_SIZE);
+    Command *cmd = parse_command(line, &arena);
+    int ok = cmd != NULL;
+    int arg = 0;
+    for (const char **word = expected; ok && *word; word++)
+    {
+        if (strcmp(*word, "|") == 0)
+        {
+            cmd = cmd->next;
+            arg = 0;
+            ok = cmd != NULL;
+            continue;
+        }
+        ok = cmd->args[arg] && strcmp(cmd->args[arg], *word) == 0;
+        arg++;
+    }
+    ok = ok && cmd->args[arg] == NULL && cmd->next == NULL;
+    if (!ok)
+    {
+        fprintf(stderr, "FAIL: %s\n", text);
+        failures++;
+    }
+    arena_destroy(&arena);
+}
+
+int main(void)
+{
+    init_memory_manager(1024 * 1024);
+
+    check("echo a\\", (const char *[]){"echo", "a", NULL});
+    check("echo a\\\\ | cat", (const char *[]){"echo", "a\\", "|", "cat", NULL});
+    check("echo a\\\\| cat", (const char *[]){"echo", "a\\", "|", "cat", NULL});
+    check("echo a\\| cat", (const char *[]){"echo", "a|", "cat", NULL});
+    check("echo \"a$\"b", (const char *[]){"echo", "a$b", NULL});
+    check("echo a$\"b\"", (const char *[]){"echo", "a$b", NULL});
+    check("echo $ a$", (const char *[]){"echo", "$", "a$", NULL});
+
+    if (failures)
+        return EXIT_FAILURE;
+    printf("parser_test: all passed\n");
+    return EXIT_SUCCESS;
+}
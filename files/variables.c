@@ -0,0 +1,97 @@
+#include "shell.h"
+
+// Shell variables, set by assignments and for loops. Values are kept in
+// buffers that are reused while the new value fits, so a loop variable
+// is updated without allocating on every iteration.
+typedef struct Variable
+{
+    struct Variable *next;
+    char *value;
+    size_t capacity;
+    char name[];
+} Variable;
+
+#define VARIABLE_BUCKETS 64
+
+static Variable *variables[VARIABLE_BUCKETS];
+
+// FNV-1a
+static unsigned int hash_variable(const char *name)
+{
+    unsigned int hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash % VARIABLE_BUCKETS;
+}
+
+static Variable *find_variable(const char *name)
+{
+    for (Variable *var = variables[hash_variable(name)]; var; var = var->next)
+    {
+        if (strcmp(var->name, name) == 0)
+            return var;
+    }
+    return NULL;
+}
+
+const char *get_variable(const char *name)
+{
+    Variable *var = find_variable(name);
+    return var ? var->value : get_env_value(name);
+}
+
+int set_variable(const char *name, const char *value)
+{
+    size_t length = strlen(value) + 1;
+    Variable *var = find_variable(name);
+
+    if (!var)
+    {
+        var = shell_malloc(sizeof(Variable) + strlen(name) + 1);
+        if (!var)
+        {
+            fprintf(stderr, "%s: out of memory\n", name);
+            return -1;
+        }
+        strcpy(var->name, name);
+        var->value = NULL;
+        var->capacity = 0;
+
+        unsigned int bucket = hash_variable(name);
+        var->next = variables[bucket];
+        variables[bucket] = var;
+    }
+
+    if (length > var->capacity)
+    {
+        char *buffer = shell_realloc(var->value, length);
+        if (!buffer)
+        {
+            fprintf(stderr, "%s: out of memory\n", name);
+            return -1;
+        }
+        var->value = buffer;
+        var->capacity = length;
+    }
+    memcpy(var->value, value, length);
+    return 0;
+}
+
+void free_variables(void)
+{
+    for (int i = 0; i < VARIABLE_BUCKETS; i++)
+    {
+        Variable *var = variables[i];
+        while (var)
+        {
+            Variable *next = var->next;
+            shell_free(var->value);
+            shell_free(var);
+            var = next;
+        }
+        variables[i] = NULL;
+    }
+}